@@ -1,13 +1,17 @@
 #version 330 core
 
 layout(location = 0) in vec3 position;
+layout(location = 1) in float size;  // Particle::size, in pixels
+layout(location = 2) in float alpha; // Particle::alpha
 
 uniform mat4 view;
 uniform mat4 proj;
+uniform float pointScale; // render target width over window width
 
 out vec4 particleColor;
 
 void main() {
     gl_Position = proj * view * vec4(position, 1.0);
-    particleColor = vec4(0.0, 0.5, 1.0, 1.0); // ˮɫ
+    gl_PointSize = size * pointScale;
+    particleColor = vec4(0.0, 0.5, 1.0, alpha); // ˮɫ
 }
@@ -4,5 +4,10 @@ in vec4 particleColor;
 out vec4 fragColor;
 
 void main() {
+    // Round bubbles instead of square sprites
+    vec2 offset = gl_PointCoord - vec2(0.5);
+    if (dot(offset, offset) > 0.25) {
+        discard;
+    }
     fragColor = particleColor; // ʹôɫ
 }
@@ -0,0 +1,436 @@
+#include "bvh.h"
+#include <float.h>
+#include <math.h>
+
+/*---------------------------------------AABB-----------------------------------------*/
+
+AABB aabb_empty () {
+	AABB box;
+	for (int i = 0; i < 3; i++) {
+		box.min[i] = FLT_MAX;
+		box.max[i] = -FLT_MAX;
+	}
+	return box;
+}
+
+AABB aabb_from_points (const std::vector<vec3>& points) {
+	AABB box = aabb_empty ();
+	for (const vec3& p : points) {
+		aabb_grow (box, p.v);
+	}
+	return box;
+}
+
+void aabb_grow (AABB& box, const float p[3]) {
+	for (int i = 0; i < 3; i++) {
+		if (p[i] < box.min[i]) { box.min[i] = p[i]; }
+		if (p[i] > box.max[i]) { box.max[i] = p[i]; }
+	}
+}
+
+void aabb_merge (AABB& box, const AABB& other) {
+	for (int i = 0; i < 3; i++) {
+		if (other.min[i] < box.min[i]) { box.min[i] = other.min[i]; }
+		if (other.max[i] > box.max[i]) { box.max[i] = other.max[i]; }
+	}
+}
+
+bool aabb_is_empty (const AABB& box) {
+	return box.min[0] > box.max[0] || box.min[1] > box.max[1] || box.min[2] > box.max[2];
+}
+
+float aabb_surface_area (const AABB& box) {
+	if (aabb_is_empty (box)) {
+		return 0.0f;
+	}
+	float dx = box.max[0] - box.min[0];
+	float dy = box.max[1] - box.min[1];
+	float dz = box.max[2] - box.min[2];
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+vec3 aabb_center (const AABB& box) {
+	return vec3 (
+		0.5f * (box.min[0] + box.max[0]),
+		0.5f * (box.min[1] + box.max[1]),
+		0.5f * (box.min[2] + box.max[2])
+	);
+}
+
+// Arvo's method: project the box extents onto each row of the matrix
+AABB aabb_transform (const AABB& box, const mat4& m) {
+	AABB out;
+	for (int row = 0; row < 3; row++) {
+		out.min[row] = out.max[row] = m.m[12 + row];
+		for (int col = 0; col < 3; col++) {
+			float a = m.m[col * 4 + row] * box.min[col];
+			float b = m.m[col * 4 + row] * box.max[col];
+			out.min[row] += (a < b) ? a : b;
+			out.max[row] += (a < b) ? b : a;
+		}
+	}
+	return out;
+}
+
+/*-------------------------------------FRUSTUM----------------------------------------*/
+
+// Gribb/Hartmann plane extraction, rows of a column-major matrix
+Frustum frustum_from_matrix (const mat4& pv) {
+	const float* m = pv.m;
+	float rows[4][4];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++) {
+			rows[r][c] = m[c * 4 + r];
+		}
+	}
+	Frustum f;
+	for (int i = 0; i < 3; i++) {
+		for (int c = 0; c < 4; c++) {
+			f.planes[i * 2 + 0][c] = rows[3][c] + rows[i][c];
+			f.planes[i * 2 + 1][c] = rows[3][c] - rows[i][c];
+		}
+	}
+	for (int p = 0; p < 6; p++) {
+		float len = sqrtf (f.planes[p][0] * f.planes[p][0] + f.planes[p][1] * f.planes[p][1] + f.planes[p][2] * f.planes[p][2]);
+		if (len > 0.0f) {
+			for (int c = 0; c < 4; c++) {
+				f.planes[p][c] /= len;
+			}
+		}
+	}
+	return f;
+}
+
+enum FrustumResult { FRUSTUM_OUTSIDE, FRUSTUM_INTERSECT, FRUSTUM_INSIDE };
+
+// p-vertex / n-vertex test against all six planes
+static FrustumResult frustum_classify (const Frustum& f, const float bmin[3], const float bmax[3]) {
+	FrustumResult result = FRUSTUM_INSIDE;
+	for (int p = 0; p < 6; p++) {
+		const float* pl = f.planes[p];
+		float px = pl[0] >= 0.0f ? bmax[0] : bmin[0];
+		float py = pl[1] >= 0.0f ? bmax[1] : bmin[1];
+		float pz = pl[2] >= 0.0f ? bmax[2] : bmin[2];
+		if (pl[0] * px + pl[1] * py + pl[2] * pz + pl[3] < 0.0f) {
+			return FRUSTUM_OUTSIDE;
+		}
+		float nx = pl[0] >= 0.0f ? bmin[0] : bmax[0];
+		float ny = pl[1] >= 0.0f ? bmin[1] : bmax[1];
+		float nz = pl[2] >= 0.0f ? bmin[2] : bmax[2];
+		if (pl[0] * nx + pl[1] * ny + pl[2] * nz + pl[3] < 0.0f) {
+			result = FRUSTUM_INTERSECT;
+		}
+	}
+	return result;
+}
+
+bool frustum_intersects_aabb (const Frustum& f, const AABB& box) {
+	return frustum_classify (f, box.min, box.max) != FRUSTUM_OUTSIDE;
+}
+
+/*---------------------------------------RAYS-----------------------------------------*/
+
+static bool ray_slab_test (const Ray& r, const float inv_dir[3], const float bmin[3], const float bmax[3], float t_max, float& t_hit) {
+	float t0 = 0.0f;
+	float t1 = t_max;
+	for (int i = 0; i < 3; i++) {
+		float near_t = (bmin[i] - r.origin.v[i]) * inv_dir[i];
+		float far_t = (bmax[i] - r.origin.v[i]) * inv_dir[i];
+		if (near_t > far_t) {
+			float tmp = near_t; near_t = far_t; far_t = tmp;
+		}
+		if (near_t > t0) { t0 = near_t; }
+		if (far_t < t1) { t1 = far_t; }
+		if (t0 > t1) {
+			return false;
+		}
+	}
+	t_hit = t0;
+	return true;
+}
+
+static void ray_inverse_direction (const Ray& r, float inv_dir[3]) {
+	for (int i = 0; i < 3; i++) {
+		inv_dir[i] = (r.direction.v[i] != 0.0f) ? 1.0f / r.direction.v[i] : FLT_MAX;
+	}
+}
+
+bool ray_intersects_aabb (const Ray& r, const AABB& box, float t_max, float& t_hit) {
+	float inv_dir[3];
+	ray_inverse_direction (r, inv_dir);
+	return ray_slab_test (r, inv_dir, box.min, box.max, t_max, t_hit);
+}
+
+Ray ray_from_screen (const mat4& proj_view, int x, int y, int width, int height) {
+	mat4 inv = inverse (proj_view);
+	float ndc_x = (2.0f * x) / width - 1.0f;
+	float ndc_y = 1.0f - (2.0f * y) / height;
+	vec4 near_p = inv * vec4 (ndc_x, ndc_y, -1.0f, 1.0f);
+	vec4 far_p = inv * vec4 (ndc_x, ndc_y, 1.0f, 1.0f);
+	Ray r;
+	for (int i = 0; i < 3; i++) {
+		r.origin.v[i] = near_p.v[i] / near_p.v[3];
+		r.direction.v[i] = far_p.v[i] / far_p.v[3] - r.origin.v[i];
+	}
+	r.direction = normalise (r.direction);
+	return r;
+}
+
+/*----------------------------------------BVH-----------------------------------------*/
+
+static const int SAH_BINS = 12;
+static const int MAX_LEAF_SIZE = 4;
+static const float TRAVERSAL_COST = 1.0f;
+static const float INTERSECT_COST = 1.0f;
+// keeps the fixed traversal stacks safe on degenerate inputs
+static const int MAX_SAH_DEPTH = 48;
+
+void StaticBVH::clear () {
+	nodes.clear ();
+	indices.clear ();
+	prim_bounds.clear ();
+	centroids.clear ();
+	max_depth = 0;
+}
+
+void StaticBVH::build (const std::vector<AABB>& bounds) {
+	clear ();
+	prim_bounds = bounds;
+	if (bounds.empty ()) {
+		return;
+	}
+	indices.resize (bounds.size ());
+	centroids.resize (bounds.size ());
+	for (uint32_t i = 0; i < bounds.size (); i++) {
+		indices[i] = i;
+		centroids[i] = aabb_center (bounds[i]);
+	}
+	// a binary tree never has more than 2n - 1 nodes
+	nodes.reserve (bounds.size () * 2);
+	build_recursive (0, (uint32_t)bounds.size (), 1);
+	centroids.clear ();
+	centroids.shrink_to_fit ();
+}
+
+uint32_t StaticBVH::build_recursive (uint32_t first, uint32_t count, int level) {
+	if (level > max_depth) {
+		max_depth = level;
+	}
+	uint32_t node_index = (uint32_t)nodes.size ();
+	nodes.push_back (BVHNode ());
+
+	AABB box = aabb_empty ();
+	AABB centroid_box = aabb_empty ();
+	for (uint32_t i = first; i < first + count; i++) {
+		aabb_merge (box, prim_bounds[indices[i]]);
+		aabb_grow (centroid_box, centroids[indices[i]].v);
+	}
+	for (int i = 0; i < 3; i++) {
+		nodes[node_index].bmin[i] = box.min[i];
+		nodes[node_index].bmax[i] = box.max[i];
+	}
+
+	// find the cheapest split plane over all three axes
+	int best_axis = -1;
+	int best_bin = 0;
+	float best_cost = INTERSECT_COST * count;
+	if (count > 1 && level < MAX_SAH_DEPTH) {
+		for (int axis = 0; axis < 3; axis++) {
+			float lo = centroid_box.min[axis];
+			float extent = centroid_box.max[axis] - lo;
+			if (extent <= 0.0f) {
+				continue;
+			}
+			AABB bin_bounds[SAH_BINS];
+			uint32_t bin_count[SAH_BINS] = { 0 };
+			for (int b = 0; b < SAH_BINS; b++) {
+				bin_bounds[b] = aabb_empty ();
+			}
+			float to_bin = SAH_BINS / extent;
+			for (uint32_t i = first; i < first + count; i++) {
+				int b = (int)((centroids[indices[i]].v[axis] - lo) * to_bin);
+				if (b >= SAH_BINS) { b = SAH_BINS - 1; }
+				bin_count[b]++;
+				aabb_merge (bin_bounds[b], prim_bounds[indices[i]]);
+			}
+			// sweep from the right to get suffix areas, then from the left
+			float right_area[SAH_BINS];
+			uint32_t right_count[SAH_BINS];
+			AABB acc = aabb_empty ();
+			uint32_t n = 0;
+			for (int b = SAH_BINS - 1; b > 0; b--) {
+				aabb_merge (acc, bin_bounds[b]);
+				n += bin_count[b];
+				right_area[b] = aabb_surface_area (acc);
+				right_count[b] = n;
+			}
+			acc = aabb_empty ();
+			n = 0;
+			float parent_area = aabb_surface_area (box);
+			if (parent_area <= 0.0f) {
+				parent_area = 1.0f;
+			}
+			for (int b = 0; b < SAH_BINS - 1; b++) {
+				aabb_merge (acc, bin_bounds[b]);
+				n += bin_count[b];
+				if (n == 0 || right_count[b + 1] == 0) {
+					continue;
+				}
+				float cost = TRAVERSAL_COST + INTERSECT_COST *
+					(aabb_surface_area (acc) * n + right_area[b + 1] * right_count[b + 1]) / parent_area;
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_bin = b;
+				}
+			}
+		}
+	}
+
+	// splitting is not worth it, or every centroid coincides
+	if (best_axis == -1) {
+		if (count <= MAX_LEAF_SIZE || count == 1) {
+			nodes[node_index].right_or_first = first;
+			nodes[node_index].count = count;
+			return node_index;
+		}
+		// too many overlapping objects for one leaf, fall back to a median split
+		best_axis = 0;
+		best_bin = -1;
+	}
+
+	uint32_t mid = first;
+	if (best_bin >= 0) {
+		float lo = centroid_box.min[best_axis];
+		float to_bin = SAH_BINS / (centroid_box.max[best_axis] - lo);
+		for (uint32_t i = first; i < first + count; i++) {
+			int b = (int)((centroids[indices[i]].v[best_axis] - lo) * to_bin);
+			if (b >= SAH_BINS) { b = SAH_BINS - 1; }
+			if (b <= best_bin) {
+				uint32_t tmp = indices[i]; indices[i] = indices[mid]; indices[mid] = tmp;
+				mid++;
+			}
+		}
+	}
+	if (mid == first || mid == first + count) {
+		mid = first + count / 2;
+	}
+
+	build_recursive (first, mid - first, level + 1);
+	uint32_t right = build_recursive (mid, first + count - mid, level + 1);
+	nodes[node_index].right_or_first = right;
+	nodes[node_index].count = 0;
+	return node_index;
+}
+
+// every leaf below node_index without further plane tests
+void StaticBVH::add_subtree (uint32_t node_index, std::vector<uint32_t>& out) const {
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = node_index;
+	while (top > 0) {
+		const BVHNode& node = nodes[stack[--top]];
+		nodes_visited++;
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				out.push_back (indices[node.right_or_first + i]);
+			}
+		}
+		else {
+			stack[top++] = node.right_or_first;
+			stack[top++] = (uint32_t)(&node - &nodes[0]) + 1;
+		}
+	}
+}
+
+void StaticBVH::query_frustum (const Frustum& f, std::vector<uint32_t>& out) const {
+	nodes_visited = 0;
+	if (nodes.empty ()) {
+		return;
+	}
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		uint32_t index = stack[--top];
+		const BVHNode& node = nodes[index];
+		nodes_visited++;
+		FrustumResult result = frustum_classify (f, node.bmin, node.bmax);
+		if (result == FRUSTUM_OUTSIDE) {
+			continue;
+		}
+		if (result == FRUSTUM_INSIDE) {
+			add_subtree (index, out);
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t prim = indices[node.right_or_first + i];
+				if (node.count == 1 || frustum_intersects_aabb (f, prim_bounds[prim])) {
+					out.push_back (prim);
+				}
+			}
+		}
+		else {
+			stack[top++] = node.right_or_first;
+			stack[top++] = index + 1;
+		}
+	}
+}
+
+bool StaticBVH::query_ray (const Ray& r, float t_max, uint32_t& hit_index, float& hit_t) const {
+	nodes_visited = 0;
+	if (nodes.empty ()) {
+		return false;
+	}
+	float inv_dir[3];
+	ray_inverse_direction (r, inv_dir);
+	bool hit = false;
+	float closest = t_max;
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const BVHNode& node = nodes[stack[--top]];
+		nodes_visited++;
+		float t;
+		if (!ray_slab_test (r, inv_dir, node.bmin, node.bmax, closest, t)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t i = 0; i < node.count; i++) {
+				uint32_t prim = indices[node.right_or_first + i];
+				if (ray_slab_test (r, inv_dir, prim_bounds[prim].min, prim_bounds[prim].max, closest, t)) {
+					closest = t;
+					hit_index = prim;
+					hit = true;
+				}
+			}
+			continue;
+		}
+		// visit the nearer child first so the far one is more likely to be culled
+		uint32_t left = (uint32_t)(&node - &nodes[0]) + 1;
+		uint32_t right = node.right_or_first;
+		float tl, tr;
+		bool hit_l = ray_slab_test (r, inv_dir, nodes[left].bmin, nodes[left].bmax, closest, tl);
+		bool hit_r = ray_slab_test (r, inv_dir, nodes[right].bmin, nodes[right].bmax, closest, tr);
+		if (hit_l && hit_r) {
+			if (tl < tr) {
+				stack[top++] = right;
+				stack[top++] = left;
+			}
+			else {
+				stack[top++] = left;
+				stack[top++] = right;
+			}
+		}
+		else if (hit_l) {
+			stack[top++] = left;
+		}
+		else if (hit_r) {
+			stack[top++] = right;
+		}
+	}
+	hit_t = closest;
+	return hit;
+}
@@ -0,0 +1,89 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "maths_funcs.h"
+
+// axis-aligned bounding box in world (or local) space
+struct AABB {
+	float min[3];
+	float max[3];
+};
+
+// plane stored as (a, b, c, d) with ax + by + cz + d >= 0 on the inside
+struct Frustum {
+	float planes[6][4];
+};
+
+struct Ray {
+	vec3 origin;
+	vec3 direction; // does not need to be normalised
+};
+
+// aabb functions
+AABB aabb_empty ();
+AABB aabb_from_points (const std::vector<vec3>& points);
+void aabb_grow (AABB& box, const float p[3]);
+void aabb_merge (AABB& box, const AABB& other);
+bool aabb_is_empty (const AABB& box);
+float aabb_surface_area (const AABB& box);
+vec3 aabb_center (const AABB& box);
+//! bounds of box after an affine transform (column-major, like mat4)
+AABB aabb_transform (const AABB& box, const mat4& m);
+
+// frustum functions
+//! extracts the six clip planes from a combined proj * view matrix
+Frustum frustum_from_matrix (const mat4& proj_view);
+bool frustum_intersects_aabb (const Frustum& f, const AABB& box);
+
+// ray functions
+//! slab test, returns the entry distance in t_hit when the ray hits before t_max
+bool ray_intersects_aabb (const Ray& r, const AABB& box, float t_max, float& t_hit);
+//! ray through window pixel (x, y) for the given proj * view matrix
+Ray ray_from_screen (const mat4& proj_view, int x, int y, int width, int height);
+
+/* flattened node, 32 bytes so two share a cache line.
+   interior nodes: count == 0, the left child is the next node and
+   right_or_first holds the right child index.
+   leaves: count > 0 primitives starting at indices[right_or_first]. */
+struct BVHNode {
+	float bmin[3];
+	uint32_t right_or_first;
+	float bmax[3];
+	uint32_t count;
+};
+
+// bounding volume hierarchy over objects that never move.
+// built once with a binned surface area heuristic; queries return the
+// indices passed to build() in the bounds array.
+class StaticBVH {
+public:
+	void build (const std::vector<AABB>& bounds);
+	void clear ();
+
+	//! appends every primitive whose bounds touch the frustum
+	void query_frustum (const Frustum& f, std::vector<uint32_t>& out) const;
+	//! closest primitive bounds hit by the ray, false when nothing is hit
+	bool query_ray (const Ray& r, float t_max, uint32_t& hit_index, float& hit_t) const;
+
+	size_t node_count () const { return nodes.size (); }
+	size_t primitive_count () const { return prim_bounds.size (); }
+	int depth () const { return max_depth; }
+	//! nodes touched by the most recent query, for profiling
+	int last_nodes_visited () const { return nodes_visited; }
+
+private:
+	uint32_t build_recursive (uint32_t first, uint32_t count, int level);
+	void add_subtree (uint32_t node_index, std::vector<uint32_t>& out) const;
+
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> indices;
+	std::vector<AABB> prim_bounds;
+	std::vector<vec3> centroids;
+	int max_depth = 0;
+	mutable int nodes_visited = 0;
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "clustered_lighting.h"
+#include <math.h>
+#include <chrono>
+
+static double now_us () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+static int clamp_int (int v, int lo, int hi) {
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static void create_buffer_texture (GLuint& buffer, GLuint& texture, GLenum format) {
+	glGenBuffers (1, &buffer);
+	glBindBuffer (GL_TEXTURE_BUFFER, buffer);
+	glBufferData (GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+	glGenTextures (1, &texture);
+	glBindTexture (GL_TEXTURE_BUFFER, texture);
+	glTexBuffer (GL_TEXTURE_BUFFER, format, buffer);
+}
+
+// orphan and refill, a texture buffer keeps pointing at the same buffer name
+static void upload (GLenum target, GLuint buffer, const void* data, size_t bytes) {
+	glBindBuffer (target, buffer);
+	glBufferData (target, bytes > 0 ? bytes : 16, NULL, GL_STREAM_DRAW);
+	if (bytes > 0) {
+		glBufferSubData (target, 0, bytes, data);
+	}
+}
+
+bool ClusteredLighting::init () {
+	create_buffer_texture (light_buffer, light_texture, GL_RGBA32F);
+	create_buffer_texture (grid_buffer, grid_texture, GL_RG32UI);
+	create_buffer_texture (index_buffer, index_texture, GL_R32UI);
+	glBindBuffer (GL_TEXTURE_BUFFER, 0);
+	glBindTexture (GL_TEXTURE_BUFFER, 0);
+
+	glGenBuffers (1, &param_buffer);
+	glBindBuffer (GL_UNIFORM_BUFFER, param_buffer);
+	glBufferData (GL_UNIFORM_BUFFER, sizeof (Params), NULL, GL_STREAM_DRAW);
+	glBindBuffer (GL_UNIFORM_BUFFER, 0);
+
+	grid.resize (CLUSTER_COUNT * 2);
+	return glGetError () == GL_NO_ERROR;
+}
+
+void ClusteredLighting::destroy () {
+	GLuint buffers[] = { light_buffer, grid_buffer, index_buffer, param_buffer };
+	GLuint textures[] = { light_texture, grid_texture, index_texture };
+	glDeleteBuffers (4, buffers);
+	glDeleteTextures (3, textures);
+	light_buffer = grid_buffer = index_buffer = param_buffer = 0;
+	light_texture = grid_texture = index_texture = 0;
+}
+
+void ClusteredLighting::attach (GLuint program, GLuint first_unit) {
+	glUseProgram (program);
+	glUniform1i (glGetUniformLocation (program, "clusterLights"), first_unit);
+	glUniform1i (glGetUniformLocation (program, "clusterGrid"), first_unit + 1);
+	glUniform1i (glGetUniformLocation (program, "clusterIndices"), first_unit + 2);
+	GLuint block = glGetUniformBlockIndex (program, "ClusterParams");
+	if (block != GL_INVALID_INDEX) {
+		glUniformBlockBinding (program, block, 0);
+	}
+}
+
+/*-------------------------------- BINNING --------------------------------*/
+
+void ClusteredLighting::build (const std::vector<ClusterLight>& lights, const mat4& view, const mat4& proj,
+	int width, int height, float z_near, float z_far) {
+	double start = now_us ();
+	float log_ratio = logf (z_far / z_near);
+	float depth_scale = SLICES / log_ratio;
+	float depth_bias = -SLICES * logf (z_near) / log_ratio;
+
+	gpu_lights.clear ();
+	ranges.clear ();
+	range_light.clear ();
+	for (size_t i = 0; i < lights.size (); i++) {
+		const ClusterLight& l = lights[i];
+		const float* p = l.position;
+		const float* d = l.direction;
+		float c[3], dir[3];
+		for (int r = 0; r < 3; r++) {
+			c[r] = view.m[r] * p[0] + view.m[4 + r] * p[1] + view.m[8 + r] * p[2] + view.m[12 + r];
+			dir[r] = view.m[r] * d[0] + view.m[4 + r] * d[1] + view.m[8 + r] * d[2];
+		}
+		// eye looks down -z
+		float dmin = -c[2] - l.radius;
+		float dmax = -c[2] + l.radius;
+		if (dmax < z_near || dmin > z_far) {
+			continue;
+		}
+		dmin = dmin < z_near ? z_near : dmin;
+		dmax = dmax > z_far ? z_far : dmax;
+
+		// screen rectangle of the sphere's eye-space box, clipped to the near plane
+		float nx0 = 1.0f, ny0 = 1.0f, nx1 = -1.0f, ny1 = -1.0f;
+		for (int k = 0; k < 8; k++) {
+			float x = c[0] + ((k & 1) ? l.radius : -l.radius);
+			float y = c[1] + ((k & 2) ? l.radius : -l.radius);
+			float z = (k & 4) ? -dmax : -dmin;
+			float cx = proj.m[0] * x + proj.m[4] * y + proj.m[8] * z + proj.m[12];
+			float cy = proj.m[1] * x + proj.m[5] * y + proj.m[9] * z + proj.m[13];
+			float cw = proj.m[3] * x + proj.m[7] * y + proj.m[11] * z + proj.m[15];
+			nx0 = fminf (nx0, cx / cw);
+			nx1 = fmaxf (nx1, cx / cw);
+			ny0 = fminf (ny0, cy / cw);
+			ny1 = fmaxf (ny1, cy / cw);
+		}
+		if (nx1 < -1.0f || ny1 < -1.0f || nx0 > 1.0f || ny0 > 1.0f) {
+			continue;
+		}
+
+		uint32_t index = (uint32_t)(gpu_lights.size () / 12);
+		float packed[12] = {
+			c[0], c[1], c[2], l.radius,
+			l.color[0], l.color[1], l.color[2], l.intensity,
+			dir[0], dir[1], dir[2], l.cos_outer
+		};
+		gpu_lights.insert (gpu_lights.end (), packed, packed + 12);
+		range_light.push_back (index);
+		ranges.push_back (clamp_int ((int)floorf ((nx0 * 0.5f + 0.5f) * TILES_X), 0, TILES_X - 1));
+		ranges.push_back (clamp_int ((int)floorf ((nx1 * 0.5f + 0.5f) * TILES_X), 0, TILES_X - 1));
+		ranges.push_back (clamp_int ((int)floorf ((ny0 * 0.5f + 0.5f) * TILES_Y), 0, TILES_Y - 1));
+		ranges.push_back (clamp_int ((int)floorf ((ny1 * 0.5f + 0.5f) * TILES_Y), 0, TILES_Y - 1));
+		ranges.push_back (clamp_int ((int)floorf (logf (dmin) * depth_scale + depth_bias), 0, SLICES - 1));
+		ranges.push_back (clamp_int ((int)floorf (logf (dmax) * depth_scale + depth_bias), 0, SLICES - 1));
+	}
+	visible_lights = (int)range_light.size ();
+
+	// count, prefix sum, then scatter the light indices
+	for (size_t i = 0; i < grid.size (); i++) {
+		grid[i] = 0;
+	}
+	for (size_t i = 0; i < range_light.size (); i++) {
+		const int* r = &ranges[i * 6];
+		for (int z = r[4]; z <= r[5]; z++) {
+			for (int y = r[2]; y <= r[3]; y++) {
+				for (int x = r[0]; x <= r[1]; x++) {
+					grid[((z * TILES_Y + y) * TILES_X + x) * 2 + 1]++;
+				}
+			}
+		}
+	}
+	uint32_t offset = 0;
+	max_cluster_lights = 0;
+	for (int i = 0; i < CLUSTER_COUNT; i++) {
+		grid[i * 2] = offset;
+		offset += grid[i * 2 + 1];
+		max_cluster_lights = (int)grid[i * 2 + 1] > max_cluster_lights ? (int)grid[i * 2 + 1] : max_cluster_lights;
+		grid[i * 2 + 1] = 0;
+	}
+	light_references = (int)offset;
+	indices.resize (offset);
+	for (size_t i = 0; i < range_light.size (); i++) {
+		const int* r = &ranges[i * 6];
+		for (int z = r[4]; z <= r[5]; z++) {
+			for (int y = r[2]; y <= r[3]; y++) {
+				for (int x = r[0]; x <= r[1]; x++) {
+					uint32_t* cell = &grid[((z * TILES_Y + y) * TILES_X + x) * 2];
+					indices[cell[0] + cell[1]++] = range_light[i];
+				}
+			}
+		}
+	}
+
+	Params params;
+	params.dims[0] = TILES_X;
+	params.dims[1] = TILES_Y;
+	params.dims[2] = SLICES;
+	params.dims[3] = visible_lights;
+	params.tile_scale[0] = (float)TILES_X / (float)width;
+	params.tile_scale[1] = (float)TILES_Y / (float)height;
+	params.tile_scale[2] = params.tile_scale[3] = 0.0f;
+	params.depth[0] = z_near;
+	params.depth[1] = z_far;
+	params.depth[2] = depth_scale;
+	params.depth[3] = depth_bias;
+
+	upload (GL_TEXTURE_BUFFER, light_buffer, gpu_lights.empty () ? NULL : &gpu_lights[0], gpu_lights.size () * sizeof (float));
+	upload (GL_TEXTURE_BUFFER, grid_buffer, &grid[0], grid.size () * sizeof (uint32_t));
+	upload (GL_TEXTURE_BUFFER, index_buffer, indices.empty () ? NULL : &indices[0], indices.size () * sizeof (uint32_t));
+	glBindBuffer (GL_TEXTURE_BUFFER, 0);
+	upload (GL_UNIFORM_BUFFER, param_buffer, &params, sizeof (params));
+	glBindBuffer (GL_UNIFORM_BUFFER, 0);
+	build_us = now_us () - start;
+}
+
+void ClusteredLighting::bind (GLuint first_unit) {
+	GLuint textures[] = { light_texture, grid_texture, index_texture };
+	for (int i = 0; i < 3; i++) {
+		glActiveTexture (GL_TEXTURE0 + first_unit + i);
+		glBindTexture (GL_TEXTURE_BUFFER, textures[i]);
+	}
+	// object textures are bound to unit 0 without switching units
+	glActiveTexture (GL_TEXTURE0);
+	glBindBufferBase (GL_UNIFORM_BUFFER, 0, param_buffer);
+}
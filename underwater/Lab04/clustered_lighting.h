@@ -0,0 +1,69 @@
+#ifndef _CLUSTERED_LIGHTING_H_
+#define _CLUSTERED_LIGHTING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <GL/glew.h>
+#include "maths_funcs.h"
+
+// point light when cos_outer <= -1, otherwise a spot light around direction
+struct ClusterLight {
+	float position[3]; // world space
+	float radius; // no contribution past this distance
+	float color[3];
+	float intensity;
+	float direction[3]; // world space, normalised
+	float cos_outer; // the cone fades in over the outer quarter
+};
+
+/* clustered forward lighting.
+   the view frustum is split into TILES_X * TILES_Y screen tiles and SLICES
+   exponential depth slices. every frame the lights are binned into the
+   clusters their bounding sphere touches on the CPU, and three texture
+   buffers are filled: the lights in eye space, an (offset, count) pair per
+   cluster and the flattened light index lists. the fragment shader finds its
+   cluster from gl_FragCoord and eye depth and loops over that list only. */
+class ClusteredLighting {
+public:
+	static const int TILES_X = 16;
+	static const int TILES_Y = 9;
+	static const int SLICES = 24;
+	static const int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+
+	bool init ();
+	void destroy ();
+
+	//! hooks a program up to the buffers, first_unit .. first_unit + 2 are used
+	void attach (GLuint program, GLuint first_unit);
+	void build (const std::vector<ClusterLight>& lights, const mat4& view, const mat4& proj,
+		int width, int height, float z_near, float z_far);
+	//! binds the three buffer textures and the parameter block for drawing
+	void bind (GLuint first_unit);
+
+	// stats of the last build
+	int visible_lights = 0;
+	int light_references = 0; // sum of per-cluster list lengths
+	int max_cluster_lights = 0;
+	double build_us = 0.0;
+
+private:
+	// params block, std140: ivec4 dims (x, y, z, light count), vec4 tile_scale (x, y), vec4 depth (near, far, scale, bias)
+	struct Params {
+		int32_t dims[4];
+		float tile_scale[4];
+		float depth[4];
+	};
+
+	GLuint light_buffer = 0, grid_buffer = 0, index_buffer = 0, param_buffer = 0;
+	GLuint light_texture = 0, grid_texture = 0, index_texture = 0;
+
+	// scratch reused every frame
+	std::vector<float> gpu_lights; // 3 vec4 per light
+	std::vector<uint32_t> grid; // offset, count per cluster
+	std::vector<uint32_t> indices;
+	std::vector<int> ranges; // x0, x1, y0, y1, z0, z1 per visible light
+	std::vector<uint32_t> range_light;
+};
+
+#endif
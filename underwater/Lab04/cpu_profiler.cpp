@@ -0,0 +1,129 @@
+#include "cpu_profiler.h"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+struct CpuEvent {
+	const char* name;
+	int64_t begin_ns;
+	int64_t end_ns;
+	int depth;
+};
+
+// written by its own thread only; written is published after the event so the dump never reads a half-filled slot
+struct ThreadBuffer {
+	int tid;
+	std::string name;
+	std::vector<CpuEvent> events;
+	std::atomic<uint64_t> written;
+	const char* open_names[CpuProfiler::MAX_DEPTH];
+	int64_t open_begins[CpuProfiler::MAX_DEPTH];
+	int depth;
+};
+
+// buffers stay alive after their thread exits so its events still make the dump
+static std::mutex registry_lock;
+static std::vector<ThreadBuffer*> registry;
+static thread_local ThreadBuffer* local = NULL;
+
+static int64_t now_ns () {
+	using namespace std::chrono;
+	return (int64_t)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count ();
+}
+
+static ThreadBuffer* thread_buffer () {
+	if (!local) {
+		ThreadBuffer* buffer = new ThreadBuffer ();
+		buffer->events.resize (CpuProfiler::EVENTS_PER_THREAD);
+		buffer->written = 0;
+		buffer->depth = 0;
+		std::lock_guard<std::mutex> guard (registry_lock);
+		buffer->tid = (int)registry.size () + 1;
+		char name[32];
+		snprintf (name, sizeof (name), "thread %d", buffer->tid);
+		buffer->name = buffer->tid == 1 ? "main" : name;
+		registry.push_back (buffer);
+		local = buffer;
+	}
+	return local;
+}
+
+void CpuProfiler::set_thread_name (const char* name) {
+	ThreadBuffer* buffer = thread_buffer ();
+	std::lock_guard<std::mutex> guard (registry_lock);
+	buffer->name = name;
+}
+
+void CpuProfiler::begin (const char* name) {
+	ThreadBuffer* buffer = thread_buffer ();
+	if (buffer->depth < MAX_DEPTH) {
+		buffer->open_names[buffer->depth] = name;
+		buffer->open_begins[buffer->depth] = now_ns ();
+	}
+	buffer->depth++;
+}
+
+void CpuProfiler::end () {
+	int64_t end_ns = now_ns ();
+	ThreadBuffer* buffer = thread_buffer ();
+	if (buffer->depth == 0) {
+		return;
+	}
+	buffer->depth--;
+	if (buffer->depth >= MAX_DEPTH) {
+		return;
+	}
+	uint64_t index = buffer->written.load (std::memory_order_relaxed);
+	CpuEvent& e = buffer->events[index % EVENTS_PER_THREAD];
+	e.name = buffer->open_names[buffer->depth];
+	e.begin_ns = buffer->open_begins[buffer->depth];
+	e.end_ns = end_ns;
+	e.depth = buffer->depth;
+	buffer->written.store (index + 1, std::memory_order_release);
+}
+
+size_t CpuProfiler::event_count () {
+	std::lock_guard<std::mutex> guard (registry_lock);
+	size_t count = 0;
+	for (ThreadBuffer* buffer : registry) {
+		uint64_t written = buffer->written.load (std::memory_order_acquire);
+		count += (size_t)(written < EVENTS_PER_THREAD ? written : EVENTS_PER_THREAD);
+	}
+	return count;
+}
+
+/*--------------------------------- OUTPUT --------------------------------*/
+
+bool CpuProfiler::write_trace (const char* path, const std::string& extra_events) {
+	std::ofstream file (path, std::ios::binary);
+	if (!file) {
+		fprintf (stderr, "ERROR: could not write %s\n", path);
+		return false;
+	}
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}}";
+
+	char line[256];
+	std::lock_guard<std::mutex> guard (registry_lock);
+	for (ThreadBuffer* buffer : registry) {
+		snprintf (line, sizeof (line), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			buffer->tid, buffer->name.c_str ());
+		file << line;
+		uint64_t written = buffer->written.load (std::memory_order_acquire);
+		uint64_t first = written > (uint64_t)EVENTS_PER_THREAD ? written - EVENTS_PER_THREAD : 0;
+		for (uint64_t i = first; i < written; i++) {
+			const CpuEvent& e = buffer->events[i % EVENTS_PER_THREAD];
+			snprintf (line, sizeof (line), ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				e.name, buffer->tid, e.begin_ns * 1e-3, (e.end_ns - e.begin_ns) * 1e-3);
+			file << line;
+		}
+	}
+	if (!extra_events.empty ()) {
+		file << ",\n" << extra_events;
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return (bool)file;
+}
@@ -0,0 +1,51 @@
+#ifndef _CPU_PROFILER_H_
+#define _CPU_PROFILER_H_
+
+#include <stdint.h>
+#include <string>
+
+/* scoped CPU markers written out as a chrome / perfetto trace.
+   every thread records into its own ring of EVENTS_PER_THREAD events, so
+   a marker costs two clock reads and a store with no lock; the only lock
+   is taken once per thread to register its ring. timestamps are
+   steady_clock nanoseconds (QueryPerformanceCounter on windows,
+   clock_gettime elsewhere), the clock GpuProfiler aligns its events to.
+   PROFILE_SCOPE compiles to nothing unless ENABLE_PROFILER is defined,
+   which only the debug configuration does. */
+class CpuProfiler {
+public:
+	static const int EVENTS_PER_THREAD = 1 << 16;
+	static const int MAX_DEPTH = 64;
+
+	//! label of the calling thread in the trace
+	static void set_thread_name (const char* name);
+	//! name must outlive the profiler, a string literal in practice
+	static void begin (const char* name);
+	static void end ();
+
+	//! every recorded event plus extra_events (comma-separated trace events, e.g. from
+	//! GpuProfiler::append_trace_events); a thread recording meanwhile may overwrite its oldest events
+	static bool write_trace (const char* path, const std::string& extra_events);
+	static size_t event_count ();
+};
+
+class CpuScope {
+public:
+	explicit CpuScope (const char* name) { CpuProfiler::begin (name); }
+	~CpuScope () { CpuProfiler::end (); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_ (a, b)
+
+#ifdef ENABLE_PROFILER
+#define PROFILE_SCOPE(name) CpuScope PROFILE_CONCAT (profile_scope_, __LINE__) (name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE (__FUNCTION__)
+#define PROFILE_THREAD(name) CpuProfiler::set_thread_name (name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_FUNCTION() ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif
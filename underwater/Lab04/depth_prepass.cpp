@@ -0,0 +1,124 @@
+#include "depth_prepass.h"
+#include <stdio.h>
+
+bool DepthPrepass::init (float enable_threshold, float disable_threshold) {
+	enable_above = enable_threshold;
+	disable_below = disable_threshold;
+	for (Slot& slot : ring) {
+		glGenQueries (2, slot.queries);
+		slot.used[0] = slot.used[1] = false;
+		slot.pending = false;
+		slot.prepass = false;
+		slot.pixels = 0;
+	}
+	current = 0;
+	open = -1;
+	initialized = true;
+	return glGetError () == GL_NO_ERROR;
+}
+
+void DepthPrepass::destroy () {
+	if (!initialized) {
+		return;
+	}
+	for (Slot& slot : ring) {
+		glDeleteQueries (2, slot.queries);
+	}
+	initialized = false;
+}
+
+// a full ring behind, the results are normally ready; if not, this frame's numbers are dropped
+void DepthPrepass::collect (Slot& slot) {
+	slot.pending = false;
+	GLuint results[2] = { 0, 0 };
+	for (int i = 0; i < 2; i++) {
+		if (!slot.used[i]) {
+			continue;
+		}
+		GLint available = 0;
+		glGetQueryObjectiv (slot.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			return;
+		}
+		glGetQueryObjectuiv (slot.queries[i], GL_QUERY_RESULT, &results[i]);
+	}
+	if (!slot.used[QUERY_DRAWN] || slot.pixels <= 0) {
+		return;
+	}
+	// without the pre-pass everything drawn was also shaded
+	double frame_shaded = slot.used[QUERY_SHADED] ? results[QUERY_SHADED] : results[QUERY_DRAWN];
+	drawn += results[QUERY_DRAWN];
+	shaded += frame_shaded;
+	pixels_total += slot.pixels;
+	frames++;
+	prepass_frames += slot.prepass;
+
+	window_drawn += results[QUERY_DRAWN];
+	window_pixels += slot.pixels;
+	if (++window_frames < WINDOW) {
+		return;
+	}
+	overdraw = (float)(window_drawn / window_pixels);
+	window_drawn = window_pixels = 0.0;
+	window_frames = 0;
+	bool decision = enabled ? overdraw >= disable_below : overdraw > enable_above;
+	if (decision != enabled) {
+		enabled = decision;
+		if (mode == PREPASS_AUTO) {
+			switches++;
+			printf ("=> depth pre-pass %s, overdraw %.2f \n", enabled ? "on" : "off", overdraw);
+		}
+	}
+}
+
+bool DepthPrepass::begin_frame (int pixels, bool available) {
+	if (!initialized) {
+		return false;
+	}
+	Slot& slot = ring[current];
+	if (slot.pending) {
+		collect (slot);
+	}
+	slot.used[0] = slot.used[1] = false;
+	slot.pixels = pixels;
+	slot.prepass = available && (mode == PREPASS_ON || (mode == PREPASS_AUTO && enabled));
+	return slot.prepass;
+}
+
+void DepthPrepass::begin_query (PrepassQuery query) {
+	if (!initialized || open >= 0) {
+		return;
+	}
+	Slot& slot = ring[current];
+	glBeginQuery (GL_SAMPLES_PASSED, slot.queries[query]);
+	slot.used[query] = true;
+	open = query;
+}
+
+void DepthPrepass::end_query () {
+	if (open < 0) {
+		return;
+	}
+	glEndQuery (GL_SAMPLES_PASSED);
+	open = -1;
+}
+
+void DepthPrepass::end_frame () {
+	if (!initialized) {
+		return;
+	}
+	end_query ();
+	ring[current].pending = ring[current].used[QUERY_DRAWN];
+	current = (current + 1) % FRAMES_IN_FLIGHT;
+}
+
+void DepthPrepass::report () {
+	if (frames == 0) {
+		return;
+	}
+	static const char* const names[] = { "auto", "on", "off" };
+	printf ("Overdraw: %.2f fragments drawn and %.2f shaded per pixel, pre-pass (%s) in %d of %d frames, %d switches\n",
+		drawn / pixels_total, shaded / pixels_total, names[mode], prepass_frames, frames, switches);
+	drawn = shaded = pixels_total = 0.0;
+	frames = prepass_frames = switches = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef _DEPTH_PREPASS_H_
+#define _DEPTH_PREPASS_H_
+
+#include <GL/glew.h>
+
+enum PrepassMode {
+	PREPASS_AUTO, // on while the measured overdraw is high
+	PREPASS_ON,
+	PREPASS_OFF
+};
+
+enum PrepassQuery {
+	QUERY_DRAWN, // the first opaque pass, depth tested with GL_LESS
+	QUERY_SHADED // the GL_EQUAL shading pass behind the pre-pass
+};
+
+/* decides whether the opaque passes go behind a depth-only pre-pass, and
+   measures overdraw to make that call.
+   a GL_SAMPLES_PASSED query runs around the first opaque pass of every
+   frame: the pre-pass when it is on, the shading pass when it is off.
+   both draw everything in the same order under GL_LESS, so either way it
+   counts the fragments a shading pass without pre-pass would shade. with
+   the pre-pass on a second query around the GL_EQUAL pass counts what is
+   really shaded. queries come from a ring and are read FRAMES_IN_FLIGHT
+   frames later, so reading them never stalls.
+   every WINDOW frames the mean overdraw (drawn fragments per pixel) is
+   compared against the thresholds; in auto mode the pre-pass turns on
+   above enable_above and off again below disable_below. */
+class DepthPrepass {
+public:
+	static const int FRAMES_IN_FLIGHT = 4;
+	static const int WINDOW = 60;
+
+	bool init (float enable_above, float disable_below);
+	void destroy ();
+
+	void set_mode (PrepassMode m) { mode = m; }
+	PrepassMode get_mode () const { return mode; }
+	//! reads back the queries this frame reuses; true when this frame draws the pre-pass.
+	//! available false (its programs are missing) keeps this frame without it whatever the mode
+	bool begin_frame (int pixels, bool available);
+	void begin_query (PrepassQuery query);
+	void end_query ();
+	void end_frame ();
+
+	//! drawn fragments per pixel over the last full window
+	float get_overdraw () const { return overdraw; }
+	//! overdraw, shaded fragments and pre-pass use since the last report, then resets them
+	void report ();
+
+private:
+	struct Slot {
+		GLuint queries[2];
+		bool used[2];
+		bool pending;
+		bool prepass;
+		int pixels;
+	};
+
+	void collect (Slot& slot);
+
+	PrepassMode mode = PREPASS_AUTO;
+	bool enabled = false; // the auto decision
+	float enable_above = 2.0f;
+	float disable_below = 1.5f;
+	Slot ring[FRAMES_IN_FLIGHT];
+	int current = 0;
+	int open = -1; // query running, -1 for none
+	bool initialized = false;
+	float overdraw = 0.0f;
+
+	// current decision window
+	double window_drawn = 0.0;
+	double window_pixels = 0.0;
+	int window_frames = 0;
+
+	// since the last report
+	double drawn = 0.0;
+	double shaded = 0.0;
+	double pixels_total = 0.0;
+	int frames = 0;
+	int prepass_frames = 0;
+	int switches = 0;
+};
+
+#endif
@@ -0,0 +1,5 @@
+// Camera matrices, uploaded once per frame and shared by every program variant
+layout(std140) uniform FrameParams {
+    mat4 view;
+    mat4 proj;
+};
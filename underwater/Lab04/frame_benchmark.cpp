@@ -0,0 +1,114 @@
+#include "frame_benchmark.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+static double now_ms () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 1e-6;
+}
+
+BenchmarkStats benchmark_stats (std::vector<double> samples) {
+	BenchmarkStats s = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	if (samples.empty ()) {
+		return s;
+	}
+	std::sort (samples.begin (), samples.end ());
+	double sum = 0.0;
+	for (double v : samples) {
+		sum += v;
+	}
+	size_t n = samples.size ();
+	// nearest rank: the smallest sample with at least p percent of the run at or below it
+	size_t p50 = (n * 50 + 99) / 100, p95 = (n * 95 + 99) / 100, p99 = (n * 99 + 99) / 100;
+	s.mean = sum / n;
+	s.min = samples.front ();
+	s.p50 = samples[p50 > 0 ? p50 - 1 : 0];
+	s.p95 = samples[p95 > 0 ? p95 - 1 : 0];
+	s.p99 = samples[p99 > 0 ? p99 - 1 : 0];
+	s.max = samples.back ();
+	return s;
+}
+
+void FrameBenchmark::init (int frames) {
+	frame_count = frames > 0 ? frames : 1;
+	frame = 0;
+	queries.resize ((size_t)frame_count * 2);
+	glGenQueries ((GLsizei)queries.size (), &queries[0]);
+	cpu_ms.clear ();
+	gpu_ms.clear ();
+	cpu_ms.reserve (frame_count);
+}
+
+void FrameBenchmark::destroy () {
+	if (!queries.empty ()) {
+		glDeleteQueries ((GLsizei)queries.size (), &queries[0]);
+	}
+	queries.clear ();
+}
+
+void FrameBenchmark::begin_frame () {
+	frame_start = now_ms ();
+	glQueryCounter (queries[frame * 2], GL_TIMESTAMP);
+}
+
+void FrameBenchmark::end_frame () {
+	glQueryCounter (queries[frame * 2 + 1], GL_TIMESTAMP);
+	cpu_ms.push_back (now_ms () - frame_start);
+	frame++;
+}
+
+static void write_stats (std::ostream& out, const char* name, const BenchmarkStats& s) {
+	char line[256];
+	snprintf (line, sizeof (line),
+		"  \"%s\": {\"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+		name, s.mean, s.min, s.p50, s.p95, s.p99, s.max);
+	out << line;
+}
+
+void FrameBenchmark::finish () {
+	glFinish ();
+	gpu_ms.clear ();
+	for (int i = 0; i < frame; i++) {
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v (queries[i * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v (queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		gpu_ms.push_back (end > begin ? (double)(end - begin) * 1e-6 : 0.0);
+	}
+}
+
+bool FrameBenchmark::write_json (const char* path, const std::string& info) {
+	finish ();
+
+	std::ostringstream out;
+	out << "{\n";
+	if (!info.empty ()) {
+		out << "  " << info << ",\n";
+	}
+	out << "  \"frames\": " << frame << ",\n";
+	write_stats (out, "cpu_ms", benchmark_stats (cpu_ms));
+	write_stats (out, "gpu_ms", benchmark_stats (gpu_ms));
+	out << "  \"per_frame_columns\": [\"cpu_ms\", \"gpu_ms\"],\n";
+	out << "  \"per_frame\": [\n";
+	char line[64];
+	for (int i = 0; i < frame; i++) {
+		snprintf (line, sizeof (line), "    [%.4f, %.4f]%s\n", cpu_ms[i], gpu_ms[i], i + 1 < frame ? "," : "");
+		out << line;
+	}
+	out << "  ]\n}\n";
+
+	if (!path) {
+		std::cout << out.str ();
+		return true;
+	}
+	std::ofstream file (path, std::ios::binary);
+	if (!file) {
+		fprintf (stderr, "ERROR: could not write %s\n", path);
+		return false;
+	}
+	file << out.str ();
+	return (bool)file;
+}
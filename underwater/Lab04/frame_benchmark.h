@@ -0,0 +1,47 @@
+#ifndef _FRAME_BENCHMARK_H_
+#define _FRAME_BENCHMARK_H_
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// mean and nearest-rank percentiles of one series, in ms
+struct BenchmarkStats {
+	double mean, min, p50, p95, p99, max;
+};
+
+BenchmarkStats benchmark_stats (std::vector<double> samples);
+
+/* CPU and GPU time of every frame of a fixed-length run.
+   GPU time is a pair of GL_TIMESTAMP queries around the frame, which can
+   wrap the governor's GL_TIME_ELAPSED query where a second elapsed query
+   could not. every query is kept and only read back after the run, so
+   the run itself never waits for the GPU. */
+class FrameBenchmark {
+public:
+	void init (int frames);
+	void destroy ();
+
+	void begin_frame ();
+	void end_frame ();
+	bool done () const { return frame >= frame_count; }
+
+	//! waits for the GPU and reads every GPU time back
+	void finish ();
+	const std::vector<double>& get_cpu_ms () const { return cpu_ms; }
+	const std::vector<double>& get_gpu_ms () const { return gpu_ms; }
+
+	//! finishes, then writes the stats and every frame; info is extra
+	//! "key": value pairs for the top-level object. path NULL prints to stdout
+	bool write_json (const char* path, const std::string& info);
+
+private:
+	int frame_count = 0;
+	int frame = 0;
+	double frame_start = 0.0;
+	std::vector<GLuint> queries; // begin, end per frame
+	std::vector<double> cpu_ms;
+	std::vector<double> gpu_ms;
+};
+
+#endif
@@ -0,0 +1,484 @@
+#include "frame_capture.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#ifdef _WIN32
+#include <direct.h>
+#define seek64 _fseeki64
+#else
+#include <sys/stat.h>
+#define seek64 fseeko
+#endif
+
+static double now_ms () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 1e-6;
+}
+
+/*---------------------------- PNG ENCODER ----------------------------*/
+
+// deflate with the fixed huffman codes and a one-entry hash for matches: no
+// zlib in libs/, and the underwater gradients compress well enough with it
+
+struct BitWriter {
+	std::vector<uint8_t>& out;
+	uint32_t bits;
+	int count;
+
+	explicit BitWriter (std::vector<uint8_t>& o) : out (o), bits (0), count (0) {}
+	//! n bits of value, least significant first
+	void put (uint32_t value, int n) {
+		bits |= value << count;
+		count += n;
+		while (count >= 8) {
+			out.push_back ((uint8_t)bits);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+	//! huffman codes go most significant bit first
+	void put_code (uint32_t code, int n) {
+		uint32_t reversed = 0;
+		for (int i = 0; i < n; i++) {
+			reversed = (reversed << 1) | ((code >> i) & 1);
+		}
+		put (reversed, n);
+	}
+	void flush () {
+		if (count > 0) {
+			out.push_back ((uint8_t)bits);
+		}
+		bits = 0;
+		count = 0;
+	}
+};
+
+static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// literal/length symbol with the fixed code
+static void put_symbol (BitWriter& writer, int symbol) {
+	if (symbol < 144) {
+		writer.put_code (0x30 + symbol, 8);
+	}
+	else if (symbol < 256) {
+		writer.put_code (0x190 + symbol - 144, 9);
+	}
+	else if (symbol < 280) {
+		writer.put_code (symbol - 256, 7);
+	}
+	else {
+		writer.put_code (0xc0 + symbol - 280, 8);
+	}
+}
+
+static void put_match (BitWriter& writer, int length, int distance) {
+	int l = 28;
+	while (LENGTH_BASE[l] > length) {
+		l--;
+	}
+	put_symbol (writer, 257 + l);
+	writer.put (length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+	int d = 29;
+	while (DISTANCE_BASE[d] > distance) {
+		d--;
+	}
+	writer.put_code (d, 5);
+	writer.put (distance - DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+}
+
+// zlib stream of one fixed-code deflate block
+static void zlib_compress (const std::vector<uint8_t>& data, std::vector<uint8_t>& out) {
+	const int HASH_BITS = 15;
+	const int WINDOW = 32768;
+	const int MAX_MATCH = 258;
+	std::vector<int32_t> last ((size_t)1 << HASH_BITS, -1);
+
+	out.push_back (0x78);
+	out.push_back (0x01);
+	BitWriter writer (out);
+	writer.put (1, 1); // final block
+	writer.put (1, 2); // fixed codes
+	size_t n = data.size ();
+	size_t i = 0;
+	while (i < n) {
+		int length = 0, distance = 0;
+		if (i + 3 <= n) {
+			uint32_t h = ((data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> (32 - HASH_BITS);
+			int32_t candidate = last[h];
+			last[h] = (int32_t)i;
+			if (candidate >= 0 && i - candidate <= (size_t)WINDOW) {
+				size_t limit = n - i < (size_t)MAX_MATCH ? n - i : (size_t)MAX_MATCH;
+				size_t k = 0;
+				while (k < limit && data[candidate + k] == data[i + k]) {
+					k++;
+				}
+				if (k >= 3) {
+					length = (int)k;
+					distance = (int)(i - candidate);
+				}
+			}
+		}
+		if (length) {
+			put_match (writer, length, distance);
+			i += length;
+		}
+		else {
+			put_symbol (writer, data[i]);
+			i++;
+		}
+	}
+	put_symbol (writer, 256);
+	writer.flush ();
+
+	uint32_t a = 1, b = 0;
+	for (size_t k = 0; k < n; k++) {
+		a = (a + data[k]) % 65521;
+		b = (b + a) % 65521;
+	}
+	uint32_t adler = b << 16 | a;
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back ((uint8_t)(adler >> shift));
+	}
+}
+
+static std::vector<uint32_t> crc_table () {
+	std::vector<uint32_t> table (256);
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		}
+		table[i] = c;
+	}
+	return table;
+}
+
+static uint32_t crc32 (const uint8_t* data, size_t size, uint32_t crc) {
+	static const std::vector<uint32_t> table = crc_table (); // built once, by whichever worker gets here first
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void put_chunk (std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data) {
+	uint32_t size = (uint32_t)data.size ();
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		png.push_back ((uint8_t)(size >> shift));
+	}
+	size_t start = png.size ();
+	png.insert (png.end (), type, type + 4);
+	png.insert (png.end (), data.begin (), data.end ());
+	uint32_t crc = crc32 (&png[start], png.size () - start, 0);
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		png.push_back ((uint8_t)(crc >> shift));
+	}
+}
+
+// RGB png from bottom-up RGBA; every row uses the Sub filter
+static void encode_png (const uint8_t* rgba, int width, int height, std::vector<uint8_t>& filtered, std::vector<uint8_t>& png) {
+	filtered.clear ();
+	filtered.reserve ((size_t)(width * 3 + 1) * height);
+	for (int y = height - 1; y >= 0; y--) {
+		const uint8_t* row = rgba + (size_t)y * width * 4;
+		filtered.push_back (1);
+		for (int x = 0; x < width; x++) {
+			for (int c = 0; c < 3; c++) {
+				uint8_t left = x > 0 ? row[(x - 1) * 4 + c] : 0;
+				filtered.push_back ((uint8_t)(row[x * 4 + c] - left));
+			}
+		}
+	}
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	png.assign (signature, signature + 8);
+	std::vector<uint8_t> header;
+	for (int value : { width, height }) {
+		for (int shift = 24; shift >= 0; shift -= 8) {
+			header.push_back ((uint8_t)(value >> shift));
+		}
+	}
+	const uint8_t rest[5] = { 8, 2, 0, 0, 0 }; // 8 bits, RGB, deflate, filtered, no interlace
+	header.insert (header.end (), rest, rest + 5);
+	put_chunk (png, "IHDR", header);
+	std::vector<uint8_t> compressed;
+	zlib_compress (filtered, compressed);
+	put_chunk (png, "IDAT", compressed);
+	put_chunk (png, "IEND", std::vector<uint8_t> ());
+}
+
+/*---------------------------- CAPTURE ----------------------------*/
+
+bool FrameCapture::init (const char* dir, CaptureFormat capture_format, int worker_count) {
+	destroy ();
+	// a restart into the same directory carries on the numbering and the raw stream instead of writing over them
+	bool resume = directory == dir && format == capture_format;
+	directory = dir;
+	format = capture_format;
+#ifdef _WIN32
+	_mkdir (directory.c_str ());
+#else
+	mkdir (directory.c_str (), 0755);
+#endif
+	for (int i = 0; i < RING_SIZE; i++) {
+		glGenBuffers (1, &ring[i].buffer);
+		ring[i].fence = 0;
+		ring[i].capacity = 0;
+	}
+	head = 0;
+	in_flight = 0;
+	captured = 0;
+	if (!resume) {
+		next_frame = 0;
+		raw_width = raw_height = 0;
+	}
+
+	if (worker_count <= 0) {
+		worker_count = (int)std::thread::hardware_concurrency () - 1;
+	}
+	worker_count = worker_count > 0 ? worker_count : 1;
+	quit = false;
+	for (int i = 0; i < worker_count; i++) {
+		workers.push_back (std::thread (&FrameCapture::worker_main, this));
+	}
+	active = true;
+	printf ("=> capturing %s into %s/ with %d writer threads \n", format == CAPTURE_PNG ? "png frames" : "raw video",
+		directory.c_str (), worker_count);
+	return true;
+}
+
+void FrameCapture::destroy () {
+	if (!active) {
+		return;
+	}
+	while (in_flight > 0) {
+		retire (ring[(head - in_flight + RING_SIZE) % RING_SIZE]);
+		in_flight--;
+	}
+	stop_workers ();
+	for (int i = 0; i < RING_SIZE; i++) {
+		glDeleteBuffers (1, &ring[i].buffer);
+		ring[i].buffer = 0;
+	}
+	spare.clear ();
+	active = false;
+	printf ("=> capture finished, %d frames in %s/ \n", captured, directory.c_str ());
+}
+
+void FrameCapture::stop_workers () {
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		quit = true;
+	}
+	work.notify_all ();
+	for (std::thread& worker : workers) {
+		worker.join ();
+	}
+	workers.clear ();
+}
+
+void FrameCapture::capture (GLuint framebuffer, int width, int height) {
+	if (!active || width <= 0 || height <= 0) {
+		return;
+	}
+	double start = now_ms ();
+
+	// hand off the oldest frames whose copy is done; only a full ring waits for one
+	while (in_flight > 0) {
+		Slot& oldest = ring[(head - in_flight + RING_SIZE) % RING_SIZE];
+		GLenum status = glClientWaitSync (oldest.fence, 0, 0);
+		bool ready = status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+		if (!ready && in_flight < RING_SIZE) {
+			break;
+		}
+		if (!ready) {
+			render_waits++;
+		}
+		retire (oldest);
+		in_flight--;
+	}
+
+	if (format == CAPTURE_RAW && raw_width == 0) {
+		// the stream is created here, so workers only ever open it for update
+		raw_width = width;
+		raw_height = height;
+		char name[64];
+		snprintf (name, sizeof (name), "/capture_%dx%d.rgba", width, height);
+		FILE* file = fopen ((directory + name).c_str (), "wb");
+		if (!file) {
+			fprintf (stderr, "ERROR: could not create %s%s\n", directory.c_str (), name);
+		}
+		else {
+			fclose (file);
+		}
+	}
+
+	Slot& slot = ring[head];
+	size_t bytes = (size_t)width * height * 4;
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, slot.buffer);
+	if (bytes > slot.capacity) {
+		glBufferData (GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		slot.capacity = bytes;
+	}
+	glBindFramebuffer (GL_READ_FRAMEBUFFER, framebuffer);
+	glReadBuffer (framebuffer ? GL_COLOR_ATTACHMENT0 : GL_BACK);
+	glPixelStorei (GL_PACK_ALIGNMENT, 4);
+	// with a pack buffer bound this only queues the copy
+	glReadPixels (0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+	slot.fence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.frame = next_frame++;
+	captured++;
+	head = (head + 1) % RING_SIZE;
+	in_flight++;
+
+	frames++;
+	render_ms += now_ms () - start;
+}
+
+// maps one finished readback and queues a copy of it for the workers
+void FrameCapture::retire (Slot& slot) {
+	while (glClientWaitSync (slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+	}
+	glDeleteSync (slot.fence);
+	slot.fence = 0;
+
+	Frame frame;
+	frame.index = slot.frame;
+	frame.width = slot.width;
+	frame.height = slot.height;
+	{
+		std::unique_lock<std::mutex> lock (mutex);
+		if ((int)(queue.size ()) + writing >= MAX_QUEUED) {
+			render_waits++;
+			space.wait (lock, [&] { return (int)(queue.size ()) + writing < MAX_QUEUED; });
+		}
+		if (!spare.empty ()) {
+			frame.pixels.swap (spare.back ());
+			spare.pop_back ();
+		}
+	}
+
+	size_t bytes = (size_t)slot.width * slot.height * 4;
+	frame.pixels.resize (bytes);
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, slot.buffer);
+	const void* mapped = glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (mapped) {
+		memcpy (&frame.pixels[0], mapped, bytes);
+		glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+	if (!mapped) {
+		fprintf (stderr, "ERROR: could not map capture buffer of frame %d\n", (int)slot.frame);
+		captured--;
+		std::lock_guard<std::mutex> lock (mutex);
+		write_failures++;
+		spare.push_back (std::move (frame.pixels));
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		queue.push_back (std::move (frame));
+	}
+	work.notify_one ();
+}
+
+void FrameCapture::worker_main () {
+	std::vector<uint8_t> scratch;
+	for (;;) {
+		Frame frame;
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			work.wait (lock, [&] { return quit || !queue.empty (); });
+			// quitting still drains the queue
+			if (queue.empty ()) {
+				return;
+			}
+			frame = std::move (queue.front ());
+			queue.pop_front ();
+			writing++;
+		}
+		double start = now_ms ();
+		bool ok = write_frame (frame, scratch);
+		double elapsed = now_ms () - start;
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			writing--;
+			write_ms += elapsed;
+			written_mb += ok ? frame.pixels.size () / (1024.0 * 1024.0) : 0.0;
+			write_failures += ok ? 0 : 1;
+			spare.push_back (std::move (frame.pixels));
+		}
+		space.notify_one ();
+	}
+}
+
+bool FrameCapture::write_frame (Frame& frame, std::vector<uint8_t>& scratch) {
+	char name[64];
+	if (format == CAPTURE_PNG) {
+		std::vector<uint8_t> png;
+		encode_png (&frame.pixels[0], frame.width, frame.height, scratch, png);
+		snprintf (name, sizeof (name), "/frame_%06d.png", (int)frame.index);
+		FILE* file = fopen ((directory + name).c_str (), "wb");
+		if (!file) {
+			fprintf (stderr, "ERROR: could not write %s%s\n", directory.c_str (), name);
+			return false;
+		}
+		bool ok = fwrite (&png[0], 1, png.size (), file) == png.size ();
+		return fclose (file) == 0 && ok;
+	}
+
+	if (frame.width != raw_width || frame.height != raw_height) {
+		fprintf (stderr, "ERROR: frame %d is %dx%d, the raw stream is %dx%d\n",
+			(int)frame.index, frame.width, frame.height, raw_width, raw_height);
+		return false;
+	}
+	// top row first, the way video tools read raw frames
+	size_t row = (size_t)frame.width * 4;
+	scratch.resize (frame.pixels.size ());
+	for (int y = 0; y < frame.height; y++) {
+		memcpy (&scratch[y * row], &frame.pixels[(frame.height - 1 - y) * row], row);
+	}
+	snprintf (name, sizeof (name), "/capture_%dx%d.rgba", raw_width, raw_height);
+	FILE* file = fopen ((directory + name).c_str (), "r+b");
+	if (!file) {
+		fprintf (stderr, "ERROR: could not open %s%s\n", directory.c_str (), name);
+		return false;
+	}
+	bool ok = seek64 (file, (long long)frame.index * (long long)scratch.size (), SEEK_SET) == 0 &&
+		fwrite (&scratch[0], 1, scratch.size (), file) == scratch.size ();
+	return fclose (file) == 0 && ok;
+}
+
+void FrameCapture::report () {
+	if (frames == 0) {
+		return;
+	}
+	double mb, ms;
+	int failures;
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		mb = written_mb;
+		ms = write_ms;
+		failures = write_failures;
+		written_mb = write_ms = 0.0;
+		write_failures = 0;
+	}
+	printf ("Capture: %d frames, %.3f ms per frame on the render thread, %d waits, "
+		"%.1f MB of pixels written in %.1f ms of worker time (%.1f MB/s per worker), %d failed\n",
+		frames, render_ms / frames, render_waits, mb, ms, ms > 0.0 ? mb * 1000.0 / ms : 0.0, failures);
+	frames = 0;
+	render_waits = 0;
+	render_ms = 0.0;
+}
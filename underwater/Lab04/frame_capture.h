@@ -0,0 +1,96 @@
+#ifndef _FRAME_CAPTURE_H_
+#define _FRAME_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <GL/glew.h>
+
+enum CaptureFormat {
+	CAPTURE_PNG, // frame_000000.png per frame
+	CAPTURE_RAW // one capture_WxH.rgba stream, e.g. ffmpeg -f rawvideo -pix_fmt rgba -s WxH -r 60 -i ...
+};
+
+/* asynchronous frame capture.
+   capture() never waits for the frame it is given: glReadPixels goes into
+   one of RING_SIZE pixel pack buffers and a fence is placed behind it. the
+   oldest buffers are mapped once their fence has signalled, normally one or
+   two frames later, copied into a pooled frame and handed to a pool of
+   worker threads that flip, encode and write it. png frames are written by
+   whichever worker is free; raw frames have a fixed size, so each worker
+   writes straight to its frame's offset in the stream.
+   the render thread only waits when a fence is still open after a full
+   ring, or when MAX_QUEUED frames are already waiting for the workers. */
+class FrameCapture {
+public:
+	static const int RING_SIZE = 3;
+	static const int MAX_QUEUED = 8;
+
+	//! directory is created if missing; workers <= 0 leaves one hardware thread to the renderer.
+	//! a second init with the same directory and format continues where the last one stopped
+	bool init (const char* directory, CaptureFormat format, int workers);
+	//! maps the frames still in flight, lets the workers finish and joins them
+	void destroy ();
+	~FrameCapture () { stop_workers (); }
+	bool is_active () const { return active; }
+
+	//! reads the colour of framebuffer (0 is the window's back buffer), width x height from the origin
+	void capture (GLuint framebuffer, int width, int height);
+	//! number the next captured frame is written under, following ones count on from it
+	void set_next_frame (uint64_t index) { next_frame = index; }
+	//! frames, render-thread cost and worker throughput since the last report, then resets them
+	void report ();
+
+private:
+	struct Slot {
+		GLuint buffer;
+		GLsync fence;
+		int width, height;
+		size_t capacity; // bytes allocated for buffer
+		uint64_t frame;
+	};
+	struct Frame {
+		uint64_t index;
+		int width, height;
+		std::vector<uint8_t> pixels; // RGBA, bottom row first
+	};
+
+	void retire (Slot& slot);
+	void worker_main ();
+	bool write_frame (Frame& frame, std::vector<uint8_t>& scratch);
+	void stop_workers ();
+
+	bool active = false;
+	std::string directory;
+	CaptureFormat format = CAPTURE_PNG;
+	Slot ring[RING_SIZE];
+	int head = 0; // next slot to issue into
+	int in_flight = 0;
+	uint64_t next_frame = 0;
+	int captured = 0; // frames handed to the workers this session
+	int raw_width = 0, raw_height = 0; // the raw stream takes the size of its first frame
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable work; // a frame was queued, or quit
+	std::condition_variable space; // a frame was written
+	std::deque<Frame> queue;
+	std::vector<std::vector<uint8_t> > spare; // pixel storage of written frames, reused
+	int writing = 0;
+	bool quit = false;
+
+	// since the last report
+	int frames = 0;
+	int render_waits = 0; // capture() blocked on a fence or on the workers
+	double render_ms = 0.0;
+	double written_mb = 0.0; // guarded by mutex, like the two below
+	double write_ms = 0.0;
+	int write_failures = 0;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "frame_governor.h"
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+
+// weight of the newest sample in the smoothed times
+static const float SMOOTHING = 0.1f;
+
+static double now_ms () {
+	using namespace std::chrono;
+	return (double)duration_cast<microseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+static void smooth (float& value, float sample) {
+	value = value > 0.0f ? value + (sample - value) * SMOOTHING : sample;
+}
+
+void FrameGovernor::init (const GovernorSettings& s) {
+	settings = s;
+	levels.resolution_scale = 1.0f;
+	levels.particle_fraction = 1.0f;
+	levels.lod_bias = 0.0f;
+	levels.fish_interval = 1;
+	glGenQueries (QUERY_COUNT, queries);
+	for (int i = 0; i < QUERY_COUNT; i++) {
+		query_pending[i] = false;
+	}
+	query_index = 0;
+	frame = 0;
+	over_frames = under_frames = cooldown_left = 0;
+	decisions.clear ();
+}
+
+void FrameGovernor::destroy () {
+	glDeleteQueries (QUERY_COUNT, queries);
+	for (int i = 0; i < QUERY_COUNT; i++) {
+		queries[i] = 0;
+		query_pending[i] = false;
+	}
+}
+
+void FrameGovernor::set_enabled (bool on) {
+	enabled = on;
+	if (!enabled) {
+		levels.resolution_scale = 1.0f;
+		levels.particle_fraction = 1.0f;
+		levels.lod_bias = 0.0f;
+		levels.fish_interval = 1;
+	}
+	over_frames = under_frames = cooldown_left = 0;
+}
+
+/*------------------------------ MEASURING -------------------------------*/
+
+void FrameGovernor::begin_frame () {
+	frame_start = now_ms ();
+	// the ring is deep enough that this only blocks when the GPU is QUERY_COUNT frames behind
+	if (query_pending[query_index]) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v (queries[query_index], GL_QUERY_RESULT, &elapsed);
+		smooth (gpu_ms, (float)(elapsed * 1e-6));
+		query_pending[query_index] = false;
+	}
+	glBeginQuery (GL_TIME_ELAPSED, queries[query_index]);
+}
+
+void FrameGovernor::end_frame () {
+	glEndQuery (GL_TIME_ELAPSED);
+	query_pending[query_index] = true;
+	query_index = (query_index + 1) % QUERY_COUNT;
+	smooth (cpu_ms, (float)(now_ms () - frame_start));
+
+	// the oldest query is the next one to be reused
+	if (query_pending[query_index]) {
+		GLint available = 0;
+		glGetQueryObjectiv (queries[query_index], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v (queries[query_index], GL_QUERY_RESULT, &elapsed);
+			smooth (gpu_ms, (float)(elapsed * 1e-6));
+			query_pending[query_index] = false;
+		}
+	}
+
+	frame++;
+	if (!enabled) {
+		return;
+	}
+	if (cooldown_left > 0) {
+		cooldown_left--;
+		return;
+	}
+
+	float cost = cpu_ms > gpu_ms ? cpu_ms : gpu_ms;
+	if (cost > settings.target_ms) {
+		over_frames++;
+		under_frames = 0;
+	}
+	else if (cost < settings.target_ms * settings.raise_below) {
+		under_frames++;
+		over_frames = 0;
+	}
+	else {
+		over_frames = under_frames = 0;
+	}
+
+	if (over_frames >= settings.lower_after) {
+		over_frames = 0;
+		if (lower (gpu_ms >= cpu_ms)) {
+			cooldown_left = settings.cooldown;
+		}
+	}
+	else if (under_frames >= settings.raise_after) {
+		under_frames = 0;
+		if (raise ()) {
+			cooldown_left = settings.cooldown;
+		}
+	}
+}
+
+/*------------------------------- DECIDING -------------------------------*/
+
+bool FrameGovernor::lower (bool gpu_bound) {
+	float scale = fmaxf (settings.min_scale, levels.resolution_scale - settings.scale_step);
+	float particles = fmaxf (settings.min_particles, levels.particle_fraction - settings.particle_step);
+	float lod = fminf (settings.max_lod_bias, levels.lod_bias + settings.lod_step);
+	int fish = levels.fish_interval < settings.max_fish_interval ? levels.fish_interval + 1 : levels.fish_interval;
+	if (gpu_bound) {
+		return step ("resolution", levels.resolution_scale, scale) || step ("particles", levels.particle_fraction, particles) ||
+			step ("lod bias", levels.lod_bias, lod) || step ("fish interval", levels.fish_interval, fish);
+	}
+	return step ("fish interval", levels.fish_interval, fish) || step ("lod bias", levels.lod_bias, lod) ||
+		step ("particles", levels.particle_fraction, particles) || step ("resolution", levels.resolution_scale, scale);
+}
+
+// most visible first, whatever the bottleneck was
+bool FrameGovernor::raise () {
+	float scale = fminf (1.0f, levels.resolution_scale + settings.scale_step);
+	float particles = fminf (1.0f, levels.particle_fraction + settings.particle_step);
+	float lod = fmaxf (0.0f, levels.lod_bias - settings.lod_step);
+	int fish = levels.fish_interval > 1 ? levels.fish_interval - 1 : 1;
+	return step ("resolution", levels.resolution_scale, scale) || step ("lod bias", levels.lod_bias, lod) ||
+		step ("particles", levels.particle_fraction, particles) || step ("fish interval", levels.fish_interval, fish);
+}
+
+bool FrameGovernor::step (const char* knob, float& value, float to) {
+	if (fabsf (value - to) < 1e-4f) {
+		return false;
+	}
+	GovernorDecision d = { frame, cpu_ms, gpu_ms, knob, value, to };
+	decisions.push_back (d);
+	printf ("=> governor: frame %d, cpu %.2f ms, gpu %.2f ms, %s %.2f -> %.2f \n", frame, cpu_ms, gpu_ms, knob, value, to);
+	value = to;
+	return true;
+}
+
+bool FrameGovernor::step (const char* knob, int& value, int to) {
+	float f = (float)value;
+	if (!step (knob, f, (float)to)) {
+		return false;
+	}
+	value = to;
+	return true;
+}
+
+void FrameGovernor::report () const {
+	printf ("Governor: %s, cpu %.2f ms, gpu %.2f ms of %.1f ms, resolution %.0f%%, particles %.0f%%, LOD bias %.1f, fish every %d updates, %d decisions\n",
+		enabled ? "on" : "off", cpu_ms, gpu_ms, settings.target_ms, levels.resolution_scale * 100.0f,
+		levels.particle_fraction * 100.0f, levels.lod_bias, levels.fish_interval, (int)decisions.size ());
+}
+
+void FrameGovernor::print_log () const {
+	printf ("Governor log, %d decisions:\n", (int)decisions.size ());
+	for (const GovernorDecision& d : decisions) {
+		printf ("  frame %6d  cpu %6.2f ms  gpu %6.2f ms  %-13s %.2f -> %.2f\n", d.frame, d.cpu_ms, d.gpu_ms, d.knob, d.from, d.to);
+	}
+}
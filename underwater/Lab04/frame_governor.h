@@ -0,0 +1,89 @@
+#ifndef _FRAME_GOVERNOR_H_
+#define _FRAME_GOVERNOR_H_
+
+#include <vector>
+#include <GL/glew.h>
+
+// bounds and pacing of the governor, every knob moves one step at a time
+struct GovernorSettings {
+	float target_ms; // frame budget, 16.7 for 60 Hz
+	float min_scale, scale_step; // render resolution as a fraction of the window, 1 at best
+	float min_particles, particle_step; // fraction of the particles drawn, 1 at best
+	float max_lod_bias, lod_step; // 0 at best
+	int max_fish_interval; // fish animated every n-th update at worst, 1 at best
+	float raise_below; // quality only goes up while the frame is under target_ms * raise_below
+	int lower_after; // consecutive frames over budget before lowering
+	int raise_after; // consecutive frames under raise_below before raising
+	int cooldown; // frames after any change before the next one
+};
+
+// what the renderer should use this frame
+struct GovernorLevels {
+	float resolution_scale;
+	float particle_fraction;
+	float lod_bias;
+	int fish_interval;
+};
+
+// one entry of the decision log
+struct GovernorDecision {
+	int frame;
+	float cpu_ms, gpu_ms; // smoothed times that triggered it
+	const char* knob;
+	float from, to;
+};
+
+/* holds a frame-time target by trading quality for time.
+   CPU time is taken between begin_frame() and end_frame(), GPU time with a
+   GL_TIME_ELAPSED query around the same span, read back a few frames later
+   so nothing waits on the GPU. both are smoothed and the larger one is the
+   frame cost. when the GPU is the bottleneck resolution and particles go
+   first, when the CPU is it goes the other way round (fish updates, LOD).
+   hysteresis: lowering needs lower_after frames over budget, raising needs
+   the much longer raise_after frames well under it, and every change is
+   followed by a cooldown so one knob never oscillates. */
+class FrameGovernor {
+public:
+	static const int QUERY_COUNT = 4;
+
+	void init (const GovernorSettings& settings);
+	void destroy ();
+
+	void begin_frame ();
+	//! call before the swap; the levels may change for the next frame
+	void end_frame ();
+
+	//! disabled keeps measuring but pins every knob at full quality
+	void set_enabled (bool on);
+	bool is_enabled () const { return enabled; }
+	const GovernorLevels& get_levels () const { return levels; }
+
+	//! one line with the smoothed times and the current levels
+	void report () const;
+	//! every decision since init, oldest first
+	void print_log () const;
+
+	float cpu_ms = 0.0f;
+	float gpu_ms = 0.0f;
+	std::vector<GovernorDecision> decisions;
+
+private:
+	bool lower (bool gpu_bound);
+	bool raise ();
+	bool step (const char* knob, float& value, float to);
+	bool step (const char* knob, int& value, int to);
+
+	GovernorSettings settings;
+	GovernorLevels levels;
+	bool enabled = true;
+	GLuint queries[QUERY_COUNT] = { 0 };
+	bool query_pending[QUERY_COUNT] = { false };
+	int query_index = 0;
+	double frame_start = 0.0;
+	int frame = 0;
+	int over_frames = 0;
+	int under_frames = 0;
+	int cooldown_left = 0;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "frame_scheduler.h"
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+const double FrameScheduler::SPIN_SECONDS = 0.002;
+
+static double now_s () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 1e-9;
+}
+
+void FrameScheduler::init (double step_seconds, int steps_per_frame, double target_fps) {
+	step = step_seconds;
+	max_steps = steps_per_frame > 1 ? steps_per_frame : 1;
+	frame_period = target_fps > 0.0 ? 1.0 / target_fps : 0.0;
+	accumulator = 0.0;
+	last_time = report_time = deadline = now_s ();
+	steps = frames = dropped_steps = 0;
+}
+
+void FrameScheduler::limit () {
+	if (frame_period <= 0.0) {
+		return;
+	}
+	deadline += frame_period;
+	double now = now_s ();
+	// more than a whole frame late: start counting from here instead of rushing to catch up
+	if (now > deadline + frame_period) {
+		deadline = now;
+		return;
+	}
+	double remaining = deadline - now;
+	if (remaining > SPIN_SECONDS) {
+		std::this_thread::sleep_for (std::chrono::duration<double> (remaining - SPIN_SECONDS));
+	}
+	while (now_s () < deadline) {
+		std::this_thread::yield ();
+	}
+}
+
+int FrameScheduler::begin_frame () {
+	double now = now_s ();
+	accumulator += now - last_time;
+	last_time = now;
+
+	int count = (int)(accumulator / step);
+	accumulator -= count * step;
+	if (count > max_steps) {
+		dropped_steps += count - max_steps;
+		count = max_steps;
+	}
+	steps += count;
+	frames++;
+	return count;
+}
+
+void FrameScheduler::report () {
+	double now = now_s ();
+	double elapsed = now - report_time;
+	if (elapsed <= 0.0) {
+		return;
+	}
+	printf ("Scheduler: %.1f simulation steps/s (%.0f Hz fixed), %.1f frames/s, %d steps dropped\n",
+		steps / elapsed, 1.0 / step, frames / elapsed, dropped_steps);
+	report_time = now;
+	steps = frames = dropped_steps = 0;
+}
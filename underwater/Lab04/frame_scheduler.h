@@ -0,0 +1,45 @@
+#ifndef _FRAME_SCHEDULER_H_
+#define _FRAME_SCHEDULER_H_
+
+/* fixed-timestep frame pacing.
+   every frame the real time since the previous one goes into an
+   accumulator that is drained in whole simulation steps. at most
+   max_steps run per frame and the rest is dropped, so after a stall the
+   world slows down for a moment instead of spiralling into ever longer
+   catch-up frames. what is left over is the interpolation factor between
+   the previous and the current simulation state for rendering.
+   limit() sleeps to the next frame deadline with the OS sleep and spins
+   the last SPIN_SECONDS, which the OS sleep cannot hit precisely. */
+class FrameScheduler {
+public:
+	static const double SPIN_SECONDS;
+
+	//! target_fps <= 0 leaves pacing to vsync alone
+	void init (double step_seconds, int max_steps, double target_fps);
+
+	//! blocks until the next frame deadline
+	void limit ();
+	//! adds the real time since the last call, returns how many steps to simulate now
+	int begin_frame ();
+	//! 0 renders the previous state, 1 the current one
+	float alpha () const { return (float)(accumulator / step); }
+	double get_step () const { return step; }
+
+	//! steps and frames per second of real time since the last report
+	void report ();
+
+	int dropped_steps = 0; // lost to the catch-up cap since the last report
+
+private:
+	double step = 1.0 / 60.0;
+	int max_steps = 5;
+	double frame_period = 0.0;
+	double accumulator = 0.0;
+	double last_time = 0.0;
+	double deadline = 0.0;
+	double report_time = 0.0;
+	int steps = 0;
+	int frames = 0;
+};
+
+#endif
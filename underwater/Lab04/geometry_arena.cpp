@@ -0,0 +1,194 @@
+#include "geometry_arena.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <iterator>
+#include <unordered_map>
+
+/*--------------------------------FREE LIST ALLOCATOR---------------------------------*/
+
+void FreeListAllocator::init (uint32_t capacity) {
+	free_blocks.clear ();
+	free_total = capacity;
+	if (capacity > 0) {
+		free_blocks[0] = capacity;
+	}
+}
+
+uint32_t FreeListAllocator::allocate (uint32_t size) {
+	if (size == 0) {
+		return INVALID;
+	}
+	for (auto it = free_blocks.begin (); it != free_blocks.end (); ++it) {
+		if (it->second < size) {
+			continue;
+		}
+		uint32_t offset = it->first;
+		uint32_t remaining = it->second - size;
+		free_blocks.erase (it);
+		if (remaining > 0) {
+			free_blocks[offset + size] = remaining;
+		}
+		free_total -= size;
+		return offset;
+	}
+	return INVALID;
+}
+
+void FreeListAllocator::release (uint32_t offset, uint32_t size) {
+	if (size == 0 || offset == INVALID) {
+		return;
+	}
+	free_total += size;
+	auto next = free_blocks.lower_bound (offset);
+	// merge with the block that follows
+	if (next != free_blocks.end () && offset + size == next->first) {
+		size += next->second;
+		next = free_blocks.erase (next);
+	}
+	// and with the one in front
+	if (next != free_blocks.begin ()) {
+		auto prev = std::prev (next);
+		if (prev->first + prev->second == offset) {
+			prev->second += size;
+			return;
+		}
+	}
+	free_blocks[offset] = size;
+}
+
+/*-----------------------------------GEOMETRY ARENA-----------------------------------*/
+
+bool GeometryArena::init (uint32_t vertex_capacity, uint32_t index_capacity) {
+	vertex_space.init (vertex_capacity);
+	index_space.init (index_capacity);
+
+	glGenVertexArrays (1, &vao);
+	glBindVertexArray (vao);
+
+	glGenBuffers (1, &vertex_buffer);
+	glBindBuffer (GL_ARRAY_BUFFER, vertex_buffer);
+	glBufferData (GL_ARRAY_BUFFER, (GLsizeiptr)vertex_capacity * sizeof (ArenaVertex), NULL, GL_STATIC_DRAW);
+
+	glGenBuffers (1, &index_buffer);
+	glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData (GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)index_capacity * sizeof (GLuint), NULL, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray (0);
+	glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (ArenaVertex), (void*)offsetof (ArenaVertex, position));
+	glEnableVertexAttribArray (1);
+	glVertexAttribPointer (1, 3, GL_FLOAT, GL_FALSE, sizeof (ArenaVertex), (void*)offsetof (ArenaVertex, normal));
+	glEnableVertexAttribArray (2);
+	glVertexAttribPointer (2, 2, GL_FLOAT, GL_FALSE, sizeof (ArenaVertex), (void*)offsetof (ArenaVertex, texcoord));
+
+	glGenVertexArrays (1, &position_vao);
+	glBindVertexArray (position_vao);
+	glGenBuffers (1, &position_buffer);
+	glBindBuffer (GL_ARRAY_BUFFER, position_buffer);
+	glBufferData (GL_ARRAY_BUFFER, (GLsizeiptr)vertex_capacity * sizeof (float) * 3, NULL, GL_STATIC_DRAW);
+	glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glEnableVertexAttribArray (0);
+	glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (float) * 3, NULL);
+
+	glBindVertexArray (0);
+	return glGetError () == GL_NO_ERROR;
+}
+
+void GeometryArena::destroy () {
+	glDeleteBuffers (1, &vertex_buffer);
+	glDeleteBuffers (1, &position_buffer);
+	glDeleteBuffers (1, &index_buffer);
+	glDeleteVertexArrays (1, &vao);
+	glDeleteVertexArrays (1, &position_vao);
+	vao = position_vao = vertex_buffer = position_buffer = index_buffer = 0;
+	vertex_space.init (0);
+	index_space.init (0);
+}
+
+struct VertexHash {
+	size_t operator() (const ArenaVertex& v) const {
+		const uint32_t* words = (const uint32_t*)&v;
+		size_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof (ArenaVertex) / 4; i++) {
+			h = (h ^ words[i]) * 16777619u;
+		}
+		return h;
+	}
+};
+
+struct VertexEqual {
+	bool operator() (const ArenaVertex& a, const ArenaVertex& b) const {
+		return memcmp (&a, &b, sizeof (ArenaVertex)) == 0;
+	}
+};
+
+bool GeometryArena::upload (const std::vector<vec3>& positions, const std::vector<vec3>& normals,
+	const std::vector<vec2>& texcoords, MeshAllocation& out) {
+	std::vector<ArenaVertex> vertices;
+	std::vector<GLuint> indices;
+	std::unordered_map<ArenaVertex, GLuint, VertexHash, VertexEqual> welded;
+	vertices.reserve (positions.size ());
+	indices.reserve (positions.size ());
+	welded.reserve (positions.size ());
+
+	for (size_t i = 0; i < positions.size (); i++) {
+		ArenaVertex v;
+		memset (&v, 0, sizeof (v));
+		memcpy (v.position, positions[i].v, sizeof (v.position));
+		if (i < normals.size ()) {
+			memcpy (v.normal, normals[i].v, sizeof (v.normal));
+		}
+		if (i < texcoords.size ()) {
+			memcpy (v.texcoord, texcoords[i].v, sizeof (v.texcoord));
+		}
+		auto found = welded.find (v);
+		if (found != welded.end ()) {
+			indices.push_back (found->second);
+		}
+		else {
+			GLuint index = (GLuint)vertices.size ();
+			welded[v] = index;
+			vertices.push_back (v);
+			indices.push_back (index);
+		}
+	}
+	if (indices.empty ()) {
+		return false;
+	}
+
+	uint32_t base_vertex = vertex_space.allocate ((uint32_t)vertices.size ());
+	if (base_vertex == FreeListAllocator::INVALID) {
+		fprintf (stderr, "Geometry arena out of vertex space (%d needed)\n", (int)vertices.size ());
+		return false;
+	}
+	uint32_t first_index = index_space.allocate ((uint32_t)indices.size ());
+	if (first_index == FreeListAllocator::INVALID) {
+		vertex_space.release (base_vertex, (uint32_t)vertices.size ());
+		fprintf (stderr, "Geometry arena out of index space (%d needed)\n", (int)indices.size ());
+		return false;
+	}
+
+	glBindBuffer (GL_ARRAY_BUFFER, vertex_buffer);
+	glBufferSubData (GL_ARRAY_BUFFER, (GLintptr)base_vertex * sizeof (ArenaVertex),
+		vertices.size () * sizeof (ArenaVertex), &vertices[0]);
+	std::vector<float> packed (vertices.size () * 3);
+	for (size_t i = 0; i < vertices.size (); i++) {
+		memcpy (&packed[i * 3], vertices[i].position, sizeof (vertices[i].position));
+	}
+	glBindBuffer (GL_ARRAY_BUFFER, position_buffer);
+	glBufferSubData (GL_ARRAY_BUFFER, (GLintptr)base_vertex * sizeof (float) * 3, packed.size () * sizeof (float), &packed[0]);
+	glBindBuffer (GL_COPY_WRITE_BUFFER, index_buffer);
+	glBufferSubData (GL_COPY_WRITE_BUFFER, (GLintptr)first_index * sizeof (GLuint),
+		indices.size () * sizeof (GLuint), &indices[0]);
+
+	out.base_vertex = base_vertex;
+	out.vertex_count = (uint32_t)vertices.size ();
+	out.first_index = first_index;
+	out.index_count = (uint32_t)indices.size ();
+	return true;
+}
+
+void GeometryArena::release (const MeshAllocation& mesh) {
+	vertex_space.release (mesh.base_vertex, mesh.vertex_count);
+	index_space.release (mesh.first_index, mesh.index_count);
+}
@@ -0,0 +1,83 @@
+#ifndef _GEOMETRY_ARENA_H_
+#define _GEOMETRY_ARENA_H_
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <GL/glew.h>
+#include "maths_funcs.h"
+
+// first-fit allocator over a range of elements, neighbouring free blocks are merged
+class FreeListAllocator {
+public:
+	static const uint32_t INVALID = 0xffffffffu;
+
+	void init (uint32_t capacity);
+	//! offset of a free run of size elements, INVALID when full
+	uint32_t allocate (uint32_t size);
+	void release (uint32_t offset, uint32_t size);
+	uint32_t free_space () const { return free_total; }
+
+private:
+	std::map<uint32_t, uint32_t> free_blocks; // offset -> size
+	uint32_t free_total = 0;
+};
+
+// vertex layout shared by everything in the arena
+struct ArenaVertex {
+	float position[3];
+	float normal[3];
+	float texcoord[2];
+};
+
+// where one mesh lives inside the arena buffers
+struct MeshAllocation {
+	uint32_t first_index = 0;
+	uint32_t index_count = 0;
+	uint32_t base_vertex = 0;
+	uint32_t vertex_count = 0;
+};
+
+// layout of one glMultiDrawElementsIndirect record
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+/* one vertex buffer, one index buffer and one VAO that many meshes are
+   sub-allocated from, so they can all be drawn without switching VAOs.
+   attributes: 0 position, 1 normal, 2 texcoord.
+   positions are also kept in a tightly packed buffer of their own with a
+   second VAO over it and the same indices, for depth-only passes that
+   would otherwise fetch whole 32-byte vertices to read 12 bytes. */
+class GeometryArena {
+public:
+	bool init (uint32_t vertex_capacity, uint32_t index_capacity);
+	void destroy ();
+
+	/* welds identical vertices of an unindexed triangle list and copies the
+	   result into the arena. texcoords may be empty. */
+	bool upload (const std::vector<vec3>& positions, const std::vector<vec3>& normals,
+		const std::vector<vec2>& texcoords, MeshAllocation& out);
+	void release (const MeshAllocation& mesh);
+
+	GLuint get_vao () const { return vao; }
+	//! attribute 0 only, same base vertices and indices as get_vao ()
+	GLuint get_position_vao () const { return position_vao; }
+	uint32_t free_vertices () const { return vertex_space.free_space (); }
+	uint32_t free_indices () const { return index_space.free_space (); }
+
+private:
+	GLuint vao = 0;
+	GLuint position_vao = 0;
+	GLuint vertex_buffer = 0;
+	GLuint position_buffer = 0;
+	GLuint index_buffer = 0;
+	FreeListAllocator vertex_space;
+	FreeListAllocator index_space;
+};
+
+#endif
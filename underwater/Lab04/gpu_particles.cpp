@@ -0,0 +1,167 @@
+#include "gpu_particles.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// vertex-only program whose outputs are captured interleaved in GpuParticle order
+static GLuint compile_update_program (const char* file_name) {
+	std::ifstream file (file_name, std::ios::binary);
+	if (!file) {
+		fprintf (stderr, "ERROR: could not read %s\n", file_name);
+		return 0;
+	}
+	std::stringstream contents;
+	contents << file.rdbuf ();
+	std::string source = contents.str ();
+	const GLchar* text = source.c_str ();
+
+	GLuint shader = glCreateShader (GL_VERTEX_SHADER);
+	glShaderSource (shader, 1, &text, NULL);
+	glCompileShader (shader);
+	GLint success = 0;
+	glGetShaderiv (shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		GLchar log[1024] = { '\0' };
+		glGetShaderInfoLog (shader, sizeof (log), NULL, log);
+		fprintf (stderr, "Error compiling %s: %s\n", file_name, log);
+		glDeleteShader (shader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram ();
+	glAttachShader (program, shader);
+	const GLchar* varyings[] = {
+		"outPosition", "outSize", "outAlpha", "outVelocity", "outLifetime", "outSeed"
+	};
+	glTransformFeedbackVaryings (program, 6, varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram (program);
+	glDeleteShader (shader);
+	glGetProgramiv (program, GL_LINK_STATUS, &success);
+	if (!success) {
+		GLchar log[1024] = { '\0' };
+		glGetProgramInfoLog (program, sizeof (log), NULL, log);
+		fprintf (stderr, "Error linking %s: %s\n", file_name, log);
+		glDeleteProgram (program);
+		return 0;
+	}
+	return program;
+}
+
+static float random_unit () {
+	return (float)rand () / (float)RAND_MAX;
+}
+
+bool GpuParticleSystem::init (size_t particle_count, const ParticleEmitter& e, const char* update_shader_file) {
+	update_program = compile_update_program (update_shader_file);
+	if (!update_program) {
+		return false;
+	}
+	emitter = e;
+	count = particle_count;
+	current = 0;
+	time = 0.0f;
+
+	glUseProgram (update_program);
+	delta_location = glGetUniformLocation (update_program, "deltaTime");
+	time_location = glGetUniformLocation (update_program, "time");
+	glUniform3fv (glGetUniformLocation (update_program, "emitterMin"), 1, emitter.min);
+	glUniform3fv (glGetUniformLocation (update_program, "emitterMax"), 1, emitter.max);
+	glUniform3fv (glGetUniformLocation (update_program, "emitterVelocity"), 1, emitter.velocity);
+	glUniform1f (glGetUniformLocation (update_program, "maxLifetime"), emitter.lifetime);
+
+	// staggered lifetimes so respawns spread over time instead of arriving in bursts
+	std::vector<GpuParticle> initial (count);
+	for (size_t i = 0; i < count; i++) {
+		GpuParticle& p = initial[i];
+		for (int k = 0; k < 3; k++) {
+			p.position[k] = emitter.min[k] + random_unit () * (emitter.max[k] - emitter.min[k]);
+			p.velocity[k] = emitter.velocity[k];
+		}
+		p.size = (float)(rand () % 5 + 2);
+		p.alpha = 0.5f;
+		p.lifetime = random_unit () * emitter.lifetime;
+		p.seed = random_unit ();
+	}
+
+	glGenBuffers (2, buffers);
+	glGenVertexArrays (2, update_vaos);
+	glGenVertexArrays (2, render_vaos);
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer (GL_ARRAY_BUFFER, buffers[i]);
+		glBufferData (GL_ARRAY_BUFFER, count * sizeof (GpuParticle), &initial[0], GL_DYNAMIC_COPY);
+
+		glBindVertexArray (update_vaos[i]);
+		glEnableVertexAttribArray (0);
+		glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, position));
+		glEnableVertexAttribArray (1);
+		glVertexAttribPointer (1, 1, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, size));
+		glEnableVertexAttribArray (2);
+		glVertexAttribPointer (2, 1, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, alpha));
+		glEnableVertexAttribArray (3);
+		glVertexAttribPointer (3, 3, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, velocity));
+		glEnableVertexAttribArray (4);
+		glVertexAttribPointer (4, 1, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, lifetime));
+		glEnableVertexAttribArray (5);
+		glVertexAttribPointer (5, 1, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, seed));
+
+		// the point program only needs position, size and alpha
+		glBindVertexArray (render_vaos[i]);
+		glEnableVertexAttribArray (0);
+		glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, position));
+		glEnableVertexAttribArray (1);
+		glVertexAttribPointer (1, 1, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, size));
+		glEnableVertexAttribArray (2);
+		glVertexAttribPointer (2, 1, GL_FLOAT, GL_FALSE, sizeof (GpuParticle), (void*)offsetof (GpuParticle, alpha));
+	}
+	glBindVertexArray (0);
+
+	printf ("=> GPU particles: %d particles, %d MB of state \n",
+		(int)count, (int)(2 * count * sizeof (GpuParticle) / (1024 * 1024)));
+	return true;
+}
+
+void GpuParticleSystem::destroy () {
+	glDeleteProgram (update_program);
+	glDeleteBuffers (2, buffers);
+	glDeleteVertexArrays (2, update_vaos);
+	glDeleteVertexArrays (2, render_vaos);
+	update_program = 0;
+	count = 0;
+}
+
+void GpuParticleSystem::update (float delta_time) {
+	if (!update_program) {
+		return;
+	}
+	time += delta_time;
+	int next = 1 - current;
+
+	glUseProgram (update_program);
+	glUniform1f (delta_location, delta_time);
+	glUniform1f (time_location, time);
+
+	glEnable (GL_RASTERIZER_DISCARD);
+	glBindVertexArray (update_vaos[current]);
+	glBindBufferBase (GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[next]);
+	glBeginTransformFeedback (GL_POINTS);
+	glDrawArrays (GL_POINTS, 0, (GLsizei)count);
+	glEndTransformFeedback ();
+	glBindBufferBase (GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+	glDisable (GL_RASTERIZER_DISCARD);
+	glBindVertexArray (0);
+
+	current = next;
+}
+
+void GpuParticleSystem::draw (size_t max_count) {
+	if (!update_program) {
+		return;
+	}
+	glBindVertexArray (render_vaos[current]);
+	glDrawArrays (GL_POINTS, 0, (GLsizei)(max_count < count ? max_count : count));
+	glBindVertexArray (0);
+}
@@ -0,0 +1,55 @@
+#ifndef _GPU_PARTICLES_H_
+#define _GPU_PARTICLES_H_
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+/* state of one particle on the GPU. the first three fields line up with
+   ParticleVertex so the same point program can draw straight out of it. */
+struct GpuParticle {
+	float position[3];
+	float size;
+	float alpha;
+	float velocity[3];
+	float lifetime;
+	float seed;
+};
+
+// box the bubbles spawn in and how they move, mirrors the CPU emitter in updateScene
+struct ParticleEmitter {
+	float min[3];
+	float max[3];
+	float velocity[3];
+	float lifetime;
+};
+
+/* particle simulation that never leaves the GPU. state lives in two buffers;
+   every update runs a vertex shader over one with transform feedback into the
+   other (rasterizer discarded), moving particles, ageing them and respawning
+   the dead ones, then the two swap. */
+class GpuParticleSystem {
+public:
+	bool init (size_t count, const ParticleEmitter& emitter, const char* update_shader_file);
+	void destroy ();
+	void update (float delta_time);
+	//! draws the first max_count particles as points, the caller binds the point program.
+	//! they are all alike, so any prefix is a fair thinning of the whole set
+	void draw (size_t max_count);
+
+	bool is_ready () const { return update_program != 0; }
+	size_t get_count () const { return count; }
+
+private:
+	GLuint update_program = 0;
+	GLuint buffers[2] = { 0, 0 };
+	GLuint update_vaos[2] = { 0, 0 };
+	GLuint render_vaos[2] = { 0, 0 };
+	int current = 0;
+	size_t count = 0;
+	float time = 0.0f;
+	ParticleEmitter emitter;
+	GLint delta_location = -1;
+	GLint time_location = -1;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "gpu_profiler.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+// the GPU clock drifts against the CPU one, line them up again this often
+static const int CALIBRATE_FRAMES = 600;
+
+static int64_t now_ns () {
+	using namespace std::chrono;
+	return (int64_t)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count ();
+}
+
+bool GpuProfiler::init () {
+	// errors left over from earlier calls would read as ours below
+	while (glGetError () != GL_NO_ERROR) {
+	}
+	for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		glGenQueries (MAX_SCOPES * 2, pools[i].queries);
+		pools[i].count = 0;
+		pools[i].pending = false;
+		pools[i].frame = 0;
+	}
+	current = 0;
+	frame = 0;
+	open.clear ();
+	histories.clear ();
+	trace.clear ();
+	trace.reserve (TRACE_EVENTS);
+	trace_next = 0;
+	calibrate ();
+	ready = glGetError () == GL_NO_ERROR;
+	return ready;
+}
+
+void GpuProfiler::destroy () {
+	if (!ready) {
+		return;
+	}
+	for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+		glDeleteQueries (MAX_SCOPES * 2, pools[i].queries);
+	}
+	ready = false;
+}
+
+void GpuProfiler::calibrate () {
+	GLint64 gpu = 0;
+	glGetInteger64v (GL_TIMESTAMP, &gpu);
+	clock_offset_ns = now_ns () - (int64_t)gpu;
+}
+
+/*------------------------------- RECORDING -------------------------------*/
+
+void GpuProfiler::begin_frame () {
+	if (!ready) {
+		return;
+	}
+	Pool& pool = pools[current];
+	if (pool.pending) {
+		collect (pool);
+	}
+	if (frame % CALIBRATE_FRAMES == 0) {
+		calibrate ();
+	}
+	pool.count = 0;
+	pool.frame = frame;
+	open.clear ();
+}
+
+void GpuProfiler::end_frame () {
+	if (!ready) {
+		return;
+	}
+	// scopes left open by an early return end here
+	while (!open.empty ()) {
+		pop ();
+	}
+	pools[current].pending = pools[current].count > 0;
+	current = (current + 1) % FRAMES_IN_FLIGHT;
+	frame++;
+}
+
+void GpuProfiler::push (const char* name) {
+	if (!ready) {
+		return;
+	}
+	Pool& pool = pools[current];
+	if (pool.count == MAX_SCOPES) {
+		open.push_back (-1);
+		return;
+	}
+	Scope& scope = pool.scopes[pool.count];
+	scope.name = name;
+	scope.depth = (int)open.size ();
+	scope.begin_query = pool.queries[pool.count * 2];
+	scope.end_query = pool.queries[pool.count * 2 + 1];
+	glQueryCounter (scope.begin_query, GL_TIMESTAMP);
+	open.push_back (pool.count++);
+}
+
+void GpuProfiler::pop () {
+	if (!ready || open.empty ()) {
+		return;
+	}
+	int index = open.back ();
+	open.pop_back ();
+	if (index >= 0) {
+		glQueryCounter (pools[current].scopes[index].end_query, GL_TIMESTAMP);
+	}
+}
+
+/*------------------------------- READ BACK -------------------------------*/
+
+GpuProfiler::History& GpuProfiler::history_of (const char* name, int depth) {
+	for (History& h : histories) {
+		if (h.depth == depth && h.name == name) {
+			return h;
+		}
+	}
+	History h;
+	h.name = name;
+	h.depth = depth;
+	h.next = 0;
+	histories.push_back (h);
+	return histories.back ();
+}
+
+// only reached FRAMES_IN_FLIGHT frames later, the results are normally there by now
+void GpuProfiler::collect (Pool& pool) {
+	for (int i = 0; i < pool.count; i++) {
+		const Scope& scope = pool.scopes[i];
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v (scope.begin_query, GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v (scope.end_query, GL_QUERY_RESULT, &end);
+		double dur_ms = end > begin ? (double)(end - begin) * 1e-6 : 0.0;
+
+		History& h = history_of (scope.name, scope.depth);
+		if ((int)h.samples.size () < WINDOW) {
+			h.samples.push_back ((float)dur_ms);
+		}
+		else {
+			h.samples[h.next] = (float)dur_ms;
+		}
+		h.next = (h.next + 1) % WINDOW;
+
+		TraceEvent e;
+		e.name = scope.name;
+		e.frame = pool.frame;
+		e.depth = scope.depth;
+		e.ts_us = (double)((int64_t)begin + clock_offset_ns) * 1e-3;
+		e.dur_us = dur_ms * 1e3;
+		if (trace.size () < (size_t)TRACE_EVENTS) {
+			trace.push_back (e);
+		}
+		else {
+			trace[trace_next] = e;
+		}
+		trace_next = (trace_next + 1) % TRACE_EVENTS;
+	}
+	pool.pending = false;
+}
+
+/*--------------------------------- OUTPUT --------------------------------*/
+
+void GpuProfiler::get_stats (std::vector<GpuScopeStats>& out) const {
+	out.clear ();
+	std::vector<float> sorted;
+	for (const History& h : histories) {
+		GpuScopeStats s;
+		s.name = h.name;
+		s.depth = h.depth;
+		s.samples = (int)h.samples.size ();
+		s.avg_ms = s.min_ms = s.max_ms = s.p99_ms = 0.0;
+		if (!h.samples.empty ()) {
+			sorted = h.samples;
+			std::sort (sorted.begin (), sorted.end ());
+			double sum = 0.0;
+			for (float v : sorted) {
+				sum += v;
+			}
+			size_t p99 = (sorted.size () * 99 + 99) / 100 - 1;
+			s.avg_ms = sum / sorted.size ();
+			s.min_ms = sorted.front ();
+			s.max_ms = sorted.back ();
+			s.p99_ms = sorted[p99 < sorted.size () ? p99 : sorted.size () - 1];
+		}
+		out.push_back (s);
+	}
+}
+
+void GpuProfiler::report () const {
+	std::vector<GpuScopeStats> stats;
+	get_stats (stats);
+	printf ("GPU passes over the last %d frames (avg / min / max / p99 ms):\n", WINDOW);
+	for (const GpuScopeStats& s : stats) {
+		printf ("  %*s%-*s %6.3f %6.3f %6.3f %6.3f\n", s.depth * 2, "", 20 - s.depth * 2, s.name.c_str (),
+			s.avg_ms, s.min_ms, s.max_ms, s.p99_ms);
+	}
+}
+
+void GpuProfiler::append_trace_events (std::string& out, int pid, int tid) const {
+	char line[256];
+	// oldest first, the ring starts at trace_next once it has wrapped
+	size_t start = trace.size () < (size_t)TRACE_EVENTS ? 0 : trace_next;
+	for (size_t i = 0; i < trace.size (); i++) {
+		const TraceEvent& e = trace[(start + i) % trace.size ()];
+		snprintf (line, sizeof (line),
+			"%s{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+			out.empty () ? "" : ",\n", e.name, pid, tid, e.ts_us, e.dur_us, e.frame);
+		out += line;
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef _GPU_PROFILER_H_
+#define _GPU_PROFILER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// timing of one named scope over the sliding window
+struct GpuScopeStats {
+	std::string name;
+	int depth; // 0 for top-level scopes
+	int samples;
+	double avg_ms, min_ms, max_ms, p99_ms;
+};
+
+/* GPU time per render pass from GL_TIMESTAMP queries.
+   every scope writes a timestamp when it opens and one when it closes, so
+   scopes nest freely (GL_TIME_ELAPSED queries cannot). each frame owns a
+   pool of queries from a ring of FRAMES_IN_FLIGHT pools; a pool is only
+   read back when the ring comes round to it, by which time the GPU has
+   normally finished it and nothing stalls. durations go into a WINDOW
+   frame history per scope for the stats, and the last TRACE_EVENTS scopes
+   are kept as trace events on the CPU clock (steady_clock microseconds),
+   so they line up with CPU markers in the same trace file. that is
+   TRACE_FRAMES frames when every frame fills its MAX_SCOPES, more frames
+   when fewer scopes are open. */
+class GpuProfiler {
+public:
+	static const int FRAMES_IN_FLIGHT = 4;
+	static const int MAX_SCOPES = 32; // per frame, deeper or later scopes are dropped
+	static const int WINDOW = 240;
+	static const int TRACE_FRAMES = 300;
+	static const int TRACE_EVENTS = TRACE_FRAMES * MAX_SCOPES;
+
+	bool init ();
+	void destroy ();
+
+	//! reads back the pool this frame reuses, then starts recording into it
+	void begin_frame ();
+	void end_frame ();
+	//! name must outlive the profiler, a string literal in practice
+	void push (const char* name);
+	void pop ();
+
+	//! one entry per scope seen so far, in first-seen order
+	void get_stats (std::vector<GpuScopeStats>& out) const;
+	//! one line per scope, indented by depth
+	void report () const;
+	//! chrome trace events of the kept frames, comma separated, for merging into a larger trace
+	void append_trace_events (std::string& out, int pid, int tid) const;
+
+private:
+	struct Scope {
+		const char* name;
+		int depth;
+		GLuint begin_query, end_query;
+	};
+	struct Pool {
+		GLuint queries[MAX_SCOPES * 2];
+		Scope scopes[MAX_SCOPES];
+		int count;
+		bool pending;
+		int frame;
+	};
+	struct History {
+		std::string name;
+		int depth;
+		std::vector<float> samples; // ring of WINDOW durations in ms
+		int next;
+	};
+	struct TraceEvent {
+		const char* name;
+		int frame;
+		int depth;
+		double ts_us, dur_us;
+	};
+
+	void collect (Pool& pool);
+	void calibrate ();
+	History& history_of (const char* name, int depth);
+
+	Pool pools[FRAMES_IN_FLIGHT];
+	int current = 0;
+	int frame = 0;
+	bool ready = false;
+	std::vector<int> open; // scope indices into the current pool, -1 for dropped ones
+	int64_t clock_offset_ns = 0; // CPU steady_clock minus GPU timestamp
+	std::vector<History> histories;
+	std::vector<TraceEvent> trace; // ring of TRACE_EVENTS events
+	size_t trace_next = 0;
+};
+
+// opens a scope for the lifetime of the object
+class GpuScope {
+public:
+	GpuScope (GpuProfiler& p, const char* name) : profiler (p) { profiler.push (name); }
+	~GpuScope () { profiler.pop (); }
+private:
+	GpuProfiler& profiler;
+};
+
+#endif
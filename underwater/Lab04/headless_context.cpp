@@ -0,0 +1,140 @@
+#include "headless_context.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#ifdef HEADLESS_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static bool create_egl (int major, int minor, EGLDisplay& out_display, EGLContext& out_context) {
+	// surfaceless needs no X or GBM device; plain eglGetDisplay still works with Mesa's default platform
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress ("eglGetPlatformDisplayEXT");
+	EGLDisplay display = EGL_NO_DISPLAY;
+	if (get_platform_display) {
+		display = get_platform_display (EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay (EGL_DEFAULT_DISPLAY);
+	}
+	EGLint egl_major = 0, egl_minor = 0;
+	if (display == EGL_NO_DISPLAY || !eglInitialize (display, &egl_major, &egl_minor)) {
+		fprintf (stderr, "ERROR: no EGL display\n");
+		return false;
+	}
+	if (!eglBindAPI (EGL_OPENGL_API)) {
+		fprintf (stderr, "ERROR: EGL has no desktop OpenGL\n");
+		eglTerminate (display);
+		return false;
+	}
+
+	const EGLint config_attribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config = NULL;
+	EGLint config_count = 0;
+	eglChooseConfig (display, config_attribs, &config, 1, &config_count);
+	if (config_count == 0) {
+		config = NULL; // EGL_KHR_no_config_context, the surfaceless platform may list no configs
+	}
+
+	// compatibility profile: the scene still draws GL_QUADS
+	const EGLint versioned[] = {
+		EGL_CONTEXT_MAJOR_VERSION, major,
+		EGL_CONTEXT_MINOR_VERSION, minor,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext (display, config, EGL_NO_CONTEXT, versioned);
+	if (context == EGL_NO_CONTEXT) {
+		context = eglCreateContext (display, config, EGL_NO_CONTEXT, NULL);
+	}
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent (display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf (stderr, "ERROR: could not make a surfaceless EGL context current (0x%x)\n", eglGetError ());
+		if (context != EGL_NO_CONTEXT) {
+			eglDestroyContext (display, context);
+		}
+		eglTerminate (display);
+		return false;
+	}
+	out_display = display;
+	out_context = context;
+	return true;
+}
+#endif
+
+bool HeadlessContext::create (int major, int minor) {
+#ifdef _WIN32
+	(void)major;
+	(void)minor;
+	return false;
+#else
+	EGLDisplay egl_display = EGL_NO_DISPLAY;
+	EGLContext egl_context = EGL_NO_CONTEXT;
+	if (create_egl (major, minor, egl_display, egl_context)) {
+		display = egl_display;
+		context = egl_context;
+		backend = "egl";
+		return true;
+	}
+#ifdef HEADLESS_OSMESA
+	const int attribs[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 24,
+		OSMESA_PROFILE, OSMESA_COMPAT_PROFILE,
+		OSMESA_CONTEXT_MAJOR_VERSION, major,
+		OSMESA_CONTEXT_MINOR_VERSION, minor,
+		0
+	};
+	OSMesaContext osmesa = OSMesaCreateContextAttribs (attribs, NULL);
+	if (osmesa) {
+		// OSMesa wants a colour buffer to make current; everything is drawn into FBOs so a tiny one does
+		buffer = malloc (16 * 16 * 4);
+		if (OSMesaMakeCurrent (osmesa, buffer, GL_UNSIGNED_BYTE, 16, 16)) {
+			context = osmesa;
+			backend = "osmesa";
+			return true;
+		}
+		OSMesaDestroyContext (osmesa);
+		free (buffer);
+		buffer = 0;
+	}
+	fprintf (stderr, "ERROR: OSMesa context failed as well\n");
+#endif
+	return false;
+#endif
+}
+
+GLenum HeadlessContext::init_glew () {
+#ifdef _WIN32
+	return glewInit ();
+#else
+	// glewInit () goes on to glxewInit (), which needs a GLX display that an EGL context does not have.
+	// glewContextInit () only loads GL: through eglGetProcAddress in a GLEW built with GLEW_EGL, and
+	// through glvnd's dispatch otherwise, which routes to whichever context is current
+	return glewContextInit ();
+#endif
+}
+
+void HeadlessContext::destroy () {
+#ifndef _WIN32
+	if (display) {
+		eglMakeCurrent ((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext ((EGLDisplay)display, (EGLContext)context);
+		eglTerminate ((EGLDisplay)display);
+	}
+#ifdef HEADLESS_OSMESA
+	else if (context) {
+		OSMesaDestroyContext ((OSMesaContext)context);
+	}
+#endif
+	free (buffer);
+#endif
+	display = context = buffer = 0;
+	backend = "none";
+}
@@ -0,0 +1,29 @@
+#ifndef _HEADLESS_CONTEXT_H_
+#define _HEADLESS_CONTEXT_H_
+
+#include <GL/glew.h>
+
+/* an OpenGL context with no window, for benchmarks on machines without a
+   display. EGL on the surfaceless platform (EGL_MESA_platform_surfaceless,
+   Mesa llvmpipe is enough) is tried first; builds with HEADLESS_OSMESA
+   fall back to OSMesa. there is no default framebuffer either way, the
+   caller renders into an FBO. on windows create() fails and the caller
+   uses a hidden GLUT window instead. */
+class HeadlessContext {
+public:
+	//! a compatibility context, major.minor when the driver has it, whatever it offers otherwise
+	bool create (int major, int minor);
+	void destroy ();
+	//! loads the GL entry points for the current context, in place of glewInit (); GLEW_OK on success
+	GLenum init_glew ();
+	//! "egl", "osmesa" or "none"
+	const char* get_backend () const { return backend; }
+
+private:
+	const char* backend = "none";
+	void* display = 0; // EGLDisplay
+	void* context = 0; // EGLContext or OSMesaContext
+	void* buffer = 0; // OSMesa colour buffer, never read
+};
+
+#endif
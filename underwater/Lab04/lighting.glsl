@@ -0,0 +1,110 @@
+// Shared by the fragment shaders of the model and static programs:
+// the original light and its shadows, the clustered lights and the fog
+uniform vec3 Kd = vec3(0.0, 0.5, 0.7); // Diffuse color (blue-green underwater effect)
+uniform vec3 Ld = vec3(0.8, 0.9, 1.0); // Light intensity (slightly blue-tinted)
+
+// Clustered lights, filled on the CPU every frame (see clustered_lighting.h)
+layout(std140) uniform ClusterParams {
+    ivec4 clusterDims;      // tiles x, tiles y, depth slices, light count
+    vec4 clusterTileScale;  // tiles per pixel in x and y
+    vec4 clusterDepth;      // near, far, log scale, log bias
+};
+uniform samplerBuffer clusterLights;   // 3 texels per light: position + radius, color + intensity, direction + cos outer
+uniform usamplerBuffer clusterGrid;    // offset, count per cluster
+uniform usamplerBuffer clusterIndices;
+
+// The original light and its two shadow maps, filled by ShadowMaps::bind() every frame
+layout(std140) uniform ShadowParams {
+    mat4 shadowMatrices[2]; // Eye space to the static and the dynamic map
+    vec4 LightPosition;     // Light source position in eye space, fixed in the world
+    vec4 shadowState;       // Static map usable, dynamic map drawn this frame
+};
+uniform sampler2DShadow shadowStatic;  // Static world, redrawn only when the light moves
+uniform sampler2DShadow shadowDynamic; // Fish and the moving models, redrawn every frame
+
+// 1 where P is lit in this map or outside it, 0 in full shadow
+float shadow_lookup(sampler2DShadow map, mat4 matrix, vec3 P) {
+    vec4 coord = matrix * vec4(P, 1.0);
+    if (coord.w <= 0.0) {
+        return 1.0;
+    }
+    coord.xyz = coord.xyz / coord.w * 0.5 + 0.5;
+    if (any(lessThan(coord.xyz, vec3(0.0))) || any(greaterThan(coord.xy, vec2(1.0)))) {
+        return 1.0;
+    }
+    // The maps end behind their casters, anything further back is compared as if on the far plane
+    return texture(map, vec3(coord.xy, min(coord.z, 1.0)));
+}
+
+// The darker of both maps, so moving and static casters shadow each other
+float shadow_visibility(vec3 P) {
+    float visibility = 1.0;
+    if (shadowState.x != 0.0) {
+        visibility = shadow_lookup(shadowStatic, shadowMatrices[0], P);
+    }
+    if (shadowState.y != 0.0) {
+        visibility = min(visibility, shadow_lookup(shadowDynamic, shadowMatrices[1], P));
+    }
+    return visibility;
+}
+
+// Underwater fog, set from main.cpp whenever the fog settings change.
+// The mode is a compile-time feature: FOG_EXP, FOG_EXP2 or linear when neither is defined
+layout(std140) uniform FogParams {
+    vec4 fogColor;
+    vec4 fogRange;  // start, end, density
+};
+
+// 1 keeps the surface color, 0 is all fog
+float fog_visibility(float distance) {
+#if defined(FOG_EXP)
+    return exp(-fogRange.z * distance);
+#elif defined(FOG_EXP2)
+    float d = fogRange.z * distance;
+    return exp(-d * d);
+#else
+    return clamp((fogRange.y - distance) / (fogRange.y - fogRange.x), 0.0, 1.0);
+#endif
+}
+
+vec3 clustered_lighting(vec3 P, vec3 N) {
+    ivec3 cell;
+    cell.xy = ivec2(gl_FragCoord.xy * clusterTileScale.xy);
+    cell.z = int(log(-P.z) * clusterDepth.z + clusterDepth.w);
+    cell = clamp(cell, ivec3(0), clusterDims.xyz - 1);
+    int cluster = (cell.z * clusterDims.y + cell.y) * clusterDims.x + cell.x;
+    uvec2 range = texelFetch(clusterGrid, cluster).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r) * 3;
+        vec4 positionRadius = texelFetch(clusterLights, light);
+        vec4 colorIntensity = texelFetch(clusterLights, light + 1);
+        vec4 directionCone = texelFetch(clusterLights, light + 2);
+
+        vec3 L = positionRadius.xyz - P;
+        float distance = length(L);
+        if (distance >= positionRadius.w) {
+            continue;
+        }
+        L /= distance;
+        // Smooth window so the light reaches exactly zero at its radius
+        float window = 1.0 - (distance * distance) / (positionRadius.w * positionRadius.w);
+        float attenuation = window * window / (1.0 + distance * distance);
+        if (directionCone.w > -1.0) {
+            float cosAngle = dot(-L, directionCone.xyz);
+            attenuation *= smoothstep(directionCone.w, mix(directionCone.w, 1.0, 0.25), cosAngle);
+        }
+        result += colorIntensity.rgb * colorIntensity.a * max(dot(N, L), 0.0) * attenuation;
+    }
+    return result;
+}
+
+// The original light plus every clustered light reaching P
+vec3 scene_lighting(vec3 P, vec3 N) {
+    // Light direction and attenuation
+    vec3 s = normalize(LightPosition.xyz - P);
+    float distance = length(LightPosition.xyz - P);
+    float attenuation = 1.0 / (1.0 + 0.02 * distance + 0.001 * distance * distance);
+    return Ld * Kd * max(dot(s, N), 0.0) * attenuation * shadow_visibility(P) + clustered_lighting(P, N);
+}
@@ -1,14 +1,23 @@
 // Windows includes (For Time, IO, etc.)
+#ifdef _WIN32
 #include <windows.h>
 #include <mmsystem.h>
+#endif
 #include <iostream>
 #include <string>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <chrono>
+#include <fstream>
 #include <vector> // STL dynamic memory.
 
 // OpenGL includes
 #include <GL/glew.h>
+#ifdef _WIN32
+#include <GL/wglew.h>
+#endif
 #include <GL/freeglut.h>
 
 
@@ -21,11 +30,38 @@
 
 // Project includes
 #include "maths_funcs.h"
+#ifdef _WIN32
 #include "corecrt_math_defines.h"
+#endif
+#include "bvh.h"
+#include "render_queue.h"
+#include "geometry_arena.h"
+#include "static_batch.h"
+#include "particle_renderer.h"
+#include "gpu_particles.h"
+#include "occlusion_culler.h"
+#include "clustered_lighting.h"
+#include "shader_cache.h"
+#include "render_target.h"
+#include "frame_governor.h"
+#include "frame_scheduler.h"
+#include "gpu_profiler.h"
+#include "cpu_profiler.h"
+#include "headless_context.h"
+#include "frame_benchmark.h"
+#include "software_rasterizer.h"
+#include "frame_capture.h"
+#include "sequence_renderer.h"
+#include "texture_array.h"
+#include "shadow_maps.h"
+#include "depth_prepass.h"
+#include "object_transforms.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include <map>
+#include <memory>
+#include <algorithm>
 
 vec3 cameraPosition(0.0f, 0.0f, 10.0f);
 float cameraRotationY = 0.0f; // For rotation around the Y-axis
@@ -48,6 +84,18 @@ float sharkRotationY = 0.0f;
 float squidDirectionX = 1.1f; // ˮƽƶ
 
 float aincradRotationX = 0.0f; // ڴ洢aincrad.daeתǶ
+float previousAincradRotationX = 0.0f;
+
+// The world advances in fixed steps; frames draw between the last two steps at renderAlpha
+FrameScheduler frameScheduler;
+const double simulationStep = 1.0 / 60.0;
+const int maxStepsPerFrame = 5; // Catch-up cap, longer stalls slow the world down instead
+double targetFps = 60.0; // Frame limiter, --fps 0 leaves pacing to vsync
+float renderAlpha = 1.0f;
+double simulationTimeMs = 0.0;
+// The governor may move the fish only every n-th step; they interpolate across the span of their last move
+int fishPendingSteps = 0; // Steps since the fish last moved
+int fishUpdateSpan = 1; // Steps the last fish move covered
 
 
 
@@ -86,15 +134,19 @@ struct Model {
     std::string name;
     ModelData data;
     vec3 position;
+    vec3 previousPosition; // position one simulation step ago
     float rotationY;
     GLuint vao; // VAO for this specific model
-    GLuint textureID;
+    int textureLayer; // Layer of materialTextures
     bool hasTexture; // ĲֵָʾǷ
+    bool isStatic; // never moves after loading, baked into staticBatches
+    AABB localBounds; // bounds of data.mVertices before the model matrix
 };
 
 struct ModelPart {
     ModelData data;
     GLuint vao;
+    std::shared_ptr<const ModelData> mesh; // CPU copy of the mesh, one for every copy of the fish
 };
 
 struct FishModel {
@@ -104,23 +156,227 @@ struct FishModel {
     float rotationY;
     vec3 direction; // New attribute for swimming direction
     float finAngle;
+    vec3 previousPosition; // position and fin angle one simulation step ago
+    float previousFinAngle;
     bool hasTexture;
-    GLuint textureID;
+    int textureLayer;
     vec3 color; // Add color attribute
+    AABB bodyBounds; // Local bounds of each part, for culling
+    AABB finBounds;
 };
 
 std::vector<Model> models; // Vector to hold multiple models
 std::vector<FishModel> fishModels; // Vector to hold multiple models
+
+// One entry per draw of the model program, rebuilt every frame
+struct DrawCommand {
+    GLuint vao;
+    int layer; // Layer of materialTextures, -1 when untextured
+    GLenum mode;
+    GLsizei count;
+    mat4 model;
+    vec3 color;
+};
+
+std::vector<DrawCommand> drawCommands;
+RenderQueue renderQueue;
+StateCache stateCache;
+
+// Matrices and colors of drawCommands worked out in parallel once per frame and read by the
+// object programs from a storage buffer; without GL 4.3 features the draws set uniforms instead
+ObjectTransforms objectTransforms;
+std::vector<ObjectInput> objectInputs;
+bool objectTransformPass = false;
+int objectThreads = 0; // --transform-threads, 0 uses every core
+
+// Immovable models baked into world-space batches at load time, one per
+// material and grid cell, so they need no matrix work per frame
+struct StaticBatch {
+    AABB bounds;
+    int layer; // Layer of materialTextures, -1 when untextured
+    vec3 color;
+    MeshAllocation mesh;
+    std::vector<uint32_t> sources; // Indices into models
+    bool occluder; // Rasterized into the Hi-Z buffer, never tested against it
+};
+
+// Extra placements of loaded static models, baked along with them; the scalability sweep scatters these
+struct StaticProp {
+    uint32_t model; // Index into models, whose mesh is reused
+    vec3 position;
+    float rotationY;
+};
+std::vector<StaticProp> staticProps;
+
+const float staticCellSize = 32.0f;
+std::vector<StaticBatch> staticBatches;
+StaticBVH staticBVH; // Hierarchy over staticBatches
+std::vector<uint32_t> visibleStatic; // Scratch list filled by the frustum query
+GeometryArena staticArena; // Geometry of every batch behind one VAO
+std::vector<DrawElementsIndirectCommand> indirectCommands;
+GLuint staticBatchBuffer = 0; // Per-batch color, written once
+GLuint indirectBuffer = 0;
+bool indirectStaticPass = false; // Falls back to glDrawElementsBaseVertex without GL 4.3 features
+int staticPassCalls = 0;
+int staticPassObjects = 0;
+std::vector<std::pair<bool, uint32_t>> staticOrder; // Visible batches in draw order, untextured first
+
+// Depth-only pre-pass, after which the opaque passes shade with GL_EQUAL; 'z' cycles auto, on and off
+DepthPrepass depthPrepass;
+PrepassMode prepassMode = PREPASS_AUTO;
+const float prepassEnableOverdraw = 2.0f; // Drawn fragments per pixel that turn it on in auto mode
+const float prepassDisableOverdraw = 1.5f;
+
+// Hi-Z occlusion culling against the big static batches, toggled with 'o'
+OcclusionCuller occlusionCuller;
+bool occlusionCulling = true;
+const float occluderMinExtent = 20.0f; // Batches at least this wide in x or z occlude
+const size_t occluderTriangleBudget = 65536;
+const int occlusionBufferWidth = 256;
+int occlusionTested = 0;
+int occlusionDrawsSaved = 0;
+double occlusionRasterUs = 0.0;
+double occlusionTestUs = 0.0;
+
+// Lamps and glowing fish, binned into clusters every frame; the first
+// fishLightCount lights follow every fishLightStride-th fish
+ClusteredLighting clusteredLighting;
+std::vector<ClusterLight> sceneLights;
+size_t fishLightCount = 0;
+const int fishLightStride = 4;
+const GLuint clusterTextureUnit = 1; // Units 1-3, unit 0 is the object texture
+double clusterBuildUs = 0.0;
+int clusterVisibleLights = 0;
+int clusterReferences = 0;
+int clusterMaxLights = 0;
+
+// Shadows of the main light: the static world goes into a cached map that is only redrawn
+// when the light moves or the world is rebaked, moving casters into a small map every frame
+ShadowMaps shadowMaps;
+bool shadowsEnabled = true; // Toggled with 'h'
+vec3 lightPosition = vec3(10.0f, 20.0f, 10.0f); // The main light of lighting.glsl, world space
+const GLuint shadowTextureUnit = 4; // Static and dynamic map, after the clusters
+const int staticShadowSize = 2048;
+const int dynamicShadowSize = 1024;
+AABB staticWorldBounds = aabb_empty(); // Everything the static map has to cover
+int shadowCasters = 0; // Dynamic casters drawn since the last report
+
+// Holds the frame budget by trading resolution, particles, LOD and fish updates, toggled with 'v'
+FrameGovernor frameGovernor;
+const GovernorSettings governorSettings = {
+    16.7f,        // target_ms, 60 Hz
+    0.5f, 0.1f,   // resolution scale down to 50% in 10% steps
+    0.25f, 0.25f, // particles down to a quarter
+    3.0f, 1.0f,   // LOD bias
+    4,            // fish animated at least every 4th update
+    0.75f, 15, 120, 30
+};
+GpuProfiler gpuProfiler; // GPU time per pass, merged into trace.json with the CPU markers
+int traceAfterFrames = 0; // --trace-frames N writes trace.json after N frames
+
+// --headless: no window, a fixed number of frames into an FBO, timings as JSON
+bool headless = false;
+HeadlessContext headlessContext;
+RenderTarget headlessTarget; // Stands in for the window's framebuffer
+GLuint windowFramebuffer = 0;
+FrameBenchmark frameBenchmark;
+int benchmarkFrames = 600;
+const char* benchmarkJson = "benchmark.json"; // --json, a file so the periodic reports on stdout stay apart
+unsigned int randomSeed = 1; // --seed, rand() and the engine start from it every run
+
+// --sweep: headless runs over growing fish, particle and static prop counts, one CSV row each
+bool sweep = false;
+const char* sweepCsv = "scalability.csv";
+int sweepFrames = 30; // Measured per configuration, after sweepWarmupFrames
+const int sweepWarmupFrames = 5;
+
+// --capture DIR or 'p': frames are read back through a PBO ring and written by worker threads
+FrameCapture frameCapture;
+bool captureOnStart = false;
+const char* captureDirectory = "capture";
+CaptureFormat captureFormat = CAPTURE_PNG; // --capture-format png|raw
+int captureThreads = 0; // --capture-threads, 0 leaves one core to the renderer
+
+// --sequence PATH: frames --range A B of a camera path rendered headless into numbered PNGs in the
+// capture directory; --processes N splits them across N copies of this program
+CameraPath cameraPath;
+const char* sequencePath = NULL;
+int sequenceFirst = 0;
+int sequenceLast = -1; // -1 is the last key of the path
+int sequenceProcesses = 1;
+int sequenceWorker = -1; // --sequence-worker i, passed to the copies the first process starts
+SequencePartition sequencePartition = PARTITION_CONTIGUOUS; // --partition contiguous|interleaved
+const auto processStart = std::chrono::steady_clock::now();
+RenderTarget sceneTarget; // Scene at the governor's resolution, blitted up to the window
+int renderWidth = 800;
+int renderHeight = 600;
+
+// LOD without authored LOD meshes: fish drop the fin draw past fishDetailDistance / (1 + bias),
+// and objects covering less than bias * smallObjectSize of the view are skipped
+const float fishDetailDistance = 30.0f;
+const float smallObjectSize = 0.01f;
+int lodSkippedDraws = 0;
+
+// --software or 'c': the models, fish and static world go through the CPU rasterizer instead of
+// the model and static programs; particles are still drawn by GL on top
+SoftwareRasterizer softwareRasterizer;
+bool softwareRendering = false;
+int softwareThreads = 0; // --raster-threads, 0 uses every core
+RenderTarget softwareTarget; // The rasterizer's frame is uploaded here and blitted into the scene
 #pragma endregion SimpleTypes
 
 using namespace std;
 
 std::map<std::string, unsigned int> shaders;
+ShaderCache shaderCache; // Linked program binaries kept in shader_cache/ between runs
+std::map<std::string, int> shaderRequests; // Handles of CompileShaders programs until finish_shaders()
+bool parallelShaderCompile = true; // --serial-shaders turns GL_KHR_parallel_shader_compile off for comparison
+bool firstFrameReported = false;
 
 int width = 800;
 int height = 600;
-
-GLuint loc1, loc2;
+float nearPlane = 0.1f;
+float farPlane = 1000.0f; // Pulled in to the fog end by apply_fog()
+
+// Fog evaluated in simpleFragmentShader; nothing past end is visible, so it
+// doubles as the far plane and the cull distance
+enum FogMode { FOG_LINEAR, FOG_EXP, FOG_EXP2, FOG_MODE_COUNT };
+struct FogSettings {
+    int mode;
+    float start, end; // exp modes pick their density so that end is fully fogged
+    vec3 color;
+};
+FogSettings fog = { FOG_LINEAR, 5.0f, 50.0f, vec3(0.0f, 0.2f, 0.3f) }; // Blue-greenish color for fog
+GLuint fogBuffer = 0;
+
+// Attribute layout locations of simpleVertexShader, fixed so no program has to be linked to look them up
+const GLuint loc1 = 0, loc2 = 1, loc3 = 2;
+
+// Feature bits of the model and static programs, each one becomes a #define
+// and every combination is its own compiled variant
+enum ShaderFeature {
+    FEATURE_TEXTURED = 1 << 0,
+    FEATURE_FOG_EXP = 1 << 1,
+    FEATURE_FOG_EXP2 = 1 << 2,
+};
+const char* const shaderFeatureNames[] = { "TEXTURED", "FOG_EXP", "FOG_EXP2" };
+const int shaderFeatureCount = 3;
+const int shaderVariantCount = 1 << shaderFeatureCount;
+
+// One compiled variant; uniform locations belong to the program, so each keeps its own.
+// program is named as soon as it is requested, the rest is filled in on first use
+struct ProgramVariant {
+    GLuint program;
+    int pending; // ShaderCache handle until resolved, -1 after
+    GLint model, diffuseColor, textureLayer;
+};
+ProgramVariant modelVariants[shaderVariantCount];
+ProgramVariant staticVariants[shaderVariantCount];
+ProgramVariant objectVariants[shaderVariantCount]; // The model programs with objectVertexShader, no per-draw uniforms
+ProgramVariant modelDepthVariant; // The vertex shaders above built with DEPTH_ONLY, for the pre-pass
+ProgramVariant staticDepthVariant;
+ProgramVariant objectDepthVariant;
+GLuint frameUniformBuffer = 0; // view and proj for every variant, binding 2
 
 GLuint textureID;
 Model terrain;
@@ -144,6 +400,7 @@ private:
 
 public:
     void update(float deltaTime) {
+        PROFILE_FUNCTION();
         for (auto& particle : particles) {
             particle.position += particle.velocity * deltaTime;
             particle.lifetime -= deltaTime;
@@ -163,43 +420,28 @@ public:
     const std::vector<Particle>& getParticles() const {
         return particles;
     }
+
+    void clear() {
+        particles.clear();
+    }
 };
 
 ParticleSystem particleSystem;
+int particleCount = 100; // Bubbles per burst, a new burst starts when the last one has died
+ParticleRenderer particleRenderer;
+double particleStreamUs = 0.0; // CPU time spent streaming particles since the last report
+size_t particleStreamCount = 0;
 
+// Alternate backend that simulates particles entirely on the GPU, toggled with 'g'
+GpuParticleSystem gpuParticleSystem;
+bool gpuParticles = false;
+const size_t gpuParticleCount = 1 << 20;
 
-GLuint loadTexture(const char* filePath) {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-
-    // Ʒʽ͹˷ʽ
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // 
-    int width, height, channels;
-    unsigned char* data = stbi_load(filePath, &width, &height, &channels, 0);
-    if (data) {
-        GLenum format = (channels == 3) ? GL_RGB : GL_RGBA;
-
-        // ϴ OpenGL
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        std::cout << "Texture loaded: " << filePath << " (" << width << "x" << height << ")" << std::endl;
-        stbi_image_free(data);
-    }
-    else {
-        std::cerr << "Failed to load texture: " << filePath << std::endl;
-        stbi_image_free(data);
-        return 0;
-    }
 
-    return textureID;
-}
+// Every model texture is a layer of one array, bound to unit 0 for the whole frame,
+// so draws that only differ in their texture no longer break batches
+TextureArray materialTextures;
+const int textureArraySize = 1024; // Layer size cap, larger images are scaled down
 
 int  channels;
 
@@ -236,8 +478,12 @@ Model load_heightmap_model(const char* heightmapFile, vec3 position, float rotat
     Model model;
     model.data = load_heightmap(heightmapFile, heightScale);
     model.position = position;
+    model.previousPosition = position;
     model.rotationY = rotationY;
     model.hasTexture = false;
+    model.textureLayer = -1;
+    model.isStatic = true;
+    model.localBounds = aabb_from_points(model.data.mVertices);
 
     //  VAO  VBOs
     glGenVertexArrays(1, &model.vao);
@@ -265,12 +511,13 @@ Model load_heightmap_model(const char* heightmapFile, vec3 position, float rotat
     glBindBuffer(GL_ARRAY_BUFFER, vn_vbo);
     glVertexAttribPointer(loc2, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 
-    GLint loc3 = glGetAttribLocation(shaders["model"], "vertex_texcoord");
     glEnableVertexAttribArray(loc3);
     glBindBuffer(GL_ARRAY_BUFFER, vt_vbo);
     glVertexAttribPointer(loc3, 2, GL_FLOAT, GL_FALSE, 0, NULL);
 
     glBindVertexArray(0);
+    // Hand finished programs their status while the next asset loads
+    shaderCache.poll();
     return model;
 }
 
@@ -377,12 +624,16 @@ Model load_model(const char* file_name, vec3 position, float rotationY, const ch
     }
 
     model.position = position;
+    model.previousPosition = position;
     model.rotationY = rotationY;
     model.hasTexture = false;
+    model.textureLayer = -1;
+    model.isStatic = true;
+    model.localBounds = aabb_from_points(model.data.mVertices);
 
     if (textureFile != nullptr && strlen(textureFile) > 0) {
-        model.textureID = loadTexture(textureFile);
-        model.hasTexture = true;
+        model.textureLayer = materialTextures.add(textureFile);
+        model.hasTexture = model.textureLayer >= 0;
     }
 
     // ɺͰ VAO
@@ -420,21 +671,37 @@ Model load_model(const char* file_name, vec3 position, float rotationY, const ch
         glGenBuffers(1, &vt_vbo);
         glBindBuffer(GL_ARRAY_BUFFER, vt_vbo);
         glBufferData(GL_ARRAY_BUFFER, model.data.mPointCount * sizeof(vec2), &model.data.mTextureCoords[0], GL_STATIC_DRAW);
-        GLint loc3 = glGetAttribLocation(shaders["model"], "vertex_texcoord");
         glEnableVertexAttribArray(loc3);
         glVertexAttribPointer(loc3, 2, GL_FLOAT, GL_FALSE, 0, NULL);
     }
 
     glBindVertexArray(0); // ú VAO
 
+    // Hand finished programs their status while the next asset loads
+    shaderCache.poll();
     return model;
 }
 
 
+// Frees the CPU copy of a mesh that lives in its VBOs, keeping the point count
+void release_vertex_data(ModelData& data) {
+    std::vector<vec3>().swap(data.mVertices);
+    std::vector<vec3>().swap(data.mNormals);
+    std::vector<vec2>().swap(data.mTextureCoords);
+}
+
+// Moves the CPU copy of a part where every copy of the fish shares it
+void share_vertex_data(ModelPart& part) {
+    part.mesh = std::make_shared<const ModelData>(part.data);
+    release_vertex_data(part.data);
+}
+
 FishModel load_fish_model(const char* file_name, vec3 position, float rotationY, const char* textureFile) {
     FishModel fishModel;
     fishModel.position = position;
+    fishModel.previousPosition = position;
     fishModel.rotationY = rotationY;
+    fishModel.finAngle = fishModel.previousFinAngle = 0.0f;
 
     // Generate a random color
     fishModel.color = vec3(randomFloat(0, 255) / 255.0f, randomFloat(0, 255) / 255.0f, randomFloat(0, 255) / 255.0f);
@@ -442,10 +709,11 @@ FishModel load_fish_model(const char* file_name, vec3 position, float rotationY,
     std::cout << "Fish Color: (" << fishModel.color.v[0] << ", " << fishModel.color.v[1] << ", " << fishModel.color.v[2] << ")\n";
 
     fishModel.hasTexture = false;
+    fishModel.textureLayer = -1;
 
     if (textureFile != nullptr && strlen(textureFile) > 0) {
-        fishModel.textureID = loadTexture(textureFile);
-        fishModel.hasTexture = true;
+        fishModel.textureLayer = materialTextures.add(textureFile);
+        fishModel.hasTexture = fishModel.textureLayer >= 0;
     }
 
     const aiScene* scene = aiImportFile(file_name, aiProcess_Triangulate | aiProcess_PreTransformVertices);
@@ -527,325 +795,1179 @@ FishModel load_fish_model(const char* file_name, vec3 position, float rotationY,
     }
 
     aiReleaseImport(scene);
+    fishModel.bodyBounds = aabb_from_points(fishModel.body.data.mVertices);
+    fishModel.finBounds = aabb_from_points(fishModel.fin.data.mVertices);
+    // Copies of a fish share one CPU mesh, so they cost no mesh memory
+    share_vertex_data(fishModel.body);
+    share_vertex_data(fishModel.fin);
     return fishModel;
 }
 
 
-void render_fish(const FishModel& fishModel) {
-    /*std::cout << "fishModel: " << std::endl;
-    print(fishPosition);
-    std::cout << "body vao: " << std::endl;*/
+#pragma endregion MESH LOADING
 
-    // Set color uniform
-    glUniform3fv(glGetUniformLocation(shaders["model"], "fishColor"), 1, &fishModel.color.v[0]);
+#pragma region SHADER_FUNCTIONS
+// Starts building name from the two files through the binary cache.
+// shaders[name] is usable right away; finish_shaders() checks the result.
+bool CompileShaders(string name, string vertex_file, string fragment_file) {
+    int request = shaderCache.request(name.c_str(), vertex_file.c_str(), fragment_file.c_str(), "");
+    shaders[name] = shaderCache.program_of(request);
+    shaderRequests[name] = request;
+    return request >= 0;
+}
 
-    // Set up body transformation
-    mat4 bodyModel = identity_mat4();
-    bodyModel = translate(bodyModel, fishModel.position);
-    bodyModel = rotate_y_deg(bodyModel, fishModel.rotationY);
+// Status of every CompileShaders program; a failed one is left as 0 in shaders
+void finish_shaders() {
+    for (const auto& entry : shaderRequests) {
+        shaders[entry.first] = shaderCache.finish(entry.second);
+        if (shaders[entry.first] == 0) {
+            std::cerr << "Error creating shader program " << entry.first << std::endl;
+        }
+    }
+}
+#pragma endregion SHADER_FUNCTIONS
+
+mat4 camera_projection() {
+    return perspective(45.0f, (float)width / (float)height, nearPlane, farPlane);
+}
+
+mat4 camera_view() {
+    mat4 view = identity_mat4();
+    view = translate(view, vec3(0.0f, 0.0f, -cameraDistance)); // Apply zoom (camera distance)
+    view = translate(view, -cameraPosition);                   // Apply camera position for WASD
+    view = rotate_x_deg(view, cameraRotationX);                // Vertical rotation
+    view = rotate_y_deg(view, cameraRotationY);                // Horizontal rotation
+    return view;
+}
+
+vec3 lerp(const vec3& a, const vec3& b, float t) {
+    return vec3(a.v[0] + (b.v[0] - a.v[0]) * t, a.v[1] + (b.v[1] - a.v[1]) * t, a.v[2] + (b.v[2] - a.v[2]) * t);
+}
 
-    // Check if model has a color and no texture
-    int color_location = glGetUniformLocation(shaders["model"], "diffuseColor");
-    glUniform1i(glGetUniformLocation(shaders["model"], "useTexture"), 0);
-    //printf("has color : %d \n", model.data.hasColor);
-    //print(model.data.diffuseColor);
+float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
 
-    //  color_location ǷЧ
-    if (color_location != -1) {
-        //print(fishModel.color);
-        glUniform3fv(color_location, 1, &fishModel.color.v[0]);
+// Placed between the last two simulation steps at renderAlpha
+mat4 model_matrix(const Model& model) {
+    mat4 modelMatrix = identity_mat4();
+    if ("assets/shark3.dae" == model.name) {
+        // ı任
+        modelMatrix = rotate_y_deg(modelMatrix, model.rotationY + sharkRotationY);
     }
-    else {
-        std::cerr << "Warning: diffuseColor uniform not found!" << std::endl;
+    else if (model.name == "assets/aincrad.dae") {
+        modelMatrix = rotate_y_deg(modelMatrix, lerp(previousAincradRotationX, aincradRotationX, renderAlpha)); // ӦYת
+    } else {
+        modelMatrix = rotate_y_deg(modelMatrix, model.rotationY);
     }
+    return translate(modelMatrix, lerp(model.previousPosition, model.position, renderAlpha));
+}
 
-    int model_location = glGetUniformLocation(shaders["model"], "model");
-    glUniformMatrix4fv(model_location, 1, GL_FALSE, bodyModel.m);
+mat4 prop_matrix(const StaticProp& prop) {
+    return translate(rotate_y_deg(identity_mat4(), prop.rotationY), prop.position);
+}
 
-    glBindVertexArray(fishModel.body.vao);
-    glDrawArrays(GL_TRIANGLES, 0, fishModel.body.data.mPointCount);
+// The terrain and qst meshes are quads, everything else triangles
+bool model_quads(const Model& model) {
+    return "terrain1.obj" == model.name || "assets/qst.obj" == model.name;
+}
 
-    // Set up fin transformation (hierarchical: start with bodys transform)
-    //printf("render_fish fin angle: %f \n", fishModel.finAngle);
+// Where the fish are between their last two moves, which can be several steps apart
+float fish_render_alpha() {
+    return std::min(1.0f, (fishPendingSteps + renderAlpha) / fishUpdateSpan);
+}
 
-    mat4 finModel = bodyModel;
-    finModel = rotate_z_deg(finModel, fishModel.finAngle);  // Apply oscillation to fin
-    glUniformMatrix4fv(model_location, 1, GL_FALSE, finModel.m);
+vec3 fish_render_position(const FishModel& fishModel) {
+    return lerp(fishModel.previousPosition, fishModel.position, fish_render_alpha());
+}
 
-    glBindVertexArray(fishModel.fin.vao);
+// Density of the exp modes, picked so that fog.end is fully fogged
+float fog_density() {
+    // Below 1/256 visibility the surface no longer shows in an 8-bit framebuffer
+    const float opaque = logf(256.0f);
+    if (fog.mode == FOG_EXP) {
+        return opaque / fog.end;
+    }
+    if (fog.mode == FOG_EXP2) {
+        return sqrtf(opaque) / fog.end;
+    }
+    return 0.0f;
+}
 
+// Uploads the fog block and moves the far plane to where the fog is opaque
+void apply_fog() {
+    float density = fog_density();
+    // The mode itself picks the program variant, see fog_features()
+    struct {
+        float color[4];
+        float range[4];
+    } block = {
+        { fog.color.v[0], fog.color.v[1], fog.color.v[2], 1.0f },
+        { fog.start, fog.end, density, 0.0f }
+    };
+    if (!fogBuffer) {
+        glGenBuffers(1, &fogBuffer);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, fogBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, fogBuffer);
+    farPlane = fog.end;
+}
 
+// Points a program's FogParams block at binding 1 and FrameParams at binding 2
+void attach_uniform_blocks(GLuint program) {
+    GLuint block = glGetUniformBlockIndex(program, "FogParams");
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block, 1);
+    }
+    block = glGetUniformBlockIndex(program, "FrameParams");
+    if (block != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block, 2);
+    }
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, fishModel.fin.data.mPointCount);
+// Features every draw shares this frame
+uint32_t fog_features() {
+    return fog.mode == FOG_EXP ? FEATURE_FOG_EXP : fog.mode == FOG_EXP2 ? FEATURE_FOG_EXP2 : 0;
+}
 
-    //printf("fish has texture: %d", fishModel.hasTexture);
+uint32_t draw_features(bool textured) {
+    return (textured ? FEATURE_TEXTURED : 0) | fog_features();
+}
 
-   /* if (fishModel.hasTexture) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, fishModel.textureID);
-        glUniform1i(glGetUniformLocation(shaderProgramID, "objectTexture"), 0);
-    }*/
+// Issues every used feature combination of one program pair, nothing waits on the driver here
+void request_variants(const char* name, const char* vertex_file, const char* fragment_file, ProgramVariant* variants) {
+    const uint32_t fogModes[] = { 0, FEATURE_FOG_EXP, FEATURE_FOG_EXP2 };
+    for (int i = 0; i < shaderVariantCount; i++) {
+        variants[i].program = 0;
+        variants[i].pending = -1;
+        variants[i].model = variants[i].diffuseColor = variants[i].textureLayer = -1;
+    }
+    for (uint32_t textured = 0; textured <= FEATURE_TEXTURED; textured++) {
+        for (uint32_t fogMode : fogModes) {
+            uint32_t features = textured | fogMode;
+            char variantName[64];
+            snprintf(variantName, sizeof(variantName), "%s_%u", name, features);
+            ProgramVariant& variant = variants[features];
+            variant.pending = shaderCache.request(variantName, vertex_file, fragment_file,
+                feature_defines(features, shaderFeatureNames, shaderFeatureCount));
+            variant.program = shaderCache.program_of(variant.pending);
+        }
+    }
+}
 
-    // useTextureuniform
-    //glUniform1i(glGetUniformLocation(shaderProgramID, "useTexture"), fishModel.hasTexture);
+// The shading vertex shader with DEPTH_ONLY, so the pre-pass writes exactly the depth the shading pass tests
+void request_depth_variant(const char* name, const char* vertex_file, ProgramVariant& variant) {
+    variant.model = variant.diffuseColor = variant.textureLayer = -1;
+    variant.pending = shaderCache.request(name, vertex_file, "depthFragmentShader.txt", "#define DEPTH_ONLY 1\n");
+    variant.program = shaderCache.program_of(variant.pending);
 }
 
-#pragma endregion MESH LOADING
+// First use: waits for the link if needed, then looks up locations and sets the fixed uniforms
+ProgramVariant& resolve_variant(ProgramVariant* variants, uint32_t features) {
+    ProgramVariant& variant = variants[features];
+    if (variant.pending < 0) {
+        return variant;
+    }
+    GLuint program = shaderCache.finish(variant.pending);
+    variant.pending = -1;
+    variant.program = program;
+    if (program == 0) {
+        std::cerr << "Error creating shader program variant " << features << std::endl;
+        return variant;
+    }
+    variant.model = glGetUniformLocation(program, "model");
+    variant.diffuseColor = glGetUniformLocation(program, "diffuseColor");
+    variant.textureLayer = glGetUniformLocation(program, "textureLayer");
+    // Every textured draw samples a layer of the array on unit 0
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "objectTexture"), 0);
+    clusteredLighting.attach(program, clusterTextureUnit);
+    shadowMaps.attach(program, shadowTextureUnit);
+    attach_uniform_blocks(program);
+    return variant;
+}
 
-#pragma region SHADER_FUNCTIONS
-char* readShaderSource(const char* shaderFile) {
-    FILE* fp;
-    fopen_s(&fp, shaderFile, "rb");
+// Camera matrices for the frame, read by every variant through FrameParams
+void update_frame_uniforms(const mat4& view, const mat4& proj) {
+    if (!frameUniformBuffer) {
+        glGenBuffers(1, &frameUniformBuffer);
+    }
+    mat4 block[2] = { view, proj };
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), block, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, frameUniformBuffer);
+}
 
-    if (fp == NULL) { return NULL; }
+// Bakes every static model into batches inside one arena and builds the BVH over them
+void build_static_world() {
+    // Rebuilding (the sweep changes staticProps) starts from an empty world
+    staticArena.destroy();
+    staticBatches.clear();
+    occlusionCuller.clear_occluders();
+    glDeleteBuffers(1, &staticBatchBuffer);
+    glDeleteBuffers(1, &indirectBuffer);
+    staticBatchBuffer = indirectBuffer = 0;
+    indirectStaticPass = false;
+
+    // Models merge when they share a texture layer and a color
+    std::vector<int> materialLayers;
+    std::vector<vec3> materialColors;
+    std::vector<BakeInput> inputs;
+    for (uint32_t i = 0; i < models.size() + staticProps.size(); i++) {
+        const StaticProp* prop = i < models.size() ? NULL : &staticProps[i - models.size()];
+        const Model& model = prop ? models[prop->model] : models[i];
+        if (!model.isStatic) {
+            continue;
+        }
+        int layer = model.hasTexture ? model.textureLayer : -1;
+        vec3 color = model.data.hasColor ? model.data.diffuseColor : vec3(1.0f, 1.0f, 1.0f);
+        uint32_t material = 0;
+        while (material < materialLayers.size() &&
+            (materialLayers[material] != layer || memcmp(materialColors[material].v, color.v, sizeof(color.v)) != 0)) {
+            material++;
+        }
+        if (material == materialLayers.size()) {
+            materialLayers.push_back(layer);
+            materialColors.push_back(color);
+        }
+        BakeInput input;
+        input.positions = &model.data.mVertices;
+        input.normals = &model.data.mNormals;
+        input.texcoords = &model.data.mTextureCoords;
+        input.transform = prop ? prop_matrix(*prop) : model_matrix(model);
+        input.material = material;
+        input.source = prop ? prop->model : i;
+        inputs.push_back(input);
+    }
 
-    fseek(fp, 0L, SEEK_END);
-    long size = ftell(fp);
+    std::vector<BakedBatch> baked;
+    bake_static_batches(inputs, staticCellSize, baked);
 
-    fseek(fp, 0L, SEEK_SET);
-    char* buf = new char[size + 1];
-    fread(buf, 1, size, fp);
-    buf[size] = '\0';
+    uint32_t vertexTotal = 0;
+    for (const BakedBatch& batch : baked) {
+        vertexTotal += (uint32_t)batch.positions.size();
+    }
+    // Welding only shrinks the vertex count, the rest is headroom for props added later
+    uint32_t capacity = vertexTotal + vertexTotal / 4;
+    if (!staticArena.init(capacity, capacity)) {
+        fprintf(stderr, "ERROR: could not create the static geometry arena\n");
+        return;
+    }
 
-    fclose(fp);
+    occlusionCuller.init(occlusionBufferWidth, occlusionBufferWidth * height / width);
+    std::vector<AABB> bounds;
+    for (const BakedBatch& source : baked) {
+        StaticBatch batch;
+        if (!staticArena.upload(source.positions, source.normals, source.texcoords, batch.mesh)) {
+            continue;
+        }
+        batch.bounds = source.bounds;
+        batch.layer = materialLayers[source.material];
+        batch.color = materialColors[source.material];
+        batch.sources = source.sources;
+        // Wide batches (terrain, rocks) hide most of the scene, keep their triangles for the depth pre-pass
+        float extent = std::max(batch.bounds.max[0] - batch.bounds.min[0], batch.bounds.max[2] - batch.bounds.min[2]);
+        batch.occluder = extent >= occluderMinExtent &&
+            occlusionCuller.occluder_triangles() + source.positions.size() / 3 <= occluderTriangleBudget;
+        if (batch.occluder) {
+            occlusionCuller.add_occluder(source.positions);
+        }
+        staticBatches.push_back(batch);
+        bounds.push_back(batch.bounds);
+    }
+    staticBVH.build(bounds);
+    staticWorldBounds = aabb_empty();
+    for (const AABB& box : bounds) {
+        aabb_merge(staticWorldBounds, box);
+    }
+    shadowMaps.invalidate();
+    printf("=> static world: %d models baked into %d batches, BVH %d nodes, depth %d \n",
+        (int)inputs.size(), (int)staticBatches.size(), (int)staticBVH.node_count(), staticBVH.depth());
+    printf("=> occlusion: %d occluder triangles into a %dx%d Hi-Z buffer \n",
+        (int)occlusionCuller.occluder_triangles(), occlusionCuller.get_width(), occlusionCuller.get_height());
+
+    if (!GLEW_ARB_multi_draw_indirect || !GLEW_ARB_shader_draw_parameters || !GLEW_ARB_shader_storage_buffer_object) {
+        printf("=> multi-draw indirect unavailable, one draw call per static batch \n");
+        return;
+    }
+    // Requested at the start of init(), by now the driver has had the whole asset load to build them
+    bool staticProgramsOk = true;
+    for (int i = 0; i < shaderVariantCount; i++) {
+        if (staticVariants[i].pending >= 0) {
+            staticProgramsOk = resolve_variant(staticVariants, i).program != 0 && staticProgramsOk;
+        }
+    }
+    if (staticDepthVariant.pending >= 0) {
+        staticProgramsOk = resolve_variant(&staticDepthVariant, 0).program != 0 && staticProgramsOk;
+    }
+    if (!staticProgramsOk) {
+        printf("=> static program unavailable, one draw call per static batch \n");
+        return;
+    }
 
-    return buf;
+    std::vector<vec4> colors;
+    for (const StaticBatch& batch : staticBatches) {
+        colors.push_back(vec4(batch.color, (float)batch.layer));
+    }
+    glGenBuffers(1, &staticBatchBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, staticBatchBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, colors.size() * sizeof(vec4), colors.empty() ? NULL : &colors[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &indirectBuffer);
+    indirectStaticPass = true;
 }
 
-static void AddShader(GLuint ShaderProgram, const char* pShaderText, GLenum ShaderType) {
-    GLuint ShaderObj = glCreateShader(ShaderType);
+// Resolves the object programs, requested at the start of init(); the uniform path stays if they fail
+void enable_object_transforms() {
+    objectTransformPass = false;
+    if (!GLEW_ARB_shader_draw_parameters || !GLEW_ARB_shader_storage_buffer_object || !GLEW_ARB_base_instance) {
+        printf("=> object buffer unavailable, model matrices go through uniforms \n");
+        return;
+    }
+    bool objectProgramsOk = true;
+    for (int i = 0; i < shaderVariantCount; i++) {
+        if (objectVariants[i].pending >= 0) {
+            objectProgramsOk = resolve_variant(objectVariants, i).program != 0 && objectProgramsOk;
+        }
+    }
+    objectProgramsOk = resolve_variant(&objectDepthVariant, 0).program != 0 && objectProgramsOk;
+    if (!objectProgramsOk) {
+        printf("=> object program unavailable, model matrices go through uniforms \n");
+        return;
+    }
+    objectTransforms.init(objectThreads);
+    objectTransformPass = true;
+}
 
-    if (ShaderObj == 0) {
-        std::cerr << "Error creating shader..." << std::endl;
-        exit(1);
+ClusterLight make_light(vec3 position, float radius, vec3 color, float intensity) {
+    ClusterLight light;
+    memcpy(light.position, position.v, sizeof(light.position));
+    light.radius = radius;
+    memcpy(light.color, color.v, sizeof(light.color));
+    light.intensity = intensity;
+    light.direction[0] = 0.0f;
+    light.direction[1] = -1.0f;
+    light.direction[2] = 0.0f;
+    light.cos_outer = -2.0f; // Point light
+    return light;
+}
+
+ClusterLight make_spot_light(vec3 position, vec3 direction, float coneDegrees, float radius, vec3 color, float intensity) {
+    ClusterLight light = make_light(position, radius, color, intensity);
+    vec3 dir = normalise(direction);
+    memcpy(light.direction, dir.v, sizeof(light.direction));
+    light.cos_outer = cosf(coneDegrees * 0.5f * (float)ONE_DEG_IN_RAD);
+    return light;
+}
+
+// Bioluminescent fish first (they move), then the fixed lamps
+void add_scene_lights() {
+    sceneLights.clear();
+    for (size_t i = 0; i < fishModels.size(); i += fishLightStride) {
+        vec3 glow = (i / fishLightStride) % 2 ? vec3(0.2f, 1.0f, 0.8f) : vec3(0.4f, 0.6f, 1.0f);
+        sceneLights.push_back(make_light(fishModels[i].position, 6.0f, glow, 8.0f));
     }
-    const char* pShaderSource = readShaderSource(pShaderText);
+    fishLightCount = sceneLights.size();
 
-    glShaderSource(ShaderObj, 1, (const GLchar**)&pShaderSource, NULL);
-    glCompileShader(ShaderObj);
-    GLint success;
-    glGetShaderiv(ShaderObj, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLchar InfoLog[1024] = { '\0' };
-        glGetShaderInfoLog(ShaderObj, 1024, NULL, InfoLog);
-        std::cerr << "Error compiling shader: " << InfoLog << std::endl;
-        exit(1);
+    // Lamps on the wreck and the submarine
+    sceneLights.push_back(make_spot_light(vec3(-8.0f, -7.0f, -9.0f), vec3(0.4f, -1.0f, -0.3f), 50.0f, 25.0f, vec3(1.0f, 0.9f, 0.7f), 60.0f));
+    sceneLights.push_back(make_spot_light(vec3(-6.0f, -7.0f, -9.0f), vec3(-0.4f, -1.0f, -0.3f), 50.0f, 25.0f, vec3(1.0f, 0.9f, 0.7f), 60.0f));
+    sceneLights.push_back(make_spot_light(vec3(10.0f, -20.0f, 18.0f), vec3(0.0f, -0.5f, -1.0f), 40.0f, 40.0f, vec3(0.9f, 0.95f, 1.0f), 120.0f));
+
+    // Glowing coral beds
+    for (int i = 0; i < 5; i++) {
+        sceneLights.push_back(make_light(vec3(i + 10.0f, -9.0f, -(10.0f + i)), 4.0f, vec3(0.8f, 0.5f, 1.0f), 4.0f));
+    }
+    for (int i = 0; i < 3; i++) {
+        sceneLights.push_back(make_light(vec3(i + 8.0f, -9.0f, -(15.0f + i)), 4.0f, vec3(1.0f, 0.3f, 0.3f), 4.0f));
     }
-    glAttachShader(ShaderProgram, ShaderObj);
+    printf("=> clustered lighting: %d lights, %dx%dx%d clusters \n", (int)sceneLights.size(),
+        ClusteredLighting::TILES_X, ClusteredLighting::TILES_Y, ClusteredLighting::SLICES);
 }
 
-void CompileShaders(string name, string vertex_file, string fragment_file) {
-    GLuint shaderProgramID = glCreateProgram();
-    if (shaderProgramID == 0) {
-        std::cerr << "Error creating shader program..." << std::endl;
-        exit(1);
+// Moves the fish lights along, bins everything into clusters and binds the result
+void update_scene_lights(const mat4& view, const mat4& proj) {
+    PROFILE_FUNCTION();
+    for (size_t i = 0; i < fishLightCount; i++) {
+        vec3 position = fish_render_position(fishModels[i * fishLightStride]);
+        memcpy(sceneLights[i].position, position.v, sizeof(sceneLights[i].position));
     }
+    clusteredLighting.build(sceneLights, view, proj, renderWidth, renderHeight, nearPlane, farPlane);
+    clusteredLighting.bind(clusterTextureUnit);
+    clusterBuildUs += clusteredLighting.build_us;
+    clusterVisibleLights += clusteredLighting.visible_lights;
+    clusterReferences += clusteredLighting.light_references;
+    clusterMaxLights = std::max(clusterMaxLights, clusteredLighting.max_cluster_lights);
+}
 
-    AddShader(shaderProgramID, vertex_file.c_str(), GL_VERTEX_SHADER);
-    AddShader(shaderProgramID, fragment_file.c_str(), GL_FRAGMENT_SHADER);
+void pick_static_model(int x, int y) {
+    mat4 proj_view = camera_projection() * camera_view();
+    Ray ray = ray_from_screen(proj_view, x, y, width, height);
+    uint32_t hit;
+    float distance;
+    if (staticBVH.query_ray(ray, farPlane, hit, distance)) {
+        const StaticBatch& batch = staticBatches[hit];
+        printf("Picked static batch %d (%d models, first %s) at distance %.2f (%d BVH nodes visited)\n",
+            (int)hit, (int)batch.sources.size(), models[batch.sources[0]].name.c_str(), distance, staticBVH.last_nodes_visited());
+    }
+    else {
+        printf("Picked nothing (%d BVH nodes visited)\n", staticBVH.last_nodes_visited());
+    }
+}
 
-    GLint Success = 0;
-    GLchar ErrorLog[1024] = { '\0' };
-    glLinkProgram(shaderProgramID);
-    glGetProgramiv(shaderProgramID, GL_LINK_STATUS, &Success);
-    if (Success == 0) {
-        glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
-        std::cerr << "Error linking shader program: " << ErrorLog << std::endl;
-        exit(1);
+// Orders the visible static batches and uploads their indirect records, shared by the pre-pass and the shading pass
+void prepare_static_world() {
+    staticOrder.clear();
+    for (uint32_t index : visibleStatic) {
+        staticOrder.push_back(std::make_pair(staticBatches[index].layer >= 0, index));
     }
+    std::sort(staticOrder.begin(), staticOrder.end());
+    staticPassObjects += (int)staticOrder.size();
+    if (staticOrder.empty() || !indirectStaticPass) {
+        return;
+    }
+    // base_instance carries the batch index to the shader
+    indirectCommands.clear();
+    for (const auto& entry : staticOrder) {
+        const MeshAllocation& mesh = staticBatches[entry.second].mesh;
+        DrawElementsIndirectCommand cmd;
+        cmd.count = mesh.index_count;
+        cmd.instance_count = 1;
+        cmd.first_index = mesh.first_index;
+        cmd.base_vertex = (GLint)mesh.base_vertex;
+        cmd.base_instance = entry.second;
+        indirectCommands.push_back(cmd);
+    }
+    // Orphan and refill, the driver hands out fresh storage while last frame is in flight
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCommands.size() * sizeof(DrawElementsIndirectCommand), &indirectCommands[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
 
-    glValidateProgram(shaderProgramID);
-    glGetProgramiv(shaderProgramID, GL_VALIDATE_STATUS, &Success);
-    if (!Success) {
-        glGetProgramInfoLog(shaderProgramID, sizeof(ErrorLog), NULL, ErrorLog);
-        std::cerr << "Invalid shader program: " << ErrorLog << std::endl;
-        exit(1);
+// Depth of the visible static batches from the packed positions, a single multi-draw when available
+void draw_static_depth() {
+    if (staticOrder.empty()) {
+        return;
+    }
+    glBindVertexArray(staticArena.get_position_vao());
+    if (indirectStaticPass) {
+        glUseProgram(resolve_variant(&staticDepthVariant, 0).program);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, (GLsizei)staticOrder.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+    // Same program and matrices as the fallback shading path below
+    const ProgramVariant& variant = resolve_variant(&modelDepthVariant, 0);
+    mat4 identity = identity_mat4();
+    glUseProgram(variant.program);
+    glUniformMatrix4fv(variant.model, 1, GL_FALSE, identity.m);
+    for (const auto& entry : staticOrder) {
+        const StaticBatch& batch = staticBatches[entry.second];
+        glDrawElementsBaseVertex(GL_TRIANGLES, batch.mesh.index_count, GL_UNSIGNED_INT,
+            (const void*)(batch.mesh.first_index * sizeof(GLuint)), (GLint)batch.mesh.base_vertex);
+    }
+}
+
+// Visible static batches, one glMultiDrawElementsIndirect per feature set when available
+void draw_static_world() {
+    PROFILE_FUNCTION();
+    GpuScope scope(gpuProfiler, "static world");
+    const std::vector<std::pair<bool, uint32_t>>& order = staticOrder;
+    if (order.empty()) {
+        return;
     }
-    glUseProgram(shaderProgramID);
 
-    shaders[name] = shaderProgramID;
-    return;
+    if (indirectStaticPass) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, staticBatchBuffer);
+    }
+    glBindVertexArray(staticArena.get_vao());
+
+    size_t start = 0;
+    while (start < order.size()) {
+        size_t end = start;
+        while (end < order.size() && order[end].first == order[start].first) {
+            end++;
+        }
+        // Untextured batches sort first, so this switches program at most once; the layer
+        // of a textured batch comes from its batchColors entry, not from a bind
+        uint32_t features = draw_features(order[start].first);
+        if (indirectStaticPass) {
+            glUseProgram(resolve_variant(staticVariants, features).program);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                (const void*)(start * sizeof(DrawElementsIndirectCommand)), (GLsizei)(end - start), 0);
+            staticPassCalls++;
+        }
+        else {
+            const ProgramVariant& variant = resolve_variant(modelVariants, features);
+            mat4 identity = identity_mat4();
+            glUseProgram(variant.program);
+            glUniformMatrix4fv(variant.model, 1, GL_FALSE, identity.m);
+            for (size_t i = start; i < end; i++) {
+                const StaticBatch& batch = staticBatches[order[i].second];
+                glUniform3fv(variant.diffuseColor, 1, batch.color.v);
+                glUniform1i(variant.textureLayer, batch.layer);
+                glDrawElementsBaseVertex(GL_TRIANGLES, batch.mesh.index_count, GL_UNSIGNED_INT,
+                    (const void*)(batch.mesh.first_index * sizeof(GLuint)), (GLint)batch.mesh.base_vertex);
+                staticPassCalls++;
+            }
+        }
+        start = end;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
-#pragma endregion SHADER_FUNCTIONS
 
+// Eye-space depth of the model origin, used for front-to-back ordering
+float view_depth(const mat4& view, const mat4& modelMatrix) {
+    return -(view.m[2] * modelMatrix.m[12] + view.m[6] * modelMatrix.m[13] + view.m[10] * modelMatrix.m[14] + view.m[14]);
+}
 
+void queue_draw(GLuint vao, int layer, GLenum mode, GLsizei count, const mat4& modelMatrix, const vec3& color, const mat4& view) {
+    DrawCommand cmd;
+    cmd.vao = vao;
+    cmd.layer = layer;
+    cmd.mode = mode;
+    cmd.count = count;
+    cmd.model = modelMatrix;
+    cmd.color = color;
+    // Sorting on the variant's program groups draws by feature set first; every textured
+    // draw samples the same array, so the texture field stays 0 and layers mix freely
+    const ProgramVariant* variants = objectTransformPass ? objectVariants : modelVariants;
+    uint64_t key = make_sort_key(variants[draw_features(layer >= 0)].program, 0, vao, view_depth(view, modelMatrix), farPlane);
+    renderQueue.push(key, (uint32_t)drawCommands.size());
+    drawCommands.push_back(cmd);
+}
 
-void display() {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    // Set background color to a deep blue
-    glClearColor(0.0f, 0.0f, 0.3f, 1.0f); // Adjust values to get the desired color
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void queue_model(const Model& model, const mat4& view) {
+    //  hasColor ֵѡɫ򴫵Ĭϰɫ
+    vec3 color = model.data.hasColor ? model.data.diffuseColor : vec3(1.0f, 1.0f, 1.0f);
+    GLenum mode = model_quads(model) ? GL_QUADS : GL_TRIANGLES;
+    queue_draw(model.vao, model.hasTexture ? model.textureLayer : -1, mode, (GLsizei)model.data.mPointCount,
+        model_matrix(model), color, view);
+}
 
-    // Enable fog
-    glEnable(GL_FOG);
-    glFogf(GL_FOG_MODE, GL_LINEAR);
-    glFogf(GL_FOG_START, 5.0f);    // Start of fog effect (closer for dense water effect)
-    glFogf(GL_FOG_END, 50.0f);     // End of fog effect
-    float fogColor[4] = { 0.0f, 0.2f, 0.3f, 1.0f }; // Blue-greenish color for fog
-    glFogfv(GL_FOG_COLOR, fogColor);
+void fish_matrices(const FishModel& fishModel, mat4& bodyModel, mat4& finModel) {
+    // Set up body transformation
+    bodyModel = identity_mat4();
+    bodyModel = translate(bodyModel, fish_render_position(fishModel));
+    bodyModel = rotate_y_deg(bodyModel, fishModel.rotationY);
 
-    glUseProgram(shaders["model"]);
+    // Set up fin transformation (hierarchical: start with bodys transform)
+    finModel = bodyModel;
+    finModel = rotate_z_deg(finModel, lerp(fishModel.previousFinAngle, fishModel.finAngle, fish_render_alpha()));  // Apply oscillation to fin
+}
 
-    int view_mat_location = glGetUniformLocation(shaders["model"], "view");
-    int proj_mat_location = glGetUniformLocation(shaders["model"], "proj");
+// World bounds of body and fin together
+AABB fish_bounds(const FishModel& fishModel) {
+    mat4 bodyModel, finModel;
+    fish_matrices(fishModel, bodyModel, finModel);
+    AABB bounds = aabb_empty();
+    if (!aabb_is_empty(fishModel.bodyBounds)) {
+        aabb_merge(bounds, aabb_transform(fishModel.bodyBounds, bodyModel));
+    }
+    if (!aabb_is_empty(fishModel.finBounds)) {
+        aabb_merge(bounds, aabb_transform(fishModel.finBounds, finModel));
+    }
+    return bounds;
+}
 
-    mat4 persp_proj = perspective(45.0f, (float)width / (float)height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(proj_mat_location, 1, GL_FALSE, persp_proj.m);
+void queue_fish(const FishModel& fishModel, const mat4& view, float detailDistance) {
+    mat4 bodyModel, finModel;
+    fish_matrices(fishModel, bodyModel, finModel);
+    queue_draw(fishModel.body.vao, -1, GL_TRIANGLES, (GLsizei)fishModel.body.data.mPointCount, bodyModel, fishModel.color, view);
+    if (view_depth(view, bodyModel) > detailDistance) {
+        lodSkippedDraws++;
+        return;
+    }
+    queue_draw(fishModel.fin.vao, -1, GL_TRIANGLES, (GLsizei)fishModel.fin.data.mPointCount, finModel, fishModel.color, view);
+}
 
-    mat4 view = identity_mat4();
-    view = translate(view, vec3(0.0f, 0.0f, -cameraDistance)); // Apply zoom (camera distance)
-    view = translate(view, -cameraPosition);                   // Apply camera position for WASD
-    view = rotate_x_deg(view, cameraRotationX);                // Vertical rotation
-    view = rotate_y_deg(view, cameraRotationY);                // Horizontal rotation
+// Bounding radius over eye depth, roughly the fraction of the view an object covers
+float screen_size(const AABB& bounds, const mat4& view) {
+    float center[3], radius = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        center[i] = (bounds.min[i] + bounds.max[i]) * 0.5f;
+        radius += (bounds.max[i] - center[i]) * (bounds.max[i] - center[i]);
+    }
+    radius = sqrtf(radius);
+    float depth = -(view.m[2] * center[0] + view.m[6] * center[1] + view.m[10] * center[2] + view.m[14]);
+    return depth > radius ? radius / depth : 1.0f;
+}
+
+// Frustum first, then the Hi-Z pyramid; draws counts what a hidden object would have cost
+bool object_visible(const Frustum& frustum, const AABB& bounds, int draws) {
+    if (!frustum_intersects_aabb(frustum, bounds)) {
+        return false;
+    }
+    if (occlusionCulling && !occlusionCuller.is_visible(bounds)) {
+        occlusionDrawsSaved += draws;
+        return false;
+    }
+    return true;
+}
 
-    glUniformMatrix4fv(view_mat_location, 1, GL_FALSE, view.m);
+// Static casters only when the cached map is stale, the moving models and every fish each frame
+void render_shadows() {
+    PROFILE_FUNCTION();
+    GLuint program = shaders["shadow"];
+    if (!shadowsEnabled || program == 0) {
+        return;
+    }
+    GpuScope scope(gpuProfiler, "shadows");
+    glUseProgram(program);
+    GLint lightMatrix = glGetUniformLocation(program, "lightMatrix");
+    GLint modelLocation = glGetUniformLocation(program, "model");
+
+    if (shadowMaps.begin_static(lightPosition, staticWorldBounds)) {
+        // Batches are baked in world space
+        mat4 identity = identity_mat4();
+        glUniformMatrix4fv(lightMatrix, 1, GL_FALSE, shadowMaps.get_static_matrix().m);
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, identity.m);
+        glBindVertexArray(staticArena.get_position_vao());
+        for (const StaticBatch& batch : staticBatches) {
+            glDrawElementsBaseVertex(GL_TRIANGLES, batch.mesh.index_count, GL_UNSIGNED_INT,
+                (const void*)(batch.mesh.first_index * sizeof(GLuint)), (GLint)batch.mesh.base_vertex);
+        }
+    }
 
+    AABB dynamicBounds = aabb_empty();
     for (const auto& model : models) {
-        glBindVertexArray(model.vao);
+        if (!model.isStatic) {
+            aabb_merge(dynamicBounds, aabb_transform(model.localBounds, model_matrix(model)));
+        }
+    }
+    for (const auto& fish : fishModels) {
+        aabb_merge(dynamicBounds, fish_bounds(fish));
+    }
+    if (shadowMaps.begin_dynamic(lightPosition, dynamicBounds)) {
+        glUniformMatrix4fv(lightMatrix, 1, GL_FALSE, shadowMaps.get_dynamic_matrix().m);
+        for (const auto& model : models) {
+            if (model.isStatic) {
+                continue;
+            }
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, model_matrix(model).m);
+            glBindVertexArray(model.vao);
+            glDrawArrays(model_quads(model) ? GL_QUADS : GL_TRIANGLES, 0, (GLsizei)model.data.mPointCount);
+            shadowCasters++;
+        }
+        for (const auto& fish : fishModels) {
+            mat4 bodyModel, finModel;
+            fish_matrices(fish, bodyModel, finModel);
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, bodyModel.m);
+            glBindVertexArray(fish.body.vao);
+            glDrawArrays(GL_TRIANGLES, 0, (GLsizei)fish.body.data.mPointCount);
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, finModel.m);
+            glBindVertexArray(fish.fin.vao);
+            glDrawArrays(GL_TRIANGLES, 0, (GLsizei)fish.fin.data.mPointCount);
+            shadowCasters++;
+        }
+    }
+    glBindVertexArray(0);
+    shadowMaps.end();
+}
 
-        if (model.hasTexture) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, model.textureID);
-            glUniform1i(glGetUniformLocation(shaders["model"], "objectTexture"), 0);
+// Per-object data of the whole queue in one storage buffer, entry i for drawCommands[i]
+void update_object_transforms(const mat4& view, const mat4& proj) {
+    PROFILE_FUNCTION();
+    objectInputs.resize(drawCommands.size());
+    for (size_t i = 0; i < drawCommands.size(); i++) {
+        objectInputs[i].model = drawCommands[i].model;
+        objectInputs[i].color = drawCommands[i].color;
+        objectInputs[i].layer = drawCommands[i].layer;
+    }
+    objectTransforms.update(objectInputs, view, proj);
+}
+
+// Emits the sorted queue, the state cache drops binds and uploads that would not change anything
+void submit_draws() {
+    PROFILE_FUNCTION();
+    GpuScope scope(gpuProfiler, "models + fish");
+    if (objectTransformPass) {
+        // The base instance picks the object's entry, nothing is uploaded between draws
+        for (const DrawItem& item : renderQueue.get_items()) {
+            const DrawCommand& cmd = drawCommands[item.index];
+            stateCache.use_program(resolve_variant(objectVariants, draw_features(cmd.layer >= 0)).program);
+            stateCache.bind_vertex_array(cmd.vao);
+            glDrawArraysInstancedBaseInstance(cmd.mode, 0, cmd.count, 1, item.index);
+            stateCache.count_draw();
         }
+        return;
+    }
+    for (const DrawItem& item : renderQueue.get_items()) {
+        const DrawCommand& cmd = drawCommands[item.index];
+        const ProgramVariant& variant = resolve_variant(modelVariants, draw_features(cmd.layer >= 0));
+        stateCache.use_program(variant.program);
+        stateCache.bind_vertex_array(cmd.vao);
+        stateCache.uniform_matrix_4fv(variant.model, cmd.model.m);
+        stateCache.uniform_3fv(variant.diffuseColor, cmd.color.v);
+        if (cmd.layer >= 0) {
+            stateCache.uniform_1i(variant.textureLayer, cmd.layer);
+        }
+        glDrawArrays(cmd.mode, 0, cmd.count);
+        stateCache.count_draw();
+    }
+}
+
+// Depth of the sorted queue; a model's positions sit in a buffer of their own, so this reads nothing else
+void draw_queue_depth() {
+    if (objectTransformPass) {
+        glUseProgram(resolve_variant(&objectDepthVariant, 0).program);
+        for (const DrawItem& item : renderQueue.get_items()) {
+            const DrawCommand& cmd = drawCommands[item.index];
+            glBindVertexArray(cmd.vao);
+            glDrawArraysInstancedBaseInstance(cmd.mode, 0, cmd.count, 1, item.index);
+        }
+        return;
+    }
+    const ProgramVariant& variant = resolve_variant(&modelDepthVariant, 0);
+    glUseProgram(variant.program);
+    for (const DrawItem& item : renderQueue.get_items()) {
+        const DrawCommand& cmd = drawCommands[item.index];
+        glBindVertexArray(cmd.vao);
+        glUniformMatrix4fv(variant.model, 1, GL_FALSE, cmd.model.m);
+        glDrawArrays(cmd.mode, 0, cmd.count);
+    }
+}
 
-        // useTextureuniform
-        glUniform1i(glGetUniformLocation(shaders["model"], "useTexture"), model.hasTexture);
+// Static world, then the queue. Behind the pre-pass both shade with GL_EQUAL, so each pixel
+// is shaded once however many surfaces overlap it
+void draw_opaque(const mat4& view, const mat4& proj) {
+    PROFILE_FUNCTION();
+    materialTextures.bind(0);
+    if (objectTransformPass) {
+        update_object_transforms(view, proj);
+    }
+    prepare_static_world();
+    // Without its programs the pre-pass would leave nothing for GL_EQUAL to match
+    bool available = resolve_variant(indirectStaticPass ? &staticDepthVariant : &modelDepthVariant, 0).program != 0 &&
+        resolve_variant(objectTransformPass ? &objectDepthVariant : &modelDepthVariant, 0).program != 0;
+    bool prepass = depthPrepass.begin_frame(renderWidth * renderHeight, available);
+    // Opaque surfaces come out with alpha 1, blending them would only cost bandwidth
+    glDisable(GL_BLEND);
+    if (prepass) {
+        GpuScope scope(gpuProfiler, "depth pre-pass");
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        depthPrepass.begin_query(QUERY_DRAWN);
+        draw_static_depth();
+        draw_queue_depth();
+        depthPrepass.end_query();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    depthPrepass.begin_query(prepass ? QUERY_SHADED : QUERY_DRAWN);
+    draw_static_world();
+    stateCache.reset();
+    submit_draws();
+    depthPrepass.end_query();
+    depthPrepass.end_frame();
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_BLEND);
+}
 
-        mat4 modelMatrix = identity_mat4();
-        if ("assets/shark3.dae" == model.name) {
-            // ı任
-            modelMatrix = rotate_y_deg(modelMatrix, model.rotationY + sharkRotationY);
+// The defaults of lighting.glsl and simpleFragmentShader plus the current fog, for the software rasterizer.
+// It has no shadow maps, the main light reaches everything
+SoftShading software_shading(const mat4& view) {
+    mat4 eye = view;
+    vec4 light = eye * vec4(lightPosition, 1.0f); // Eye space, as ShadowParams hands it to the GL programs
+    SoftShading shading = {
+        { light.v[0], light.v[1], light.v[2] }, // LightPosition
+        { 0.0f, 0.5f, 0.7f },    // Kd
+        { 0.8f, 0.9f, 1.0f },    // Ld
+        { 0.09f, 0.10f, 0.10f }, // ambientLight
+        { fog.color.v[0], fog.color.v[1], fog.color.v[2] },
+        fog.start, fog.end, fog_density(),
+        fog.mode == FOG_EXP ? 1 : fog.mode == FOG_EXP2 ? 2 : 0
+    };
+    return shading;
+}
+
+void software_draw(const ModelData& data, bool quads, const mat4& modelMatrix, const vec3& color) {
+    if (data.mVertices.empty()) {
+        return;
+    }
+    const vec3* normals = data.mNormals.size() == data.mVertices.size() ? &data.mNormals[0] : NULL;
+    softwareRasterizer.draw(&data.mVertices[0], normals, data.mVertices.size(), quads, modelMatrix, color);
+}
+
+// Textured models come out in their diffuse color (white), the rasterizer does no texturing
+void software_model(const Model& model, const mat4& modelMatrix) {
+    vec3 color = model.data.hasColor ? model.data.diffuseColor : vec3(1.0f, 1.0f, 1.0f);
+    software_draw(model.data, model_quads(model), modelMatrix, color);
+}
+
+// Same parts and fin LOD as queue_fish
+void software_fish(const FishModel& fishModel, const mat4& view, float detailDistance) {
+    mat4 bodyModel, finModel;
+    fish_matrices(fishModel, bodyModel, finModel);
+    if (fishModel.body.mesh) {
+        software_draw(*fishModel.body.mesh, false, bodyModel, fishModel.color);
+    }
+    if (view_depth(view, bodyModel) > detailDistance) {
+        lodSkippedDraws++;
+        return;
+    }
+    if (fishModel.fin.mesh) {
+        software_draw(*fishModel.fin.mesh, false, finModel, fishModel.color);
+    }
+}
+
+// The static world from the models and props themselves, the baked batches only live on the GPU
+void software_static_world(const Frustum& frustum) {
+    PROFILE_FUNCTION();
+    for (uint32_t i = 0; i < models.size() + staticProps.size(); i++) {
+        const StaticProp* prop = i < models.size() ? NULL : &staticProps[i - models.size()];
+        const Model& model = prop ? models[prop->model] : models[i];
+        if (!model.isStatic) {
+            continue;
         }
-        else if (model.name == "assets/aincrad.dae") {
-            modelMatrix = rotate_y_deg(modelMatrix, aincradRotationX); // ӦYת
-        } else {
-            modelMatrix = rotate_y_deg(modelMatrix, model.rotationY);
+        mat4 modelMatrix = prop ? prop_matrix(*prop) : model_matrix(model);
+        if (frustum_intersects_aabb(frustum, aabb_transform(model.localBounds, modelMatrix))) {
+            software_model(model, modelMatrix);
         }
-        
-        modelMatrix = translate(modelMatrix, model.position);
+    }
+}
+
+// Rasterizes everything recorded this frame and blits it into framebuffer, which is renderWidth x renderHeight
+void present_software_frame(GLuint framebuffer) {
+    {
+        PROFILE_SCOPE("software raster");
+        softwareRasterizer.end_frame();
+    }
+    GpuScope scope(gpuProfiler, "software upload");
+    if (!softwareTarget.resize(renderWidth, renderHeight)) {
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, softwareTarget.get_color_texture());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderWidth, renderHeight, GL_RGBA, GL_UNSIGNED_BYTE, softwareRasterizer.get_color());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    softwareTarget.blit_to_window(framebuffer, renderWidth, renderHeight);
+}
 
-        int matrix_location = glGetUniformLocation(shaders["model"], "model");
+void report_render_stats() {
+    static int frames = 0;
+    frames++;
+    if (frames < 300) {
+        return;
+    }
+    const RenderStats& stats = stateCache.stats;
+    printf("Render queue: %.1f draws, %.1f state changes per frame (%.1f without the state cache)\n",
+        stats.draws / (float)frames, stats.issued / (float)frames, stats.requested / (float)frames);
+    printf("Static pass: %.1f batches in %.1f draw calls per frame\n",
+        staticPassObjects / (float)frames, staticPassCalls / (float)frames);
+    if (particleStreamCount > 0) {
+        printf("Particles: %.0f per frame, %.1f us CPU per frame, %.1f us per 10k particles\n",
+            particleStreamCount / (double)frames, particleStreamUs / frames,
+            particleStreamUs * 10000.0 / particleStreamCount);
+    }
+    if (occlusionCulling) {
+        printf("Occlusion: %.1f draws saved of %.1f tested per frame, %.1f us depth pre-pass + %.1f us tests\n",
+            occlusionDrawsSaved / (float)frames, occlusionTested / (float)frames,
+            occlusionRasterUs / frames, occlusionTestUs / frames);
+    }
+    printf("LOD: %.1f draws skipped per frame\n", lodSkippedDraws / (float)frames);
+    if (softwareRendering) {
+        softwareRasterizer.report();
+    }
+    frameCapture.report();
+    frameGovernor.report();
+    frameScheduler.report();
+    gpuProfiler.report();
+    if (shadowsEnabled) {
+        printf("Shadows: static map redrawn %d times, dynamic map %d times with %.1f casters per frame\n",
+            shadowMaps.static_renders, shadowMaps.dynamic_renders, shadowCasters / (float)frames);
+    }
+    shadowMaps.static_renders = shadowMaps.dynamic_renders = 0;
+    if (!softwareRendering) {
+        depthPrepass.report();
+        objectTransforms.report();
+    }
+    shadowCasters = 0;
+    printf("Lights: %.1f of %d visible, %.2f per cluster on average, at most %d, %.1f us binning per frame\n",
+        clusterVisibleLights / (float)frames, (int)sceneLights.size(),
+        clusterReferences / (float)frames / ClusteredLighting::CLUSTER_COUNT, clusterMaxLights, clusterBuildUs / frames);
+    particleStreamUs = 0.0;
+    particleStreamCount = 0;
+    lodSkippedDraws = 0;
+    clusterBuildUs = 0.0;
+    clusterVisibleLights = 0;
+    clusterReferences = 0;
+    clusterMaxLights = 0;
+    occlusionTested = 0;
+    occlusionDrawsSaved = 0;
+    occlusionRasterUs = 0.0;
+    occlusionTestUs = 0.0;
+    stateCache.stats = RenderStats();
+    staticPassObjects = 0;
+    staticPassCalls = 0;
+    frames = 0;
+}
 
-  
+// CPU markers and GPU passes on one timeline, opens in chrome://tracing or Perfetto
+void write_trace(const char* path) {
+    std::string gpuEvents = "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}}";
+    gpuProfiler.append_trace_events(gpuEvents, 2, 1);
+    if (CpuProfiler::write_trace(path, gpuEvents)) {
+        printf("=> trace with %d CPU events written to %s \n", (int)CpuProfiler::event_count(), path);
+    }
+}
 
-        glUniformMatrix4fv(matrix_location, 1, GL_FALSE, modelMatrix.m);
+void display() {
+    PROFILE_FUNCTION();
+    frameGovernor.begin_frame();
+    gpuProfiler.begin_frame();
+    gpuProfiler.push("frame");
+    const GovernorLevels& levels = frameGovernor.get_levels();
+
+    // Below full resolution the scene goes to the offscreen target and is stretched onto the window at the end
+    renderWidth = std::max(1, (int)(width * levels.resolution_scale + 0.5f));
+    renderHeight = std::max(1, (int)(height * levels.resolution_scale + 0.5f));
+    bool scaled = (renderWidth != width || renderHeight != height) && sceneTarget.resize(renderWidth, renderHeight);
+    if (scaled) {
+        sceneTarget.bind();
+    }
+    else {
+        renderWidth = width;
+        renderHeight = height;
+        glBindFramebuffer(GL_FRAMEBUFFER, windowFramebuffer);
+        glViewport(0, 0, width, height);
+    }
 
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    // Set background color to a deep blue
+    // Background matches the fog so geometry culled past the fog end cannot pop
+    glClearColor(fog.color.v[0], fog.color.v[1], fog.color.v[2], 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Check if model has a color and no texture
-        int color_location = glGetUniformLocation(shaders["model"], "diffuseColor");
-        //printf("has color : %d \n", model.data.hasColor);
-        //print(model.data.diffuseColor);
+    mat4 persp_proj = camera_projection();
+    mat4 view = camera_view();
 
-        //  color_location ǷЧ
-        if (color_location != -1) {
-            //  hasColor ֵѡɫ
-            if (model.data.hasColor) {
-                glUniform3fv(color_location, 1, &model.data.diffuseColor.v[0]);
+    update_frame_uniforms(view, persp_proj);
+    update_scene_lights(view, persp_proj);
+    if (!softwareRendering) {
+        render_shadows();
+    }
+    shadowMaps.bind(view, lightPosition, shadowTextureUnit, shadowsEnabled);
+
+    // Static models come out of the BVH, the few moving ones are tested directly
+    mat4 proj_view = persp_proj * view;
+    Frustum frustum = frustum_from_matrix(proj_view);
+    visibleStatic.clear();
+    staticBVH.query_frustum(frustum, visibleStatic);
+
+    // Occluders go into the Hi-Z buffer first, everything else is tested against it
+    if (occlusionCulling) {
+        PROFILE_SCOPE("occlusion");
+        occlusionCuller.begin_frame(proj_view);
+        size_t kept = 0;
+        for (uint32_t index : visibleStatic) {
+            const StaticBatch& batch = staticBatches[index];
+            if (batch.occluder || occlusionCuller.is_visible(batch.bounds)) {
+                visibleStatic[kept++] = index;
             }
             else {
-                // һĬɫɫ
-                vec3 defaultColor(1.0f, 1.0f, 1.0f); // ɫ
-                glUniform3fv(color_location, 1, &defaultColor.v[0]);
+                occlusionDrawsSaved++;
             }
         }
-        else {
-            std::cerr << "Warning: diffuseColor uniform not found!" << std::endl;
-        }
+        visibleStatic.resize(kept);
+    }
+
+    if (softwareRendering) {
+        softwareRasterizer.begin_frame(renderWidth, renderHeight, view, persp_proj, software_shading(view), sceneLights);
+        software_static_world(frustum);
+    }
 
+    drawCommands.clear();
+    renderQueue.clear();
 
-        //std::cout << "name: " + model.name << std::endl;
-        if ("terrain1.obj" == model.name || "assets/qst.obj" == model.name) {
-            glDrawArrays(GL_QUADS, 0, model.data.mPointCount);
+    float minSize = smallObjectSize * levels.lod_bias;
+    float detailDistance = fishDetailDistance / (1.0f + levels.lod_bias);
+    for (const auto& model : models) {
+        if (model.isStatic) {
+            continue;
+        }
+        AABB bounds = aabb_transform(model.localBounds, model_matrix(model));
+        if (!object_visible(frustum, bounds, 1)) {
+            continue;
+        }
+        if (screen_size(bounds, view) < minSize) {
+            lodSkippedDraws++;
+            continue;
+        }
+        if (softwareRendering) {
+            software_model(model, model_matrix(model));
         }
         else {
-            glDrawArrays(GL_TRIANGLES, 0, model.data.mPointCount);
+            queue_model(model, view);
         }
     }
 
-    //glDrawArrays(GL_QUADS, 0, terrain.data.mPointCount);
-
-    mat4 bodyModel = identity_mat4();
-    bodyModel = translate(bodyModel, fishModels[0].position);
-    bodyModel = rotate_y_deg(bodyModel, fishModels[0].rotationY);
+    for (const auto& model : fishModels) {
+        AABB bounds = fish_bounds(model);
+        if (!object_visible(frustum, bounds, 2)) {
+            continue;
+        }
+        if (screen_size(bounds, view) < minSize) {
+            lodSkippedDraws += 2;
+            continue;
+        }
+        if (softwareRendering) {
+            software_fish(model, view, detailDistance);
+        }
+        else {
+            queue_fish(model, view, detailDistance);
+        }
+    }
 
-    int model_location = glGetUniformLocation(shaders["model"], "model");
-    glUniformMatrix4fv(model_location, 1, GL_FALSE, bodyModel.m);
+    if (occlusionCulling) {
+        occlusionTested += occlusionCuller.tested;
+        occlusionRasterUs += occlusionCuller.raster_us;
+        occlusionTestUs += occlusionCuller.test_us;
+    }
 
-    for (const auto& model : fishModels) {
-        render_fish(model);
+    if (softwareRendering) {
+        present_software_frame(scaled ? sceneTarget.get_framebuffer() : windowFramebuffer);
+    }
+    else {
+        // Group draws by program and VAO, then front to back
+        renderQueue.sort();
+        draw_opaque(view, persp_proj);
     }
 
 
 
     glUseProgram(shaders["simple"]);
 
-    mat4 persp_proj2 = perspective(45.0f, (float)width / (float)height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(shaders["simple"], "proj"), 1, GL_FALSE, persp_proj2.m);
+    glUniformMatrix4fv(glGetUniformLocation(shaders["simple"], "proj"), 1, GL_FALSE, persp_proj.m);
 
     mat4 view2 = identity_mat4();
     view = translate(view, vec3(0.0f, 0.0f, -5.0f)); // ʵλ
     glUniformMatrix4fv(glGetUniformLocation(shaders["simple"], "view"), 1, GL_FALSE, view2.m);
+    // Point sizes are in pixels of the target, keep them the same size on the window
+    glUniform1f(glGetUniformLocation(shaders["simple"], "pointScale"), renderWidth / (float)width);
 
     const auto& particles = particleSystem.getParticles();
+    gpuProfiler.push("particles");
+
+    if (gpuParticles) {
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        gpuParticleSystem.draw((size_t)(gpuParticleSystem.get_count() * levels.particle_fraction));
+    }
+    else if (!particles.empty()) {
+        // : stream every live particle once, then a single draw
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        size_t count = std::max((size_t)1, (size_t)(particles.size() * levels.particle_fraction));
+        ParticleVertex* vertices = particleRenderer.begin(count);
+        // A failed map skips the particles for this frame
+        if (vertices) {
+            for (size_t i = 0; i < count; i++) {
+                const Particle& particle = particles[i];
+                vertices[i].position[0] = particle.position.v[0];
+                vertices[i].position[1] = particle.position.v[1];
+                vertices[i].position[2] = particle.position.v[2];
+                vertices[i].size = particle.size;
+                vertices[i].alpha = particle.alpha;
+            }
+            particleRenderer.draw(count);
+            particleStreamUs += particleRenderer.last_cpu_us();
+            particleStreamCount += count;
+        }
+    }
+    gpuProfiler.pop();
 
-    if (particles.empty()) {
-        std::cout << "No particles to draw!" << std::endl;
+    if (scaled) {
+        gpuProfiler.push("upscale");
+        sceneTarget.blit_to_window(windowFramebuffer, width, height);
+        gpuProfiler.pop();
+    }
+    if (frameCapture.is_active()) {
+        PROFILE_SCOPE("capture");
+        GpuScope scope(gpuProfiler, "capture");
+        frameCapture.capture(windowFramebuffer, width, height);
+    }
+    gpuProfiler.pop();
+    gpuProfiler.end_frame();
+    frameGovernor.end_frame();
+
+    report_render_stats();
+    if (!headless) {
+        PROFILE_SCOPE("swap");
+        glutSwapBuffers();
     }
-    // 
-    for (const auto& particle : particles) {
-        // ӵλ
-        glUniform3f(glGetUniformLocation(shaders["simple"], "position"),
-            particle.position.v[0],
-            particle.position.v[1],
-            particle.position.v[2]);
 
-        // ӣʹõ㣩
-        glBegin(GL_POINTS);
-        glVertex3f(particle.position.v[0], particle.position.v[1], particle.position.v[2]);
-        glEnd();
+    static int renderedFrames = 0;
+    if (++renderedFrames == traceAfterFrames) {
+        write_trace("trace.json");
     }
 
-    glutSwapBuffers();
+    if (!firstFrameReported) {
+        // Startup cost is what the shader work overlaps with, so report both together
+        firstFrameReported = true;
+        long long startupMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - processStart).count();
+        printf("=> first frame after %lld ms (%s shader compile) \n", startupMs,
+            shaderCache.is_parallel() ? "parallel" : "serial");
+        shaderCache.report();
+    }
 }
 
 GLfloat rotate_y = 0.0f;
 
 
-void updateScene() {
-    static DWORD last_time = 0;
+// Everything that moves keeps where it was one step ago, rendering interpolates from there.
+// Fish keep theirs in updateScene, when they actually move
+void store_previous_state() {
+    previousAincradRotationX = aincradRotationX;
+    for (auto& model : models) {
+        model.previousPosition = model.position;
+    }
+}
+
+// One fixed simulation step of delta seconds
+void updateScene(float delta) {
+    PROFILE_FUNCTION();
     static float maxFinAngle = 1;
     static float finOscillationSpeed = 0.15f;
-    DWORD curr_time = timeGetTime();
-    if (last_time == 0)
-        last_time = curr_time;
-    float delta = (curr_time - last_time) * 0.001f;
-    last_time = curr_time;
+    simulationTimeMs += delta * 1000.0;
 
     // aincradתǶ
     aincradRotationX += 10.0f * delta; // ÿת10ȣԸҪٶȣ
 
 
-    // Update each fish model
-    for (auto& fish : fishModels) {
-        // Update fish position based on its direction (horizontal movement only)
-        fish.position.v[0] += fish.direction.v[0] * traceSpeed * delta; // x
-        fish.position.v[1] = fish.direction.v[1]; // Keep y position constant for horizontal movement
-        fish.position.v[2] += fish.direction.v[2] * traceSpeed * delta; // z
+    // Update each fish model; the governor may thin this out to every n-th update,
+    // the skipped time is then caught up in one step
+    static float fishDelta = 0.0f;
+    fishDelta += delta;
+    if (++fishPendingSteps >= frameGovernor.get_levels().fish_interval) {
+        for (auto& fish : fishModels) {
+            fish.previousPosition = fish.position;
+            fish.previousFinAngle = fish.finAngle;
 
-        // Check if the fish has reached a certain distance to reverse direction
-        if (fish.position.v[0] >= traceRadius || fish.position.v[0] <= -traceRadius) {
-            fish.direction.v[0] = -fish.direction.v[0]; // Reverse direction
-        }
-        if (fish.position.v[2] >= traceRadius || fish.position.v[2] <= -traceRadius) {
-            fish.direction.v[2] = -fish.direction.v[2]; // Reverse direction
-        }
+            // Update fish position based on its direction (horizontal movement only)
+            fish.position.v[0] += fish.direction.v[0] * traceSpeed * fishDelta; // x
+            fish.position.v[1] = fish.direction.v[1]; // Keep y position constant for horizontal movement
+            fish.position.v[2] += fish.direction.v[2] * traceSpeed * fishDelta; // z
 
-        // Update fin angle for animation
-        fish.finAngle = maxFinAngle * sinf(curr_time * finOscillationSpeed);
+            // Check if the fish has reached a certain distance to reverse direction
+            if (fish.position.v[0] >= traceRadius || fish.position.v[0] <= -traceRadius) {
+                fish.direction.v[0] = -fish.direction.v[0]; // Reverse direction
+            }
+            if (fish.position.v[2] >= traceRadius || fish.position.v[2] <= -traceRadius) {
+                fish.direction.v[2] = -fish.direction.v[2]; // Reverse direction
+            }
+
+            // Update fin angle for animation
+            fish.finAngle = maxFinAngle * sinf((float)simulationTimeMs * finOscillationSpeed);
+        }
+        fishUpdateSpan = fishPendingSteps;
+        fishPendingSteps = 0;
+        fishDelta = 0.0f;
     }
 
     // Y
@@ -879,10 +2001,15 @@ void updateScene() {
     }
 
     // ϵͳ
-    particleSystem.update(0.016f);
+    if (gpuParticles) {
+        gpuParticleSystem.update(delta);
+    }
+    else {
+        particleSystem.update(delta);
+    }
     // ûӣµ
-    if (particleSystem.getParticles().empty()) {
-        for (int i = 0; i < 100; ++i) {
+    if (!gpuParticles && particleSystem.getParticles().empty()) {
+        for (int i = 0; i < particleCount; ++i) {
             particleSystem.addParticle(
                 vec3(rand() % 10 - 5, rand() % 10 - 5, -10), // λ
                 vec3(0.0f, 0.0f, 0.1f), // ƶ
@@ -891,24 +2018,59 @@ void updateScene() {
         }
     }
 
-    glutPostRedisplay(); // Request a redraw to update the display
 }
 
-void timer(int value) {
-    float deltaTime = 0.016f; // ʾʵӦʱ
-    updateScene(); // ³
-    display(); // Ƴ
-    glutTimerFunc(16, timer, 0); // ÿ16һ
+// One pass of the main loop: wait for the frame slot, catch the world up in fixed steps, draw once
+void idle() {
+    PROFILE_FUNCTION();
+    {
+        PROFILE_SCOPE("frame limiter");
+        frameScheduler.limit();
+    }
+    int steps = frameScheduler.begin_frame();
+    for (int i = 0; i < steps; i++) {
+        store_previous_state();
+        updateScene((float)frameScheduler.get_step());
+    }
+    renderAlpha = frameScheduler.alpha();
+    glutPostRedisplay();
 }
 
 
 
 void init() {
-    CompileShaders("model", "simpleVertexShader.txt", "simpleFragmentShader.txt");
-    CompileShaders("simple", "1.glsl", "2.glsl");
+    PROFILE_FUNCTION();
+    // Every program is issued before any asset loads; the driver builds them meanwhile
+    shaderCache.init("shader_cache", parallelShaderCompile);
+    request_variants("model", "simpleVertexShader.txt", "simpleFragmentShader.txt", modelVariants);
+    request_depth_variant("model_depth", "simpleVertexShader.txt", modelDepthVariant);
+    if (GLEW_ARB_multi_draw_indirect && GLEW_ARB_shader_draw_parameters && GLEW_ARB_shader_storage_buffer_object) {
+        request_variants("static", "staticVertexShader.txt", "simpleFragmentShader.txt", staticVariants);
+        request_depth_variant("static_depth", "staticVertexShader.txt", staticDepthVariant);
+    }
+    if (GLEW_ARB_shader_draw_parameters && GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_base_instance) {
+        request_variants("object", "objectVertexShader.txt", "simpleFragmentShader.txt", objectVariants);
+        request_depth_variant("object_depth", "objectVertexShader.txt", objectDepthVariant);
+    }
+    // The particles have no other program; without the shadow program the maps are never drawn
+    if (!CompileShaders("simple", "1.glsl", "2.glsl")) {
+        std::cerr << "Error creating shader program simple" << std::endl;
+        exit(1);
+    }
+    if (!CompileShaders("shadow", "shadowVertexShader.txt", "depthFragmentShader.txt")) {
+        shadowsEnabled = false;
+    }
+
+    clusteredLighting.init();
+    shadowMaps.init(staticShadowSize, dynamicShadowSize);
+    depthPrepass.init(prepassEnableOverdraw, prepassDisableOverdraw);
+    depthPrepass.set_mode(prepassMode);
+    softwareRasterizer.init(softwareThreads);
+    apply_fog();
 
-    loc1 = glGetAttribLocation(shaders["model"], "vertex_position");
-    loc2 = glGetAttribLocation(shaders["model"], "vertex_normal");
+    particleRenderer.init(1024);
+    frameGovernor.init(governorSettings);
+    gpuProfiler.init();
 
     // ظ߶ͼģ
     //terrain = load_heightmap_model("heightmap.png", vec3(0.0f, -2.0f, -10.0f), 0.0f, 1.0f);
@@ -927,6 +2089,7 @@ void init() {
             0.0f,
             nullptr, 1)
     );
+    models.back().isStatic = false; // Spins in place, so it cannot be baked
 
     models.push_back(
         load_model(
@@ -986,6 +2149,7 @@ void init() {
             45.0f,
             nullptr, 1)
     );
+    models.back().isStatic = false;
 
 
     models.push_back(
@@ -995,6 +2159,7 @@ void init() {
             15.0f,
             nullptr, 1)
     );
+    models.back().isStatic = false;
 
     models.push_back(
         load_model(
@@ -1003,6 +2168,7 @@ void init() {
             45.0f,
             nullptr, 1)
     );
+    models.back().isStatic = false;
 
     models.push_back(
         load_model(
@@ -1011,6 +2177,7 @@ void init() {
             45.0f,
             nullptr, 1)
     );
+    models.back().isStatic = false;
     models.push_back(
         load_model(
             "assets/jiangyou.dae",
@@ -1019,6 +2186,17 @@ void init() {
             nullptr, 1)
     );
 
+    build_static_world();
+    enable_object_transforms();
+    finish_shaders();
+    if (shaders["simple"] == 0) {
+        exit(1);
+    }
+    if (shaders["shadow"] == 0) {
+        printf("=> shadow program unavailable, shadows are off \n");
+        shadowsEnabled = false;
+    }
+
 
 
 
@@ -1033,9 +2211,13 @@ void init() {
         fish = load_fish_model("assets/xxx.dae", vec3(randomFloat(-30, 15), randomFloat(-10,5), randomFloat(-10, -3)), rand() * 10 % 45, "assets/fish.png");
         fish.direction = vec3(randomFloat(1, 10), randomFloat(-4, 4), 0.0f); // Set initial swimming direction
         fishModels.push_back(fish);
+        shaderCache.poll();
     }
+    materialTextures.build(textureArraySize);
 
-    for (int i = 0; i < 100; ++i) {
+    add_scene_lights();
+
+    for (int i = 0; i < particleCount; ++i) {
         particleSystem.addParticle(
             vec3(rand() % 10 - 5, rand() % 10 - 5, -10), // λ
             vec3(0.0f, 0.0f, 0.1f), // ƶ
@@ -1046,6 +2228,7 @@ void init() {
 
 
 void keypress(unsigned char key, int x, int y) {
+    PROFILE_FUNCTION();
     float movementSpeed = 0.5f; // Speed of camera movement
     float rotationSpeed = 5.0f;  // Speed of camera rotation
 
@@ -1084,18 +2267,80 @@ void keypress(unsigned char key, int x, int y) {
         cameraPosition.v[1] -= movementSpeed;
         std::cout << "Moving Down: " << cameraPosition.v[1] << std::endl;
         break;
+    case 'g': // Switch between CPU and GPU particle simulation
+        if (!gpuParticleSystem.is_ready()) {
+            // Same box, speed and lifetime the CPU system spawns with
+            ParticleEmitter emitter = { { -5.0f, -5.0f, -10.0f }, { 4.0f, 4.0f, -10.0f }, { 0.0f, 0.0f, 0.1f }, 5.0f };
+            gpuParticleSystem.init(gpuParticleCount, emitter, "particleUpdate.glsl");
+        }
+        gpuParticles = !gpuParticles && gpuParticleSystem.is_ready();
+        std::cout << "Particle simulation: " << (gpuParticles ? "GPU" : "CPU") << std::endl;
+        break;
+    case 'm': // Cycle fog mode
+        fog.mode = (fog.mode + 1) % FOG_MODE_COUNT;
+        apply_fog();
+        std::cout << "Fog mode: " << (fog.mode == FOG_LINEAR ? "linear" : fog.mode == FOG_EXP ? "exp" : "exp2") << std::endl;
+        break;
+    case '[': // Thinner visibility, pulls the far plane in
+    case ']':
+        fog.end = std::max(fog.start + 5.0f, fog.end + (key == ']' ? 10.0f : -10.0f));
+        apply_fog();
+        std::cout << "Fog end / far plane: " << fog.end << std::endl;
+        break;
+    case 'v': // Toggle the frame-time governor, off pins everything at full quality
+        frameGovernor.set_enabled(!frameGovernor.is_enabled());
+        std::cout << "Frame governor: " << (frameGovernor.is_enabled() ? "on" : "off") << std::endl;
+        break;
+    case 'l': // Print every governor decision so far
+        frameGovernor.print_log();
+        break;
+    case 't': // CPU and GPU timeline of the last frames
+        write_trace("trace.json");
+        break;
+    case 'p': // Start or stop recording frames
+        if (frameCapture.is_active()) {
+            frameCapture.destroy();
+        }
+        else {
+            frameCapture.init(captureDirectory, captureFormat, captureThreads);
+        }
+        break;
+    case 'c': // Switch between the GL programs and the CPU rasterizer
+        softwareRendering = !softwareRendering;
+        std::cout << "Rasterizer: " << (softwareRendering ? "software" : "GL") << std::endl;
+        break;
+    case 'h': // Toggle the shadows of the main light
+        shadowsEnabled = !shadowsEnabled && shaders["shadow"] != 0;
+        std::cout << "Shadows: " << (shadowsEnabled ? "on" : "off") << std::endl;
+        break;
+    case 'z': // Cycle the depth pre-pass between auto, on and off
+    {
+        static const char* const names[] = { "auto", "on", "off" };
+        prepassMode = (PrepassMode)((prepassMode + 1) % 3);
+        depthPrepass.set_mode(prepassMode);
+        std::cout << "Depth pre-pass: " << names[prepassMode] << std::endl;
+        break;
+    }
+    case 'o': // Toggle Hi-Z occlusion culling
+        occlusionCulling = !occlusionCulling;
+        std::cout << "Occlusion culling: " << (occlusionCulling ? "on" : "off") << std::endl;
+        break;
     }
     glutPostRedisplay(); // Request a redraw to update the display with changes
 }
 
 
 void mouseButton(int button, int state, int x, int y) {
+    PROFILE_FUNCTION();
     std::cout << button << std::endl;
     if (button == GLUT_LEFT_BUTTON) {
         leftMousePressed = (state == GLUT_DOWN);
         lastMouseX = x;
         lastMouseY = y;
     }
+    else if (button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN) {
+        pick_static_model(x, y);
+    }
     else if (button == 3) { // Scroll up
         cameraDistance -= 1.0f;
         if (cameraDistance < 2.0f) cameraDistance = 2.0f; // Prevent too close zoom
@@ -1107,6 +2352,7 @@ void mouseButton(int button, int state, int x, int y) {
 }
 
 void mouseMotion(int x, int y) {
+    PROFILE_FUNCTION();
     if (leftMousePressed) {
         float dx = x - lastMouseX;
         float dy = y - lastMouseY;
@@ -1121,28 +2367,368 @@ void mouseMotion(int x, int y) {
 }
 
 
+// The context is still current here, so the frames in flight can be mapped and written
+void close_window() {
+    frameCapture.destroy();
+    objectTransforms.destroy();
+    shadowMaps.destroy();
+    depthPrepass.destroy();
+}
+
+// Exactly one simulation step per frame at full quality, so two runs with one seed draw the same frames
+int run_headless_benchmark() {
+    frameGovernor.set_enabled(false);
+    frameBenchmark.init(benchmarkFrames);
+    while (!frameBenchmark.done()) {
+        frameBenchmark.begin_frame();
+        store_previous_state();
+        updateScene((float)simulationStep);
+        renderAlpha = 1.0f;
+        display();
+        glFlush(); // What the swap would do for a window
+        frameBenchmark.end_frame();
+    }
+
+    char info[1024];
+    snprintf(info, sizeof(info),
+        "\"backend\": \"%s\", \"renderer\": \"%s\", \"version\": \"%s\", \"width\": %d, \"height\": %d, \"seed\": %u, "
+        "\"rasterizer\": \"%s\", \"raster_threads\": %d, \"prepass\": \"%s\"",
+        headlessContext.get_backend(), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION),
+        width, height, randomSeed, softwareRendering ? "software" : "gl", softwareRasterizer.get_thread_count(),
+        prepassMode == PREPASS_ON ? "on" : prepassMode == PREPASS_OFF ? "off" : "auto");
+    bool ok = frameBenchmark.write_json(benchmarkJson, info);
+    if (ok) {
+        printf("=> %d frames benchmarked, written to %s \n", benchmarkFrames, benchmarkJson);
+    }
+    frameBenchmark.destroy();
+    frameCapture.destroy();
+    objectTransforms.destroy();
+    shadowMaps.destroy();
+    depthPrepass.destroy();
+    headlessTarget.destroy();
+    headlessContext.destroy();
+    return ok ? 0 : 1;
+}
+
+// Grows the school with fish copied from the loaded ones (they share VAOs) or trims it
+void set_fish_count(size_t count) {
+    size_t loaded = fishModels.size();
+    if (count <= loaded) {
+        fishModels.resize(count);
+        return;
+    }
+    fishModels.reserve(count);
+    for (size_t i = loaded; i < count; i++) {
+        FishModel fish = fishModels[i % loaded];
+        fish.position = vec3(randomFloat(-30, 15), randomFloat(-10, 5), randomFloat(-10, -3));
+        fish.direction = vec3(randomFloat(1, 10), randomFloat(-4, 4), 0.0f);
+        fish.previousPosition = fish.position;
+        fishModels.push_back(fish);
+    }
+}
+
+// Scatters count copies of the loaded static models over the sea floor and rebakes the static world
+void set_static_prop_count(size_t count) {
+    std::vector<uint32_t> templates;
+    for (uint32_t i = 0; i < models.size(); i++) {
+        if (models[i].isStatic && models[i].data.mPointCount > 0) {
+            templates.push_back(i);
+        }
+    }
+    staticProps.clear();
+    for (size_t i = 0; i < count && !templates.empty(); i++) {
+        StaticProp prop;
+        prop.model = templates[i % templates.size()];
+        prop.position = vec3(randomFloat(-40, 40), randomFloat(-14, -8), randomFloat(-40, 20));
+        prop.rotationY = randomFloat(0, 360);
+        staticProps.push_back(prop);
+    }
+    build_static_world();
+}
+
+// One CSV row: simulation (updateScene), submission (display, culling and GL calls included),
+// the whole frame and GPU time, each as mean and p95 over sweepFrames
+void run_sweep_point(std::ofstream& csv, const char* axis, size_t fish, size_t particles, size_t props) {
+    srand(randomSeed);
+    set_fish_count(fish);
+    if (props != staticProps.size()) {
+        set_static_prop_count(props);
+    }
+    particleCount = (int)particles;
+    particleSystem.clear(); // The next update spawns a full burst
+
+    std::vector<double> simMs, submitMs;
+    for (int i = 0; i < sweepWarmupFrames; i++) {
+        store_previous_state();
+        updateScene((float)simulationStep);
+        display();
+    }
+    frameBenchmark.init(sweepFrames);
+    while (!frameBenchmark.done()) {
+        frameBenchmark.begin_frame();
+        auto start = std::chrono::steady_clock::now();
+        store_previous_state();
+        updateScene((float)simulationStep);
+        auto simulated = std::chrono::steady_clock::now();
+        renderAlpha = 1.0f;
+        display();
+        glFlush();
+        auto submitted = std::chrono::steady_clock::now();
+        frameBenchmark.end_frame();
+        simMs.push_back(std::chrono::duration<double, std::milli>(simulated - start).count());
+        submitMs.push_back(std::chrono::duration<double, std::milli>(submitted - simulated).count());
+    }
+    frameBenchmark.finish();
+    BenchmarkStats sim = benchmark_stats(simMs);
+    BenchmarkStats submit = benchmark_stats(submitMs);
+    BenchmarkStats frame = benchmark_stats(frameBenchmark.get_cpu_ms());
+    BenchmarkStats gpu = benchmark_stats(frameBenchmark.get_gpu_ms());
+    frameBenchmark.destroy();
+
+    char row[512];
+    snprintf(row, sizeof(row), "%s,%zu,%zu,%zu,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+        axis, fish, particles, props, sweepFrames, sim.mean, sim.p95, submit.mean, submit.p95,
+        frame.mean, frame.p95, gpu.mean, gpu.p95);
+    csv << row;
+    csv.flush();
+    printf("=> sweep %s: %zu fish, %zu particles, %zu props: sim %.3f ms, submit %.3f ms, frame %.3f ms, gpu %.3f ms \n",
+        axis, fish, particles, props, sim.mean, submit.mean, frame.mean, gpu.mean);
+}
+
+// Each axis grows by decades from the shipped scene (100 fish, 100 particles, no extra props)
+int run_scalability_sweep() {
+    std::ofstream csv(sweepCsv, std::ios::binary);
+    if (!csv) {
+        fprintf(stderr, "ERROR: could not write %s\n", sweepCsv);
+        return 1;
+    }
+    csv << "axis,fish,particles,props,frames,sim_mean_ms,sim_p95_ms,submit_mean_ms,submit_p95_ms,"
+        "frame_mean_ms,frame_p95_ms,gpu_mean_ms,gpu_p95_ms\n";
+    frameGovernor.set_enabled(false);
+    gpuParticles = false;
+    const size_t baseFish = 100, baseParticles = 100;
+    for (size_t fish = baseFish; fish <= 1000000; fish *= 10) {
+        run_sweep_point(csv, "fish", fish, baseParticles, 0);
+    }
+    for (size_t particles = baseParticles; particles <= 10000000; particles *= 10) {
+        run_sweep_point(csv, "particles", baseFish, particles, 0);
+    }
+    for (size_t props = 100; props <= 10000; props *= 10) {
+        run_sweep_point(csv, "props", baseFish, baseParticles, props);
+    }
+    printf("=> scalability sweep written to %s \n", sweepCsv);
+    objectTransforms.destroy();
+    shadowMaps.destroy();
+    depthPrepass.destroy();
+    headlessTarget.destroy();
+    headlessContext.destroy();
+    return 0;
+}
+
+// Renders this process's share of the sequence; every earlier frame is simulated but not drawn,
+// so all processes see the same world at the same frame
+int run_sequence() {
+    SequenceSlice slice = { sequenceFirst, sequenceLast, std::max(sequenceWorker, 0), sequenceProcesses, sequencePartition };
+    frameGovernor.set_enabled(false);
+    frameCapture.init(captureDirectory, CAPTURE_PNG, captureThreads);
+    auto start = std::chrono::steady_clock::now();
+    int last = slice.last_owned();
+    int rendered = 0;
+    for (int frame = 0; frame <= last; frame++) {
+        store_previous_state();
+        updateScene((float)simulationStep);
+        if (!slice.owns(frame)) {
+            continue;
+        }
+        CameraKey key = cameraPath.sample(frame);
+        cameraPosition = vec3(key.position[0], key.position[1], key.position[2]);
+        cameraRotationX = key.rotation_x;
+        cameraRotationY = key.rotation_y;
+        cameraDistance = key.distance;
+        renderAlpha = 1.0f;
+        frameCapture.set_next_frame(frame);
+        display();
+        rendered++;
+    }
+    frameCapture.destroy();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("=> sequence worker %d of %d: %d frames rendered, %d only simulated, %.2f s \n",
+        slice.index, slice.count, rendered, last + 1 - rendered, seconds);
+    objectTransforms.destroy();
+    shadowMaps.destroy();
+    depthPrepass.destroy();
+    headlessTarget.destroy();
+    headlessContext.destroy();
+    return 0;
+}
+
+// Starts the worker processes with this process's arguments and waits for them; no GL here
+int run_sequence_processes(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    printf("=> sequence frames %d-%d on %d processes (%s) \n", sequenceFirst, sequenceLast, sequenceProcesses,
+        sequencePartition == PARTITION_INTERLEAVED ? "interleaved" : "contiguous");
+    auto start = std::chrono::steady_clock::now();
+    int failed = run_worker_processes(argv[0], args, sequenceProcesses);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int frames = sequenceLast - sequenceFirst + 1;
+    printf("=> sequence: %d frames in %.2f s, %.2f frames/s, %d workers failed \n",
+        frames, seconds, seconds > 0.0 ? frames / seconds : 0.0, failed);
+    return failed == 0 ? 0 : 1;
+}
+
+#ifdef _WIN32
+// timeBeginPeriod raises the timer resolution for the whole system until it is paired
+void restore_timer_period() {
+    timeEndPeriod(1);
+}
+#endif
+
 int main(int argc, char** argv) {
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-    glutInitWindowSize(width, height);
-    glutCreateWindow("Hello Triangle");
-
-    glutDisplayFunc(display);
-    glutIdleFunc(updateScene);
-    glutKeyboardFunc(keypress);
-    glutMouseFunc(mouseButton);
-    glutMotionFunc(mouseMotion);
-
-    GLenum res = glewInit();
+    PROFILE_THREAD("main");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--serial-shaders") == 0) {
+            parallelShaderCompile = false;
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            targetFps = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--trace-frames") == 0 && i + 1 < argc) {
+            traceAfterFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            benchmarkFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            randomSeed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            benchmarkJson = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sweep") == 0) {
+            headless = sweep = true;
+        }
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            sweepCsv = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sweep-frames") == 0 && i + 1 < argc) {
+            sweepFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--prepass") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            prepassMode = strcmp(mode, "on") == 0 ? PREPASS_ON : strcmp(mode, "off") == 0 ? PREPASS_OFF : PREPASS_AUTO;
+        }
+        else if (strcmp(argv[i], "--software") == 0) {
+            softwareRendering = true;
+        }
+        else if (strcmp(argv[i], "--raster-threads") == 0 && i + 1 < argc) {
+            softwareThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--transform-threads") == 0 && i + 1 < argc) {
+            objectThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            captureOnStart = true;
+            captureDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc) {
+            captureFormat = strcmp(argv[++i], "raw") == 0 ? CAPTURE_RAW : CAPTURE_PNG;
+        }
+        else if (strcmp(argv[i], "--capture-threads") == 0 && i + 1 < argc) {
+            captureThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--sequence") == 0 && i + 1 < argc) {
+            sequencePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--range") == 0 && i + 2 < argc) {
+            sequenceFirst = atoi(argv[++i]);
+            sequenceLast = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--processes") == 0 && i + 1 < argc) {
+            sequenceProcesses = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--partition") == 0 && i + 1 < argc) {
+            sequencePartition = strcmp(argv[++i], "interleaved") == 0 ? PARTITION_INTERLEAVED : PARTITION_CONTIGUOUS;
+        }
+        else if (strcmp(argv[i], "--sequence-worker") == 0 && i + 1 < argc) {
+            sequenceWorker = atoi(argv[++i]);
+        }
+    }
+    srand(randomSeed);
+    e.seed(randomSeed);
+
+    if (sequencePath) {
+        if (!cameraPath.load(sequencePath)) {
+            return 1;
+        }
+        if (sequenceLast < 0) {
+            sequenceLast = cameraPath.last_frame();
+        }
+        if (sequenceProcesses > 1 && sequenceWorker < 0) {
+            return run_sequence_processes(argc, argv);
+        }
+        headless = true;
+    }
+
+    // Headless without a context of its own (Windows) falls back to a hidden window
+    bool windowed = !headless || !headlessContext.create(4, 5);
+    if (windowed) {
+        glutInit(&argc, argv);
+        glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+        glutInitWindowSize(width, height);
+        glutCreateWindow("Hello Triangle");
+        if (headless) {
+            glutHideWindow();
+        }
+
+        glutDisplayFunc(display);
+        glutIdleFunc(idle);
+        glutKeyboardFunc(keypress);
+        glutMouseFunc(mouseButton);
+        glutMotionFunc(mouseMotion);
+        glutCloseFunc(close_window);
+    }
+
+    // Without a window the headless context loads GL itself, glewInit() would look for a GLX display
+    GLenum res = windowed ? glewInit() : headlessContext.init_glew();
     if (res != GLEW_OK) {
         fprintf(stderr, "Error: '%s'\n", glewGetErrorString(res));
         return 1;
     }
+    if (headless) {
+        if (!headlessTarget.resize(width, height)) {
+            return 1;
+        }
+        windowFramebuffer = headlessTarget.get_framebuffer();
+    }
     init();
+    if (captureOnStart) {
+        frameCapture.init(captureDirectory, captureFormat, captureThreads);
+    }
+    if (sequencePath) {
+        return run_sequence();
+    }
+    if (sweep) {
+        return run_scalability_sweep();
+    }
+    if (headless) {
+        return run_headless_benchmark();
+    }
 
-    // עʾͶʱ
-    glutDisplayFunc(display);
-    glutTimerFunc(0, timer, 0); // ʱ
+#ifdef _WIN32
+    // One swap per vblank; the limiter only matters with vsync off or a faster display
+    if (WGLEW_EXT_swap_control) {
+        wglSwapIntervalEXT(1);
+    }
+    timeBeginPeriod(1); // 1 ms sleep granularity for the limiter
+    atexit(restore_timer_period); // glutMainLoop may leave through exit() and never return
+#endif
+    frameScheduler.init(simulationStep, maxStepsPerFrame, targetFps);
 
     glutMainLoop();
     return 0;
@@ -18,7 +18,7 @@ struct vec2 {
 };
 
 struct vec3 {
-	vec3 vec3::operator- () const {
+	vec3 operator- () const {
 		return vec3(-v[0], -v[1], -v[2]);
 	}
 	vec3 ();
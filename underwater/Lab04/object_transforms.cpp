@@ -0,0 +1,175 @@
+#include "object_transforms.h"
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+
+static double now_us () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+// out = a * b, all column-major
+static void multiply (const float* a, const float* b, float* out) {
+	for (int c = 0; c < 4; c++) {
+		for (int row = 0; row < 4; row++) {
+			out[c * 4 + row] = a[row] * b[c * 4] + a[4 + row] * b[c * 4 + 1] +
+				a[8 + row] * b[c * 4 + 2] + a[12 + row] * b[c * 4 + 3];
+		}
+	}
+}
+
+static void cross (const float* a, const float* b, float* out) {
+	out[0] = a[1] * b[2] - a[2] * b[1];
+	out[1] = a[2] * b[0] - a[0] * b[2];
+	out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/*---------------------------- WORKER POOL ----------------------------*/
+
+void ObjectTransforms::init (int threads) {
+	stop_workers ();
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency ();
+	}
+	thread_count = threads > 0 ? threads : 1;
+	quit = false;
+	for (int i = 1; i < thread_count; i++) {
+		workers.push_back (std::thread (&ObjectTransforms::worker_main, this));
+	}
+}
+
+void ObjectTransforms::stop_workers () {
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		quit = true;
+	}
+	wake.notify_all ();
+	for (std::thread& worker : workers) {
+		worker.join ();
+	}
+	workers.clear ();
+	thread_count = 1;
+}
+
+void ObjectTransforms::destroy () {
+	stop_workers ();
+	glDeleteBuffers (1, &buffer);
+	buffer = 0;
+	objects.clear ();
+}
+
+void ObjectTransforms::worker_main () {
+	uint64_t seen = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			wake.wait (lock, [&] { return quit || generation != seen; });
+			if (quit) {
+				return;
+			}
+			seen = generation;
+		}
+		run_jobs ();
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			if (--running == 0) {
+				done.notify_one ();
+			}
+		}
+	}
+}
+
+void ObjectTransforms::run_jobs () {
+	for (;;) {
+		size_t job = next_job.fetch_add (1);
+		if (job >= job_count) {
+			return;
+		}
+		size_t first = job * JOB_OBJECTS;
+		size_t last = first + JOB_OBJECTS < input_count ? first + JOB_OBJECTS : input_count;
+		compute (first, last);
+	}
+}
+
+/*---------------------------- FRAME ----------------------------*/
+
+void ObjectTransforms::compute (size_t first, size_t last) {
+	for (size_t i = first; i < last; i++) {
+		const ObjectInput& input = inputs[i];
+		ObjectData& object = objects[i];
+		multiply (view.m, input.model.m, object.model_view);
+		multiply (proj.m, object.model_view, object.mvp);
+
+		// the cofactors of the 3x3 over its determinant are its inverse transpose
+		const float* mv = object.model_view;
+		float* normal = object.normal;
+		cross (mv + 4, mv + 8, normal);
+		cross (mv + 8, mv, normal + 4);
+		cross (mv, mv + 4, normal + 8);
+		float det = mv[0] * normal[0] + mv[1] * normal[1] + mv[2] * normal[2];
+		// a degenerate matrix keeps the plain cofactors, the shader normalizes anyway
+		float scale = fabsf (det) > 1e-20f ? 1.0f / det : 1.0f;
+		for (int c = 0; c < 3; c++) {
+			normal[c * 4] *= scale;
+			normal[c * 4 + 1] *= scale;
+			normal[c * 4 + 2] *= scale;
+			normal[c * 4 + 3] = 0.0f;
+		}
+
+		object.color[0] = input.color.v[0];
+		object.color[1] = input.color.v[1];
+		object.color[2] = input.color.v[2];
+		object.color[3] = (float)(input.layer >= 0 ? input.layer : 0);
+	}
+}
+
+void ObjectTransforms::update (const std::vector<ObjectInput>& in, const mat4& v, const mat4& p) {
+	double start = now_us ();
+	inputs = in.empty () ? NULL : &in[0];
+	input_count = in.size ();
+	view = v;
+	proj = p;
+	objects.resize (input_count);
+	job_count = (input_count + JOB_OBJECTS - 1) / JOB_OBJECTS;
+	next_job = 0;
+	if (workers.empty () || job_count < (size_t)MIN_PARALLEL_JOBS) {
+		run_jobs ();
+	}
+	else {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			running = (int)workers.size ();
+			generation++;
+		}
+		wake.notify_all ();
+		run_jobs ();
+		std::unique_lock<std::mutex> lock (mutex);
+		done.wait (lock, [&] { return running == 0; });
+	}
+	inputs = NULL;
+	double computed = now_us ();
+
+	if (!buffer) {
+		glGenBuffers (1, &buffer);
+	}
+	// orphan and refill, the driver hands out fresh storage while last frame is in flight
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData (GL_SHADER_STORAGE_BUFFER, objects.size () * sizeof (ObjectData), objects.empty () ? NULL : &objects[0], GL_STREAM_DRAW);
+	glBindBuffer (GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 1, buffer);
+
+	frames++;
+	total_objects += (double)input_count;
+	total_compute_us += computed - start;
+	total_upload_us += now_us () - computed;
+}
+
+void ObjectTransforms::report () {
+	if (frames == 0) {
+		return;
+	}
+	printf ("Objects: %.1f per frame, %.1f us transforms on %d threads + %.1f us upload\n",
+		total_objects / frames, total_compute_us / frames, thread_count, total_upload_us / frames);
+	frames = 0;
+	total_objects = total_compute_us = total_upload_us = 0.0;
+}
@@ -0,0 +1,86 @@
+#ifndef _OBJECT_TRANSFORMS_H_
+#define _OBJECT_TRANSFORMS_H_
+
+#include <GL/glew.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "maths_funcs.h"
+
+// what the renderer knows about one draw
+struct ObjectInput {
+	mat4 model;
+	vec3 color;
+	int layer; // -1 when untextured
+};
+
+// std430 layout of ObjectData in objectVertexShader.txt
+struct ObjectData {
+	float mvp[16];
+	float model_view[16];
+	float normal[12]; // inverse transpose of the model-view 3x3, each column padded to a vec4
+	float color[4]; // diffuse rgb, texture layer in w
+};
+
+/* per-object shader data, computed on the CPU once per object per frame.
+   the model-view, the full MVP and the normal matrix (the inverse
+   transpose, so normals stay perpendicular under non-uniform scale) are
+   worked out here instead of in every vertex, and the draws set no
+   uniforms at all: the objects go into one shader storage buffer at
+   binding 1 and each draw picks its entry through its base instance.
+   objects are split into jobs of JOB_OBJECTS over a pool of worker threads
+   (the calling thread is worker 0), each job writes its own slice of the
+   output so no locking is needed. small frames skip the pool, waking it
+   would cost more than the work. */
+class ObjectTransforms {
+public:
+	static const int JOB_OBJECTS = 64;
+	static const int MIN_PARALLEL_JOBS = 4;
+
+	~ObjectTransforms () { stop_workers (); }
+
+	void init (int threads);
+	void destroy ();
+
+	//! fills one ObjectData per input, in order, uploads them and binds the buffer to binding 1
+	void update (const std::vector<ObjectInput>& inputs, const mat4& view, const mat4& proj);
+
+	//! objects and timings per frame since the last report, then resets them
+	void report ();
+
+private:
+	void stop_workers ();
+	void worker_main ();
+	void run_jobs ();
+	void compute (size_t first, size_t last);
+
+	GLuint buffer = 0;
+	std::vector<ObjectData> objects;
+	const ObjectInput* inputs = NULL;
+	size_t input_count = 0;
+	mat4 view;
+	mat4 proj;
+
+	// worker pool
+	int thread_count = 1;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation = 0;
+	int running = 0;
+	bool quit = false;
+	size_t job_count = 0;
+	std::atomic<size_t> next_job;
+
+	// totals since the last report
+	int frames = 0;
+	double total_objects = 0.0;
+	double total_compute_us = 0.0;
+	double total_upload_us = 0.0;
+};
+
+#endif
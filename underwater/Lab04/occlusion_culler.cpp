@@ -0,0 +1,245 @@
+#include "occlusion_culler.h"
+#include <math.h>
+#include <chrono>
+
+// anything this close to the eye plane is treated as crossing it
+static const float NEAR_W = 1e-3f;
+
+static double now_us () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+// clip = m * (p, 1), m is column-major
+static void transform_point (const mat4& m, const float p[3], float out[4]) {
+	for (int r = 0; r < 4; r++) {
+		out[r] = m.m[r] * p[0] + m.m[4 + r] * p[1] + m.m[8 + r] * p[2] + m.m[12 + r];
+	}
+}
+
+void OcclusionCuller::init (int w, int h) {
+	width = w > 1 ? w : 1;
+	height = h > 1 ? h : 1;
+	levels.clear ();
+	level_width.clear ();
+	level_height.clear ();
+	int lw = width, lh = height;
+	for (;;) {
+		levels.push_back (std::vector<float> ((size_t)lw * lh, 1.0f));
+		level_width.push_back (lw);
+		level_height.push_back (lh);
+		if (lw == 1 && lh == 1) {
+			break;
+		}
+		lw = (lw + 1) / 2;
+		lh = (lh + 1) / 2;
+	}
+}
+
+void OcclusionCuller::add_occluder (const std::vector<vec3>& triangles) {
+	size_t n = triangles.size () - triangles.size () % 3;
+	for (size_t i = 0; i < n; i++) {
+		occluder_vertices.push_back (triangles[i].v[0]);
+		occluder_vertices.push_back (triangles[i].v[1]);
+		occluder_vertices.push_back (triangles[i].v[2]);
+	}
+}
+
+void OcclusionCuller::clear_occluders () {
+	occluder_vertices.clear ();
+	clip.clear ();
+}
+
+/*---------------------------- DEPTH PRE-PASS ----------------------------*/
+
+void OcclusionCuller::begin_frame (const mat4& pv) {
+	double start = now_us ();
+	proj_view = pv;
+	tested = 0;
+	culled = 0;
+	test_us = 0.0;
+
+	std::vector<float>& depth = levels[0];
+	for (size_t i = 0; i < depth.size (); i++) {
+		depth[i] = 1.0f;
+	}
+
+	size_t vertex_count = occluder_vertices.size () / 3;
+	clip.resize (vertex_count * 4);
+	for (size_t i = 0; i < vertex_count; i++) {
+		transform_point (proj_view, &occluder_vertices[i * 3], &clip[i * 4]);
+	}
+
+	for (size_t i = 0; i + 2 < vertex_count; i += 3) {
+		const float* a = &clip[i * 4];
+		const float* b = &clip[(i + 1) * 4];
+		const float* c = &clip[(i + 2) * 4];
+		// dropping a triangle only loses occlusion, never hides something visible
+		if (a[3] < NEAR_W || b[3] < NEAR_W || c[3] < NEAR_W) {
+			continue;
+		}
+		// trivially outside one side of the frustum
+		if ((a[0] > a[3] && b[0] > b[3] && c[0] > c[3]) || (a[0] < -a[3] && b[0] < -b[3] && c[0] < -c[3]) ||
+			(a[1] > a[3] && b[1] > b[3] && c[1] > c[3]) || (a[1] < -a[3] && b[1] < -b[3] && c[1] < -c[3]) ||
+			(a[2] > a[3] && b[2] > b[3] && c[2] > c[3])) {
+			continue;
+		}
+		rasterize_triangle (a, b, c);
+	}
+
+	build_pyramid ();
+	raster_us = now_us () - start;
+}
+
+// half-space rasterizer sampling pixel centres, keeps the nearest depth
+void OcclusionCuller::rasterize_triangle (const float* ca, const float* cb, const float* cc) {
+	float v[3][3];
+	const float* in[3] = { ca, cb, cc };
+	for (int k = 0; k < 3; k++) {
+		float inv_w = 1.0f / in[k][3];
+		v[k][0] = (in[k][0] * inv_w * 0.5f + 0.5f) * width;
+		v[k][1] = (in[k][1] * inv_w * 0.5f + 0.5f) * height;
+		v[k][2] = in[k][2] * inv_w * 0.5f + 0.5f;
+	}
+
+	float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[1][1] - v[0][1]) * (v[2][0] - v[0][0]);
+	if (fabsf (area) < 1e-6f) {
+		return;
+	}
+	// occluders are drawn two-sided, flip clockwise triangles
+	if (area < 0.0f) {
+		for (int k = 0; k < 3; k++) {
+			float t = v[1][k];
+			v[1][k] = v[2][k];
+			v[2][k] = t;
+		}
+		area = -area;
+	}
+
+	float fx0 = fminf (v[0][0], fminf (v[1][0], v[2][0]));
+	float fx1 = fmaxf (v[0][0], fmaxf (v[1][0], v[2][0]));
+	float fy0 = fminf (v[0][1], fminf (v[1][1], v[2][1]));
+	float fy1 = fmaxf (v[0][1], fmaxf (v[1][1], v[2][1]));
+	int x0 = fx0 < 0.0f ? 0 : (int)fx0;
+	int y0 = fy0 < 0.0f ? 0 : (int)fy0;
+	int x1 = fx1 > (float)(width - 1) ? width - 1 : (int)fx1;
+	int y1 = fy1 > (float)(height - 1) ? height - 1 : (int)fy1;
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	// edge i is opposite vertex i, e(p) = A * px + B * py + C
+	float ea[3], eb[3], ec[3];
+	for (int i = 0; i < 3; i++) {
+		const float* p = v[(i + 1) % 3];
+		const float* q = v[(i + 2) % 3];
+		ea[i] = p[1] - q[1];
+		eb[i] = q[0] - p[0];
+		ec[i] = p[0] * q[1] - p[1] * q[0];
+	}
+	float inv_area = 1.0f / area;
+	float* depth = &levels[0][0];
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f;
+		float px = x0 + 0.5f;
+		float e0 = ea[0] * px + eb[0] * py + ec[0];
+		float e1 = ea[1] * px + eb[1] * py + ec[1];
+		float e2 = ea[2] * px + eb[2] * py + ec[2];
+		float* row = depth + (size_t)y * width;
+		for (int x = x0; x <= x1; x++) {
+			if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+				float z = (e0 * v[0][2] + e1 * v[1][2] + e2 * v[2][2]) * inv_area;
+				if (z < row[x]) {
+					row[x] = z;
+				}
+			}
+			e0 += ea[0];
+			e1 += ea[1];
+			e2 += ea[2];
+		}
+	}
+}
+
+// every texel of level i holds the farthest depth of its 2x2 block in level i - 1
+void OcclusionCuller::build_pyramid () {
+	for (size_t l = 1; l < levels.size (); l++) {
+		const std::vector<float>& src = levels[l - 1];
+		std::vector<float>& dst = levels[l];
+		int sw = level_width[l - 1], sh = level_height[l - 1];
+		int dw = level_width[l], dh = level_height[l];
+		for (int y = 0; y < dh; y++) {
+			int sy0 = y * 2;
+			int sy1 = sy0 + 1 < sh ? sy0 + 1 : sy0;
+			for (int x = 0; x < dw; x++) {
+				int sx0 = x * 2;
+				int sx1 = sx0 + 1 < sw ? sx0 + 1 : sx0;
+				float d = fmaxf (fmaxf (src[sy0 * sw + sx0], src[sy0 * sw + sx1]),
+					fmaxf (src[sy1 * sw + sx0], src[sy1 * sw + sx1]));
+				dst[y * dw + x] = d;
+			}
+		}
+	}
+}
+
+/*----------------------------- BOUNDS TEST ------------------------------*/
+
+bool OcclusionCuller::is_visible (const AABB& box) {
+	double start = now_us ();
+	tested++;
+	bool visible = true;
+
+	float sx0 = 1e30f, sy0 = 1e30f, sx1 = -1e30f, sy1 = -1e30f, zmin = 1e30f;
+	bool crosses_near = false;
+	for (int i = 0; i < 8 && !crosses_near; i++) {
+		float p[3] = {
+			(i & 1) ? box.max[0] : box.min[0],
+			(i & 2) ? box.max[1] : box.min[1],
+			(i & 4) ? box.max[2] : box.min[2]
+		};
+		float c[4];
+		transform_point (proj_view, p, c);
+		if (c[3] < NEAR_W) {
+			crosses_near = true;
+			break;
+		}
+		float inv_w = 1.0f / c[3];
+		float x = (c[0] * inv_w * 0.5f + 0.5f) * width;
+		float y = (c[1] * inv_w * 0.5f + 0.5f) * height;
+		float z = c[2] * inv_w * 0.5f + 0.5f;
+		sx0 = fminf (sx0, x);
+		sx1 = fmaxf (sx1, x);
+		sy0 = fminf (sy0, y);
+		sy1 = fmaxf (sy1, y);
+		zmin = fminf (zmin, z);
+	}
+
+	if (!crosses_near && zmin > 0.0f && sx1 >= 0.0f && sy1 >= 0.0f && sx0 < width && sy0 < height) {
+		int x0 = sx0 < 0.0f ? 0 : (int)sx0;
+		int y0 = sy0 < 0.0f ? 0 : (int)sy0;
+		int x1 = sx1 > (float)(width - 1) ? width - 1 : (int)sx1;
+		int y1 = sy1 > (float)(height - 1) ? height - 1 : (int)sy1;
+
+		// smallest level where the rectangle spans at most 2x2 texels
+		int extent = (x1 - x0) > (y1 - y0) ? (x1 - x0) : (y1 - y0);
+		int level = 0;
+		while ((extent >> level) > 0 && level + 1 < (int)levels.size ()) {
+			level++;
+		}
+		const std::vector<float>& hiz = levels[level];
+		int lw = level_width[level];
+		float farthest = 0.0f;
+		for (int y = y0 >> level; y <= (y1 >> level); y++) {
+			for (int x = x0 >> level; x <= (x1 >> level); x++) {
+				farthest = fmaxf (farthest, hiz[y * lw + x]);
+			}
+		}
+		visible = zmin <= farthest;
+	}
+
+	if (!visible) {
+		culled++;
+	}
+	test_us += now_us () - start;
+	return visible;
+}
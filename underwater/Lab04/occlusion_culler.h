@@ -0,0 +1,50 @@
+#ifndef _OCCLUSION_CULLER_H_
+#define _OCCLUSION_CULLER_H_
+
+#include <stddef.h>
+#include <vector>
+#include "maths_funcs.h"
+#include "bvh.h"
+
+/* hierarchical-Z occlusion culling on the CPU.
+   large occluders are rasterized depth-only into a small buffer each frame,
+   a max-depth mip pyramid is built over it, and object bounds are tested
+   against the pyramid level where their screen rectangle covers at most
+   2x2 texels. no GPU readback is involved, so the test never stalls. */
+class OcclusionCuller {
+public:
+	void init (int width, int height);
+	//! world-space triangle list (3 vertices per triangle), kept for every frame
+	void add_occluder (const std::vector<vec3>& triangles);
+	void clear_occluders ();
+
+	//! rasterizes the occluders for this camera and rebuilds the pyramid
+	void begin_frame (const mat4& proj_view);
+	//! false only when the box is certainly hidden behind occluders
+	bool is_visible (const AABB& box);
+
+	size_t occluder_triangles () const { return occluder_vertices.size () / 9; }
+	int get_width () const { return width; }
+	int get_height () const { return height; }
+
+	// per-frame counters, reset by begin_frame
+	int tested = 0;
+	int culled = 0;
+	double raster_us = 0.0;
+	double test_us = 0.0;
+
+private:
+	void rasterize_triangle (const float* a, const float* b, const float* c);
+	void build_pyramid ();
+
+	int width = 0;
+	int height = 0;
+	mat4 proj_view;
+	std::vector<float> occluder_vertices; // xyz per vertex
+	std::vector<float> clip; // xyzw per occluder vertex, reused every frame
+	std::vector<std::vector<float> > levels; // levels[0] is full resolution
+	std::vector<int> level_width;
+	std::vector<int> level_height;
+};
+
+#endif
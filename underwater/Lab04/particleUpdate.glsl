@@ -0,0 +1,50 @@
+#version 330 core
+
+// One particle in, the same particle one step later out (transform feedback)
+layout(location = 0) in vec3 position;
+layout(location = 1) in float size;
+layout(location = 2) in float alpha;
+layout(location = 3) in vec3 velocity;
+layout(location = 4) in float lifetime;
+layout(location = 5) in float seed;
+
+out vec3 outPosition;
+out float outSize;
+out float outAlpha;
+out vec3 outVelocity;
+out float outLifetime;
+out float outSeed;
+
+uniform float deltaTime;
+uniform float time;
+uniform vec3 emitterMin;
+uniform vec3 emitterMax;
+uniform vec3 emitterVelocity;
+uniform float maxLifetime;
+
+// Cheap per-particle random number in [0, 1)
+float hash(float n) {
+    return fract(sin(n) * 43758.5453);
+}
+
+void main() {
+    float life = lifetime - deltaTime;
+    if (life <= 0.0) {
+        // Respawn somewhere new in the emitter box
+        float s = seed * 1000.0 + time;
+        vec3 r = vec3(hash(s), hash(s + 17.0), hash(s + 31.0));
+        outPosition = mix(emitterMin, emitterMax, r);
+        outVelocity = emitterVelocity;
+        outLifetime = maxLifetime;
+        outSize = floor(hash(s + 47.0) * 5.0) + 2.0; // Same 2..6 range as the CPU system
+        outSeed = hash(s + 59.0);
+    }
+    else {
+        outPosition = position + velocity * deltaTime;
+        outVelocity = velocity;
+        outLifetime = life;
+        outSize = size;
+        outSeed = seed;
+    }
+    outAlpha = alpha;
+}
@@ -0,0 +1,120 @@
+#include "particle_renderer.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <chrono>
+
+static double now_us () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+void ParticleRenderer::init (size_t initial_capacity) {
+	persistent = GLEW_ARB_buffer_storage != 0;
+	glGenVertexArrays (1, &vao);
+	create_storage (initial_capacity);
+	printf ("=> particle renderer: %s, %d particles per segment \n",
+		persistent ? "persistently mapped ring" : "orphaned buffer", (int)capacity);
+}
+
+void ParticleRenderer::destroy () {
+	for (int i = 0; i < RING_SEGMENTS; i++) {
+		if (fences[i]) {
+			glDeleteSync (fences[i]);
+			fences[i] = 0;
+		}
+	}
+	if (mapped) {
+		glBindBuffer (GL_ARRAY_BUFFER, vbo);
+		glUnmapBuffer (GL_ARRAY_BUFFER);
+		mapped = NULL;
+	}
+	glDeleteBuffers (1, &vbo);
+	glDeleteVertexArrays (1, &vao);
+	vbo = vao = 0;
+	capacity = 0;
+}
+
+void ParticleRenderer::create_storage (size_t new_capacity) {
+	if (vbo) {
+		// the old buffer may still be read by queued frames, let the driver keep it alive
+		for (int i = 0; i < RING_SEGMENTS; i++) {
+			if (fences[i]) {
+				glDeleteSync (fences[i]);
+				fences[i] = 0;
+			}
+		}
+		if (mapped) {
+			glBindBuffer (GL_ARRAY_BUFFER, vbo);
+			glUnmapBuffer (GL_ARRAY_BUFFER);
+			mapped = NULL;
+		}
+		glDeleteBuffers (1, &vbo);
+	}
+	capacity = new_capacity;
+	segment = 0;
+
+	glBindVertexArray (vao);
+	glGenBuffers (1, &vbo);
+	glBindBuffer (GL_ARRAY_BUFFER, vbo);
+	if (persistent) {
+		GLsizeiptr bytes = (GLsizeiptr)(capacity * RING_SEGMENTS * sizeof (ParticleVertex));
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage (GL_ARRAY_BUFFER, bytes, NULL, flags);
+		mapped = (ParticleVertex*)glMapBufferRange (GL_ARRAY_BUFFER, 0, bytes, flags);
+		if (!mapped) {
+			fprintf (stderr, "ERROR: could not map the particle ring (0x%x)\n", glGetError ());
+		}
+	}
+	else {
+		glBufferData (GL_ARRAY_BUFFER, capacity * sizeof (ParticleVertex), NULL, GL_STREAM_DRAW);
+	}
+	glEnableVertexAttribArray (0);
+	glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (ParticleVertex), (void*)offsetof (ParticleVertex, position));
+	glEnableVertexAttribArray (1);
+	glVertexAttribPointer (1, 1, GL_FLOAT, GL_FALSE, sizeof (ParticleVertex), (void*)offsetof (ParticleVertex, size));
+	glEnableVertexAttribArray (2);
+	glVertexAttribPointer (2, 1, GL_FLOAT, GL_FALSE, sizeof (ParticleVertex), (void*)offsetof (ParticleVertex, alpha));
+	glBindVertexArray (0);
+}
+
+ParticleVertex* ParticleRenderer::begin (size_t count) {
+	begin_time = now_us ();
+	if (count > capacity) {
+		size_t grown = capacity * 2;
+		create_storage (grown > count ? grown : count);
+	}
+	glBindBuffer (GL_ARRAY_BUFFER, vbo);
+	if (persistent) {
+		if (!mapped) {
+			return NULL;
+		}
+		// wait until the GPU is done with the frame that last used this segment
+		if (fences[segment]) {
+			while (glClientWaitSync (fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+			}
+			glDeleteSync (fences[segment]);
+			fences[segment] = 0;
+		}
+		return mapped + segment * capacity;
+	}
+	// orphan: the driver gives us fresh storage while the old one is still in flight
+	glBufferData (GL_ARRAY_BUFFER, capacity * sizeof (ParticleVertex), NULL, GL_STREAM_DRAW);
+	return (ParticleVertex*)glMapBufferRange (GL_ARRAY_BUFFER, 0, count * sizeof (ParticleVertex),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void ParticleRenderer::draw (size_t count) {
+	glBindVertexArray (vao);
+	if (persistent) {
+		glDrawArrays (GL_POINTS, (GLint)(segment * capacity), (GLsizei)count);
+		fences[segment] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		segment = (segment + 1) % RING_SEGMENTS;
+	}
+	else {
+		glBindBuffer (GL_ARRAY_BUFFER, vbo);
+		glUnmapBuffer (GL_ARRAY_BUFFER);
+		glDrawArrays (GL_POINTS, 0, (GLsizei)count);
+	}
+	glBindVertexArray (0);
+	cpu_us = now_us () - begin_time;
+}
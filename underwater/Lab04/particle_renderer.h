@@ -0,0 +1,50 @@
+#ifndef _PARTICLE_RENDERER_H_
+#define _PARTICLE_RENDERER_H_
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+// what the particle program reads per point, attributes 0, 1 and 2
+struct ParticleVertex {
+	float position[3];
+	float size; // gl_PointSize in pixels
+	float alpha;
+};
+
+/* streams every live particle into a ring-buffer VBO once per frame and
+   draws them all with a single glDrawArrays(GL_POINTS).
+   with ARB_buffer_storage the buffer is persistently mapped and split into
+   RING_SEGMENTS parts guarded by fences, otherwise it is orphaned and mapped
+   each frame. */
+class ParticleRenderer {
+public:
+	static const int RING_SEGMENTS = 3;
+
+	void init (size_t capacity);
+	void destroy ();
+
+	//! space for count vertices, fill it and call draw() with the same count;
+	//! NULL if the buffer could not be mapped, the frame then draws no particles
+	ParticleVertex* begin (size_t count);
+	//! issues the draw; the caller has the program and uniforms bound
+	void draw (size_t count);
+
+	bool is_persistent () const { return persistent; }
+	//! CPU time spent in begin() + draw() on the last frame, in microseconds
+	double last_cpu_us () const { return cpu_us; }
+
+private:
+	void create_storage (size_t new_capacity);
+
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	size_t capacity = 0; // vertices per segment
+	bool persistent = false;
+	ParticleVertex* mapped = NULL;
+	int segment = 0;
+	GLsync fences[RING_SEGMENTS] = { 0 };
+	double begin_time = 0.0;
+	double cpu_us = 0.0;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "render_queue.h"
+#include <string.h>
+
+uint64_t make_sort_key (GLuint program, GLuint texture, GLuint vao, float depth, float far_plane) {
+	float d = depth / far_plane;
+	if (d < 0.0f) { d = 0.0f; }
+	if (d > 1.0f) { d = 1.0f; }
+	uint64_t bucket = (uint64_t)(d * 65535.0f);
+	return ((uint64_t)(program & 0xff) << 56) |
+		((uint64_t)(texture & 0xffff) << 40) |
+		((uint64_t)(vao & 0xffff) << 24) |
+		(bucket << 8);
+}
+
+/*------------------------------------RENDER QUEUE------------------------------------*/
+
+void RenderQueue::push (uint64_t key, uint32_t index) {
+	DrawItem item;
+	item.key = key;
+	item.index = index;
+	items.push_back (item);
+}
+
+void RenderQueue::sort () {
+	size_t n = items.size ();
+	if (n < 2) {
+		return;
+	}
+	scratch.resize (n);
+	DrawItem* src = &items[0];
+	DrawItem* dst = &scratch[0];
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t offsets[256] = { 0 };
+		for (size_t i = 0; i < n; i++) {
+			offsets[(src[i].key >> shift) & 0xff]++;
+		}
+		// every key shares this byte, nothing to reorder
+		if (offsets[(src[0].key >> shift) & 0xff] == n) {
+			continue;
+		}
+		size_t sum = 0;
+		for (int b = 0; b < 256; b++) {
+			size_t c = offsets[b];
+			offsets[b] = sum;
+			sum += c;
+		}
+		for (size_t i = 0; i < n; i++) {
+			dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+		DrawItem* tmp = src; src = dst; dst = tmp;
+	}
+	if (src != &items[0]) {
+		memcpy (&items[0], src, n * sizeof (DrawItem));
+	}
+}
+
+/*-------------------------------------STATE CACHE------------------------------------*/
+
+void StateCache::reset () {
+	program = 0;
+	texture = 0;
+	vao = 0;
+	uniforms.clear ();
+}
+
+void StateCache::use_program (GLuint p) {
+	stats.requested++;
+	if (p != program) {
+		glUseProgram (p);
+		program = p;
+		// uniform locations belong to the program, forget the old values
+		uniforms.clear ();
+		stats.issued++;
+	}
+}
+
+void StateCache::bind_texture (GLuint t) {
+	stats.requested++;
+	if (t != texture) {
+		glActiveTexture (GL_TEXTURE0);
+		glBindTexture (GL_TEXTURE_2D, t);
+		texture = t;
+		stats.issued++;
+	}
+}
+
+void StateCache::bind_vertex_array (GLuint v) {
+	stats.requested++;
+	if (v != vao) {
+		glBindVertexArray (v);
+		vao = v;
+		stats.issued++;
+	}
+}
+
+bool StateCache::update_uniform (GLint location, const float* value, int count) {
+	stats.requested++;
+	if (location == -1) {
+		return false;
+	}
+	for (CachedUniform& u : uniforms) {
+		if (u.location == location) {
+			if (memcmp (u.value, value, count * sizeof (float)) == 0) {
+				return false;
+			}
+			memcpy (u.value, value, count * sizeof (float));
+			stats.issued++;
+			return true;
+		}
+	}
+	CachedUniform u;
+	u.location = location;
+	memcpy (u.value, value, count * sizeof (float));
+	uniforms.push_back (u);
+	stats.issued++;
+	return true;
+}
+
+void StateCache::uniform_1i (GLint location, int value) {
+	float v = (float)value;
+	if (update_uniform (location, &v, 1)) {
+		glUniform1i (location, value);
+	}
+}
+
+void StateCache::uniform_3fv (GLint location, const float* value) {
+	if (update_uniform (location, value, 3)) {
+		glUniform3fv (location, 1, value);
+	}
+}
+
+void StateCache::uniform_matrix_4fv (GLint location, const float* value) {
+	if (update_uniform (location, value, 16)) {
+		glUniformMatrix4fv (location, 1, GL_FALSE, value);
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include <stdint.h>
+#include <vector>
+#include <GL/glew.h>
+
+/* 64-bit draw sort key, most significant field first:
+   63..56 program | 55..40 texture | 39..24 vao | 23..8 depth bucket | 7..0 spare
+   sorting by key groups draws by the state that is most expensive to change. */
+uint64_t make_sort_key (GLuint program, GLuint texture, GLuint vao, float depth, float far_plane);
+
+struct DrawItem {
+	uint64_t key;
+	uint32_t index; // into the caller's per-frame command list
+};
+
+// per-frame list of draws, radix sorted by key before submission
+class RenderQueue {
+public:
+	void clear () { items.clear (); }
+	void push (uint64_t key, uint32_t index);
+	//! LSD radix sort, 8 bits per pass, passes with a single bucket are skipped
+	void sort ();
+	const std::vector<DrawItem>& get_items () const { return items; }
+
+private:
+	std::vector<DrawItem> items;
+	std::vector<DrawItem> scratch;
+};
+
+// counts every state change a draw asks for next to the ones actually sent
+struct RenderStats {
+	int draws = 0;
+	int requested = 0;
+	int issued = 0;
+};
+
+// remembers the bound GL state so redundant binds and uploads are skipped
+class StateCache {
+public:
+	//! forget the bound state, call when GL was touched outside the cache
+	void reset ();
+	void use_program (GLuint program);
+	void bind_texture (GLuint texture);
+	void bind_vertex_array (GLuint vao);
+	void uniform_1i (GLint location, int value);
+	void uniform_3fv (GLint location, const float* value);
+	void uniform_matrix_4fv (GLint location, const float* value);
+	void count_draw () { stats.draws++; }
+
+	RenderStats stats;
+
+private:
+	struct CachedUniform {
+		GLint location;
+		float value[16];
+	};
+	//! true when the cached value differs and was updated
+	bool update_uniform (GLint location, const float* value, int count);
+
+	GLuint program = 0;
+	GLuint texture = 0;
+	GLuint vao = 0;
+	std::vector<CachedUniform> uniforms;
+};
+
+#endif
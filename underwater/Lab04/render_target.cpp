@@ -0,0 +1,61 @@
+#include "render_target.h"
+#include <stdio.h>
+
+bool RenderTarget::resize (int w, int h) {
+	w = w > 1 ? w : 1;
+	h = h > 1 ? h : 1;
+	if (framebuffer && w == width && h == height) {
+		return true;
+	}
+	destroy ();
+	width = w;
+	height = h;
+
+	glGenTextures (1, &color);
+	glBindTexture (GL_TEXTURE_2D, color);
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers (1, &depth);
+	glBindRenderbuffer (GL_RENDERBUFFER, depth);
+	glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer (GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers (1, &framebuffer);
+	glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+	GLenum status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+	glBindFramebuffer (GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf (stderr, "ERROR: render target %dx%d incomplete (0x%x)\n", width, height, status);
+		destroy ();
+		return false;
+	}
+	return true;
+}
+
+void RenderTarget::destroy () {
+	glDeleteFramebuffers (1, &framebuffer);
+	glDeleteRenderbuffers (1, &depth);
+	glDeleteTextures (1, &color);
+	framebuffer = depth = color = 0;
+	width = height = 0;
+}
+
+void RenderTarget::bind () {
+	glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+	glViewport (0, 0, width, height);
+}
+
+void RenderTarget::blit_to_window (GLuint window_framebuffer, int window_width, int window_height) {
+	glBindFramebuffer (GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer (GL_DRAW_FRAMEBUFFER, window_framebuffer);
+	glBlitFramebuffer (0, 0, width, height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer (GL_FRAMEBUFFER, window_framebuffer);
+	glViewport (0, 0, window_width, window_height);
+}
@@ -0,0 +1,32 @@
+#ifndef _RENDER_TARGET_H_
+#define _RENDER_TARGET_H_
+
+#include <GL/glew.h>
+
+/* offscreen colour and depth target. the scene is drawn into it at a
+   fraction of the window size and stretched onto the window with a
+   linear glBlitFramebuffer, which is the whole upscale. */
+class RenderTarget {
+public:
+	//! (re)allocates the attachments only when the size changes
+	bool resize (int w, int h);
+	void destroy ();
+	//! binds the framebuffer and sets the viewport to cover it
+	void bind ();
+	//! stretches the colour onto the window's framebuffer (0 unless headless), which is left bound
+	void blit_to_window (GLuint window_framebuffer, int window_width, int window_height);
+
+	int get_width () const { return width; }
+	int get_height () const { return height; }
+	GLuint get_color_texture () const { return color; }
+	GLuint get_framebuffer () const { return framebuffer; }
+
+private:
+	GLuint framebuffer = 0;
+	GLuint color = 0;
+	GLuint depth = 0;
+	int width = 0;
+	int height = 0;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "sequence_renderer.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
+
+/*---------------------------- CAMERA PATH ----------------------------*/
+
+bool CameraPath::load (const char* path) {
+	keys.clear ();
+	FILE* file = fopen (path, "r");
+	if (!file) {
+		fprintf (stderr, "ERROR: could not open camera path %s\n", path);
+		return false;
+	}
+	char line[512];
+	int line_number = 0;
+	while (fgets (line, sizeof (line), file)) {
+		line_number++;
+		const char* start = line + strspn (line, " \t\r\n");
+		if (*start == '\0' || *start == '#') {
+			continue;
+		}
+		CameraKey key;
+		if (sscanf (start, "%f %f %f %f %f %f %f", &key.frame, &key.position[0], &key.position[1], &key.position[2],
+			&key.rotation_x, &key.rotation_y, &key.distance) != 7) {
+			fprintf (stderr, "ERROR: %s:%d is not \"frame x y z rotation_x rotation_y distance\"\n", path, line_number);
+			continue;
+		}
+		if (!keys.empty () && key.frame <= keys.back ().frame) {
+			fprintf (stderr, "ERROR: %s:%d, frame %g is not after the previous key\n", path, line_number, key.frame);
+			continue;
+		}
+		keys.push_back (key);
+	}
+	fclose (file);
+	if (keys.empty ()) {
+		fprintf (stderr, "ERROR: camera path %s has no keys\n", path);
+		return false;
+	}
+	return true;
+}
+
+CameraKey CameraPath::sample (double frame) const {
+	if (keys.empty ()) {
+		CameraKey none = { 0.0f, { 0.0f, 0.0f, 0.0f }, 0.0f, 0.0f, 10.0f };
+		return none;
+	}
+	if (frame <= keys.front ().frame) {
+		return keys.front ();
+	}
+	if (frame >= keys.back ().frame) {
+		return keys.back ();
+	}
+	size_t next = 1;
+	while (keys[next].frame < frame) {
+		next++;
+	}
+	const CameraKey& a = keys[next - 1];
+	const CameraKey& b = keys[next];
+	float t = (float)((frame - a.frame) / (b.frame - a.frame));
+	CameraKey key;
+	key.frame = (float)frame;
+	for (int i = 0; i < 3; i++) {
+		key.position[i] = a.position[i] + (b.position[i] - a.position[i]) * t;
+	}
+	key.rotation_x = a.rotation_x + (b.rotation_x - a.rotation_x) * t;
+	key.rotation_y = a.rotation_y + (b.rotation_y - a.rotation_y) * t;
+	key.distance = a.distance + (b.distance - a.distance) * t;
+	return key;
+}
+
+/*---------------------------- PARTITION ----------------------------*/
+
+bool SequenceSlice::owns (int frame) const {
+	if (frame < first || frame > last) {
+		return false;
+	}
+	if (partition == PARTITION_INTERLEAVED) {
+		return (frame - first) % count == index;
+	}
+	// blocks differ in length by at most one frame
+	long long length = (long long)last - first + 1;
+	long long begin = length * index / count;
+	long long end = length * (index + 1) / count;
+	return frame - first >= begin && frame - first < end;
+}
+
+int SequenceSlice::last_owned () const {
+	long long length = (long long)last - first + 1;
+	if (partition == PARTITION_INTERLEAVED) {
+		if (index >= length) {
+			return -1;
+		}
+		return first + index + (int)((length - 1 - index) / count) * count;
+	}
+	long long begin = length * index / count;
+	long long end = length * (index + 1) / count;
+	return end > begin ? first + (int)end - 1 : -1;
+}
+
+/*---------------------------- PROCESSES ----------------------------*/
+
+#ifdef _WIN32
+// CommandLineToArgvW rules: quotes around anything with spaces, backslashes before a quote doubled
+static void append_argument (std::string& line, const std::string& arg) {
+	if (!line.empty ()) {
+		line += ' ';
+	}
+	if (!arg.empty () && arg.find_first_of (" \t\"") == std::string::npos) {
+		line += arg;
+		return;
+	}
+	line += '"';
+	size_t backslashes = 0;
+	for (char c : arg) {
+		if (c == '\\') {
+			backslashes++;
+			continue;
+		}
+		line.append (c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+		backslashes = 0;
+		line += c;
+	}
+	line.append (backslashes * 2, '\\');
+	line += '"';
+}
+#endif
+
+int run_worker_processes (const char* program, const std::vector<std::string>& args, int count) {
+	int failed = 0;
+#ifdef _WIN32
+	std::vector<PROCESS_INFORMATION> processes;
+	for (int i = 0; i < count; i++) {
+		std::string line;
+		append_argument (line, program);
+		for (const std::string& arg : args) {
+			append_argument (line, arg);
+		}
+		append_argument (line, "--sequence-worker");
+		append_argument (line, std::to_string (i));
+		STARTUPINFOA startup;
+		memset (&startup, 0, sizeof (startup));
+		startup.cb = sizeof (startup);
+		PROCESS_INFORMATION process;
+		std::vector<char> writable (line.begin (), line.end ());
+		writable.push_back ('\0');
+		if (!CreateProcessA (NULL, &writable[0], NULL, NULL, FALSE, 0, NULL, NULL, &startup, &process)) {
+			fprintf (stderr, "ERROR: could not start worker %d (%lu)\n", i, (unsigned long)GetLastError ());
+			failed++;
+			continue;
+		}
+		processes.push_back (process);
+	}
+	for (PROCESS_INFORMATION& process : processes) {
+		WaitForSingleObject (process.hProcess, INFINITE);
+		DWORD code = 1;
+		GetExitCodeProcess (process.hProcess, &code);
+		failed += code != 0;
+		CloseHandle (process.hThread);
+		CloseHandle (process.hProcess);
+	}
+#else
+	std::vector<pid_t> processes;
+	for (int i = 0; i < count; i++) {
+		std::vector<std::string> strings;
+		strings.push_back (program);
+		strings.insert (strings.end (), args.begin (), args.end ());
+		strings.push_back ("--sequence-worker");
+		strings.push_back (std::to_string (i));
+		std::vector<char*> argv;
+		for (std::string& s : strings) {
+			argv.push_back (&s[0]);
+		}
+		argv.push_back (NULL);
+		pid_t pid = 0;
+		int error = posix_spawnp (&pid, program, NULL, NULL, &argv[0], environ);
+		if (error != 0) {
+			fprintf (stderr, "ERROR: could not start worker %d (%s)\n", i, strerror (error));
+			failed++;
+			continue;
+		}
+		processes.push_back (pid);
+	}
+	for (pid_t pid : processes) {
+		int status = 0;
+		if (waitpid (pid, &status, 0) != pid || !WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+			failed++;
+		}
+	}
+#endif
+	return failed;
+}
@@ -0,0 +1,53 @@
+#ifndef _SEQUENCE_RENDERER_H_
+#define _SEQUENCE_RENDERER_H_
+
+#include <string>
+#include <vector>
+
+// camera state at one frame of a path, in the terms of camera_view()
+struct CameraKey {
+	float frame;
+	float position[3];
+	float rotation_x, rotation_y; // degrees
+	float distance;
+};
+
+/* keyframed camera path, one key per line:
+     frame  x y z  rotation_x rotation_y  distance
+   blank lines and lines starting with # are skipped, keys have to be in
+   frame order. frames between keys are interpolated linearly, frames
+   outside the path hold the first or last key. */
+class CameraPath {
+public:
+	bool load (const char* path);
+	CameraKey sample (double frame) const;
+	bool empty () const { return keys.empty (); }
+	int last_frame () const { return keys.empty () ? 0 : (int)keys.back ().frame; }
+
+private:
+	std::vector<CameraKey> keys;
+};
+
+enum SequencePartition {
+	PARTITION_CONTIGUOUS, // worker i renders the i-th block of the range
+	PARTITION_INTERLEAVED // worker i renders every count-th frame from first + i
+};
+
+/* a frame range split over worker processes. every worker simulates from
+   frame 0 with the same seed, so they all see the same world; frames a
+   worker does not own are simulated but never drawn. */
+struct SequenceSlice {
+	int first, last; // the whole range, inclusive
+	int index, count; // this worker of count
+	SequencePartition partition;
+
+	bool owns (int frame) const;
+	//! last frame this worker renders, -1 if none; it can stop simulating after it
+	int last_owned () const;
+};
+
+//! starts count copies of program, copy i with args plus "--sequence-worker i", and waits for
+//! all of them; returns how many failed to start or exited with an error
+int run_worker_processes (const char* program, const std::vector<std::string>& args, int count);
+
+#endif
@@ -0,0 +1,400 @@
+#include "shader_cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#define get_proc_address(name) (void*)wglGetProcAddress (name)
+#else
+#include <sys/stat.h>
+// the loader GLEW itself uses here; with glvnd it also serves EGL contexts, so headless runs need no GLX header
+extern "C" void (*glXGetProcAddressARB (const GLubyte* name)) ();
+#define get_proc_address(name) (void*)glXGetProcAddressARB ((const GLubyte*)name)
+#endif
+
+// GL_KHR_parallel_shader_compile, newer than the GLEW in libs/
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (GLAPIENTRY* MaxShaderCompilerThreadsProc) (GLuint count);
+
+static const uint32_t CACHE_MAGIC = 0x43425348; // "HSBC"
+static const uint32_t CACHE_VERSION = 1;
+
+// what precedes the binary in every cache file
+struct CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static double now_ms () {
+	using namespace std::chrono;
+	return (double)duration_cast<microseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+// 64-bit FNV-1a, chained through seed
+static uint64_t hash_string (const std::string& s, uint64_t seed) {
+	uint64_t h = seed;
+	for (size_t i = 0; i < s.size (); i++) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ull;
+	}
+	// separator so ("ab", "c") and ("a", "bc") differ
+	h ^= 0xff;
+	h *= 1099511628211ull;
+	return h;
+}
+
+static const int MAX_INCLUDE_DEPTH = 8;
+
+std::string feature_defines (uint32_t features, const char* const* names, int count) {
+	std::string defines;
+	for (int i = 0; i < count; i++) {
+		if (features & (1u << i)) {
+			defines += std::string ("#define ") + names[i] + " 1\n";
+		}
+	}
+	return defines;
+}
+
+static bool read_text_file (const char* file_name, std::string& out) {
+	std::ifstream file (file_name, std::ios::binary);
+	if (!file) {
+		fprintf (stderr, "ERROR: could not read %s\n", file_name);
+		return false;
+	}
+	std::stringstream contents;
+	contents << file.rdbuf ();
+	out = contents.str ();
+	return true;
+}
+
+// defines go right after #version, which has to stay the first line;
+// the #line afterwards keeps error messages pointing at the file's own lines
+static std::string insert_defines (const std::string& source, const std::string& defines) {
+	if (defines.empty ()) {
+		return source;
+	}
+	size_t version = source.find ("#version");
+	size_t line_end = version == std::string::npos ? std::string::npos : source.find ('\n', version);
+	if (line_end == std::string::npos) {
+		return defines + source;
+	}
+	return source.substr (0, line_end + 1) + defines + "#line 2 0\n" + source.substr (line_end + 1);
+}
+
+static std::string directory_of (const std::string& path) {
+	size_t slash = path.find_last_of ("/\\");
+	return slash == std::string::npos ? std::string () : path.substr (0, slash + 1);
+}
+
+// issues the compile, the status is only read by shader_compiled()
+static GLuint issue_shader (const std::string& source, GLenum type) {
+	GLuint shader = glCreateShader (type);
+	const GLchar* text = source.c_str ();
+	glShaderSource (shader, 1, &text, NULL);
+	glCompileShader (shader);
+	return shader;
+}
+
+static bool shader_compiled (const std::vector<std::string>& files, GLuint shader) {
+	GLint success = 0;
+	glGetShaderiv (shader, GL_COMPILE_STATUS, &success);
+	if (!success) {
+		GLchar log[1024] = { '\0' };
+		glGetShaderInfoLog (shader, sizeof (log), NULL, log);
+		// the log numbers sources in include order
+		fprintf (stderr, "Error compiling %s: %s\n", files[0].c_str (), log);
+		for (size_t i = 1; i < files.size (); i++) {
+			fprintf (stderr, "  source %d: %s\n", (int)i, files[i].c_str ());
+		}
+	}
+	return success != 0;
+}
+
+static bool has_extension (const char* name) {
+	GLint count = 0;
+	glGetIntegerv (GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++) {
+		if (strcmp ((const char*)glGetStringi (GL_EXTENSIONS, i), name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void ShaderCache::init (const char* dir, bool allow_parallel) {
+	directory = dir;
+#ifdef _WIN32
+	_mkdir (directory.c_str ());
+#else
+	mkdir (directory.c_str (), 0755);
+#endif
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary) {
+		glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	binaries = formats > 0;
+	driver = std::string ((const char*)glGetString (GL_VENDOR)) + "|" +
+		(const char*)glGetString (GL_RENDERER) + "|" + (const char*)glGetString (GL_VERSION);
+
+	parallel = false;
+	if (allow_parallel) {
+		MaxShaderCompilerThreadsProc max_threads = NULL;
+		if (has_extension ("GL_KHR_parallel_shader_compile")) {
+			max_threads = (MaxShaderCompilerThreadsProc)get_proc_address ("glMaxShaderCompilerThreadsKHR");
+		}
+		else if (has_extension ("GL_ARB_parallel_shader_compile")) {
+			max_threads = (MaxShaderCompilerThreadsProc)get_proc_address ("glMaxShaderCompilerThreadsARB");
+		}
+		if (max_threads) {
+			// 0xffffffff lets the driver pick the thread count
+			max_threads (0xffffffff);
+			parallel = true;
+		}
+	}
+	printf ("=> shader cache: %s, %s compile \n", binaries ? directory.c_str () : "no program binary formats",
+		parallel ? "parallel" : "serial");
+}
+
+std::string ShaderCache::entry_path (const char* name, uint64_t key) const {
+	char hex[17];
+	snprintf (hex, sizeof (hex), "%016llx", (unsigned long long)key);
+	return directory + "/" + name + "_" + hex + ".bin";
+}
+
+/*----------------------------- PREPROCESSOR -----------------------------*/
+
+// expands #include "file" lines in place, each file at most once per shader
+bool ShaderCache::load_source (const std::string& file_name, std::string& out, std::vector<std::string>& files, int depth) {
+	if (depth > MAX_INCLUDE_DEPTH) {
+		fprintf (stderr, "ERROR: includes nested too deeply at %s\n", file_name.c_str ());
+		return false;
+	}
+	std::string text;
+	if (!read_text_file (file_name.c_str (), text)) {
+		return false;
+	}
+	int source_number = (int)files.size ();
+	files.push_back (file_name);
+
+	std::istringstream lines (text);
+	std::string line;
+	int line_number = 0;
+	while (std::getline (lines, line)) {
+		line_number++;
+		size_t start = line.find_first_not_of (" \t");
+		if (start == std::string::npos || line.compare (start, 8, "#include") != 0) {
+			out += line;
+			out += '\n';
+			continue;
+		}
+		size_t open = line.find ('"', start);
+		size_t close = open == std::string::npos ? std::string::npos : line.find ('"', open + 1);
+		if (close == std::string::npos) {
+			fprintf (stderr, "ERROR: %s(%d): malformed #include\n", file_name.c_str (), line_number);
+			return false;
+		}
+		std::string included = directory_of (file_name) + line.substr (open + 1, close - open - 1);
+		bool seen = false;
+		for (size_t i = 0; i < files.size (); i++) {
+			seen = seen || files[i] == included;
+		}
+		if (!seen) {
+			char marker[32];
+			snprintf (marker, sizeof (marker), "#line 1 %d\n", (int)files.size ());
+			out += marker;
+			if (!load_source (included, out, files, depth + 1)) {
+				return false;
+			}
+		}
+		char marker[32];
+		snprintf (marker, sizeof (marker), "#line %d %d\n", line_number + 1, source_number);
+		out += marker;
+	}
+	return true;
+}
+
+/*----------------------------- CACHE FILES ------------------------------*/
+
+// hands the binary to program; whether the driver accepted it shows in finish()
+bool ShaderCache::load_binary (const std::string& path, uint64_t key, GLuint program) {
+	std::ifstream file (path.c_str (), std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	CacheHeader header;
+	if (!file.read ((char*)&header, sizeof (header)) || header.magic != CACHE_MAGIC ||
+		header.version != CACHE_VERSION || header.key != key || header.length == 0) {
+		return false;
+	}
+	std::vector<char> binary (header.length);
+	if (!file.read (&binary[0], header.length)) {
+		return false;
+	}
+	glProgramBinary (program, header.format, &binary[0], (GLsizei)header.length);
+	return true;
+}
+
+void ShaderCache::save_binary (const std::string& path, uint64_t key, GLuint program) {
+	GLint length = 0;
+	glGetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+	std::vector<char> binary (length);
+	CacheHeader header = { CACHE_MAGIC, CACHE_VERSION, key, 0, 0 };
+	GLenum format = 0;
+	glGetProgramBinary (program, length, NULL, &format, &binary[0]);
+	header.format = format;
+	header.length = (uint32_t)length;
+
+	std::ofstream file (path.c_str (), std::ios::binary | std::ios::trunc);
+	if (!file) {
+		fprintf (stderr, "WARNING: could not write %s\n", path.c_str ());
+		return;
+	}
+	file.write ((const char*)&header, sizeof (header));
+	file.write (&binary[0], length);
+}
+
+/*-------------------------------- BUILD ---------------------------------*/
+
+void ShaderCache::issue_source (Request& r) {
+	r.from_binary = false;
+	r.vertex = issue_shader (r.vertex_source, GL_VERTEX_SHADER);
+	r.fragment = issue_shader (r.fragment_source, GL_FRAGMENT_SHADER);
+	glAttachShader (r.program, r.vertex);
+	glAttachShader (r.program, r.fragment);
+	if (binaries) {
+		glProgramParameteri (r.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	// a link of shaders that failed to compile fails too, finish() reports both
+	glLinkProgram (r.program);
+}
+
+int ShaderCache::request (const char* name, const char* vertex_file, const char* fragment_file, const std::string& defines) {
+	double start = now_ms ();
+	Request r;
+	r.name = name;
+	r.vertex = r.fragment = 0;
+	r.done = false;
+	r.result = 0;
+	std::string vertex_source, fragment_source;
+	if (!load_source (vertex_file, vertex_source, r.vertex_files, 0) ||
+		!load_source (fragment_file, fragment_source, r.fragment_files, 0)) {
+		misses++;
+		failures++;
+		issue_ms += now_ms () - start;
+		return -1;
+	}
+
+	r.key = 14695981039346656037ull;
+	r.key = hash_string (vertex_source, r.key);
+	r.key = hash_string (fragment_source, r.key);
+	r.key = hash_string (defines, r.key);
+	r.key = hash_string (driver, r.key);
+	r.path = entry_path (name, r.key);
+	r.vertex_source = insert_defines (vertex_source, defines);
+	r.fragment_source = insert_defines (fragment_source, defines);
+
+	r.program = glCreateProgram ();
+	r.from_binary = binaries && load_binary (r.path, r.key, r.program);
+	if (!r.from_binary) {
+		issue_source (r);
+	}
+	requests.push_back (r);
+	issue_ms += now_ms () - start;
+	return (int)requests.size () - 1;
+}
+
+GLuint ShaderCache::program_of (int handle) const {
+	return handle < 0 ? 0 : requests[handle].program;
+}
+
+GLuint ShaderCache::finish (int handle) {
+	if (handle < 0) {
+		return 0;
+	}
+	Request& r = requests[handle];
+	if (r.done) {
+		return r.result;
+	}
+	double start = now_ms ();
+	r.done = true;
+	GLint success = 0;
+	glGetProgramiv (r.program, GL_LINK_STATUS, &success);
+
+	if (r.from_binary) {
+		if (success) {
+			hits++;
+			r.result = r.program;
+			wait_ms += now_ms () - start;
+			return r.result;
+		}
+		// the driver may reject its own binaries after an update, that is a normal miss;
+		// relinking the same program object keeps the name callers already hold
+		issue_source (r);
+		glGetProgramiv (r.program, GL_LINK_STATUS, &success);
+	}
+
+	misses++;
+	bool compiled = shader_compiled (r.vertex_files, r.vertex);
+	compiled = shader_compiled (r.fragment_files, r.fragment) && compiled;
+	// the program keeps what it needs, the shader objects only leak if kept around
+	glDetachShader (r.program, r.vertex);
+	glDetachShader (r.program, r.fragment);
+	glDeleteShader (r.vertex);
+	glDeleteShader (r.fragment);
+	r.vertex = r.fragment = 0;
+	r.vertex_source.clear ();
+	r.fragment_source.clear ();
+
+	if (!compiled || !success) {
+		if (compiled) {
+			GLchar log[1024] = { '\0' };
+			glGetProgramInfoLog (r.program, sizeof (log), NULL, log);
+			fprintf (stderr, "Error linking %s: %s\n", r.name.c_str (), log);
+		}
+		glDeleteProgram (r.program);
+		failures++;
+		wait_ms += now_ms () - start;
+		return 0;
+	}
+	if (binaries) {
+		save_binary (r.path, r.key, r.program);
+	}
+	r.result = r.program;
+	wait_ms += now_ms () - start;
+	return r.result;
+}
+
+void ShaderCache::poll () {
+	if (!parallel) {
+		// without the extension any status query would block
+		return;
+	}
+	for (size_t i = 0; i < requests.size (); i++) {
+		if (requests[i].done) {
+			continue;
+		}
+		GLint complete = 0;
+		glGetProgramiv (requests[i].program, GL_COMPLETION_STATUS_KHR, &complete);
+		if (complete) {
+			finish ((int)i);
+		}
+	}
+}
+
+void ShaderCache::report () const {
+	printf ("=> shaders: %d from cache, %d compiled from source, %d failed; %.2f ms issuing, %.2f ms waiting (%s compile) \n",
+		hits, misses - failures, failures, issue_ms, wait_ms, parallel ? "parallel" : "serial");
+}
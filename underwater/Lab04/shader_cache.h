@@ -0,0 +1,79 @@
+#ifndef _SHADER_CACHE_H_
+#define _SHADER_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+//! "#define NAME 1" line for every set bit, names[i] belongs to bit i
+std::string feature_defines (uint32_t features, const char* const* names, int count);
+
+/* builds programs from a vertex and a fragment shader file and keeps the
+   linked binaries on disk (glGetProgramBinary / glProgramBinary).
+   a cache entry is keyed on the hash of both sources, the permutation
+   defines and the driver's vendor, renderer and version strings, so any
+   edit or driver update falls back to compiling from source and rewrites
+   the entry. errors are reported and return 0, they never exit.
+   sources may #include "file" relative to themselves; the expanded text is
+   what gets hashed, so editing an included file invalidates its users.
+
+   building is split in two so the driver can work on every program at
+   once: request() issues the compile and link (or binary load) without
+   asking for any status and hands out the program name straight away,
+   finish() is the first status query and blocks until that program is
+   done. with GL_KHR_parallel_shader_compile the driver compiles on its own
+   threads and poll() finishes whatever GL_COMPLETION_STATUS reports done. */
+class ShaderCache {
+public:
+	//! directory is created if missing; parallel = false keeps the driver compiling serially
+	void init (const char* directory, bool parallel);
+	//! defines are inserted after the #version line, e.g. "#define FOG 1\n".
+	//! returns a handle for finish(), or -1 when a source file is unreadable
+	int request (const char* name, const char* vertex_file, const char* fragment_file, const std::string& defines);
+	//! program name of a request, valid before it is finished
+	GLuint program_of (int handle) const;
+	//! checks the result, blocking if needed; 0 when compile or link failed
+	GLuint finish (int handle);
+	//! finishes requests the driver reports complete, never blocks
+	void poll ();
+	//! one line with hits, misses and the time spent issuing and waiting
+	void report () const;
+
+	bool is_parallel () const { return parallel; }
+
+	int hits = 0;
+	int misses = 0;
+	int failures = 0;
+	double issue_ms = 0.0; // reading sources and binaries, issuing the GL calls
+	double wait_ms = 0.0; // blocked in finish() on status queries
+
+private:
+	struct Request {
+		std::string name;
+		std::string path;
+		uint64_t key;
+		GLuint program;
+		GLuint vertex, fragment; // 0 while the program came from a binary
+		bool from_binary;
+		bool done;
+		GLuint result;
+		// kept to compile from source if the driver rejects the binary
+		std::string vertex_source, fragment_source;
+		std::vector<std::string> vertex_files, fragment_files;
+	};
+
+	bool load_source (const std::string& file_name, std::string& out, std::vector<std::string>& files, int depth);
+	std::string entry_path (const char* name, uint64_t key) const;
+	bool load_binary (const std::string& path, uint64_t key, GLuint program);
+	void save_binary (const std::string& path, uint64_t key, GLuint program);
+	void issue_source (Request& r);
+
+	bool binaries = false;
+	bool parallel = false;
+	std::string directory;
+	std::string driver; // vendor, renderer and version, part of every key
+	std::vector<Request> requests;
+};
+
+#endif
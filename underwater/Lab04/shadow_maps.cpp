@@ -0,0 +1,209 @@
+#include "shadow_maps.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+static mat4 multiply (const mat4& a, const mat4& b) {
+	mat4 result = a;
+	return result * b;
+}
+
+// perspective from the light that just encloses bounds
+static mat4 fit_light_frustum (const vec3& light, const AABB& bounds) {
+	vec3 center ((bounds.min[0] + bounds.max[0]) * 0.5f, (bounds.min[1] + bounds.max[1]) * 0.5f,
+		(bounds.min[2] + bounds.max[2]) * 0.5f);
+	vec3 direction = center - light;
+	if (length2 (direction) < 1e-6f) {
+		direction = vec3 (0.0f, -1.0f, 0.0f);
+		center = vec3 (light.v[0], light.v[1] - 1.0f, light.v[2]);
+	}
+	direction = normalise (direction);
+	vec3 up = fabsf (direction.v[1]) > 0.99f ? vec3 (0.0f, 0.0f, 1.0f) : vec3 (0.0f, 1.0f, 0.0f);
+	mat4 view = look_at (light, center, up);
+
+	// corners behind the light (it can sit inside the bounds) are left out of the fit
+	float spread = 0.0f, nearest = 1e30f, farthest = 0.0f;
+	for (int i = 0; i < 8; i++) {
+		float corner[3] = { (i & 1) ? bounds.max[0] : bounds.min[0], (i & 2) ? bounds.max[1] : bounds.min[1],
+			(i & 4) ? bounds.max[2] : bounds.min[2] };
+		float x = view.m[0] * corner[0] + view.m[4] * corner[1] + view.m[8] * corner[2] + view.m[12];
+		float y = view.m[1] * corner[0] + view.m[5] * corner[1] + view.m[9] * corner[2] + view.m[13];
+		float depth = -(view.m[2] * corner[0] + view.m[6] * corner[1] + view.m[10] * corner[2] + view.m[14]);
+		farthest = std::max (farthest, depth);
+		if (depth <= 0.01f) {
+			nearest = 0.0f;
+			continue;
+		}
+		nearest = std::min (nearest, depth);
+		spread = std::max (spread, std::max (fabsf (x), fabsf (y)) / depth);
+	}
+	// at most 150 degrees across, wider maps waste almost every texel on the edges
+	spread = std::min (spread * 1.02f, 3.73f);
+	float fov = 2.0f * atanf (spread) * (float)ONE_RAD_IN_DEG;
+	float far_plane = std::max (farthest * 1.01f, 1.0f);
+	// depth precision goes with far / near, keep the near plane off the light
+	float near_plane = std::max (nearest * 0.99f, far_plane / 500.0f);
+	return multiply (perspective (fov, 1.0f, near_plane, far_plane), view);
+}
+
+bool ShadowMaps::create_map (Map& map, int size) {
+	map.size = size;
+	glGenTextures (1, &map.depth);
+	glBindTexture (GL_TEXTURE_2D, map.depth);
+	glTexImage2D (GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	// linear filtering with a compare mode gives 2x2 PCF for free
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture (GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers (1, &map.framebuffer);
+	glBindFramebuffer (GL_FRAMEBUFFER, map.framebuffer);
+	glFramebufferTexture2D (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, map.depth, 0);
+	glDrawBuffer (GL_NONE);
+	glReadBuffer (GL_NONE);
+	GLenum status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+	glBindFramebuffer (GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf (stderr, "ERROR: shadow map framebuffer incomplete (0x%x)\n", status);
+		return false;
+	}
+	return true;
+}
+
+bool ShadowMaps::init (int static_size, int dynamic_size) {
+	if (!create_map (static_map, static_size) || !create_map (dynamic_map, dynamic_size)) {
+		destroy ();
+		return false;
+	}
+	static_valid = false;
+	printf ("=> shadows: %dx%d static map, %dx%d dynamic map \n", static_size, static_size, dynamic_size, dynamic_size);
+	return true;
+}
+
+void ShadowMaps::destroy () {
+	Map* maps[] = { &static_map, &dynamic_map };
+	for (Map* map : maps) {
+		glDeleteFramebuffers (1, &map->framebuffer);
+		glDeleteTextures (1, &map->depth);
+		map->framebuffer = map->depth = 0;
+		map->size = 0;
+	}
+	glDeleteBuffers (1, &param_buffer);
+	param_buffer = 0;
+	static_valid = dynamic_valid = false;
+}
+
+/*-------------------------------- DRAWING --------------------------------*/
+
+void ShadowMaps::begin (Map& map) {
+	if (!saved) {
+		glGetIntegerv (GL_DRAW_FRAMEBUFFER_BINDING, &saved_framebuffer);
+		glGetIntegerv (GL_VIEWPORT, saved_viewport);
+		saved = true;
+	}
+	glBindFramebuffer (GL_FRAMEBUFFER, map.framebuffer);
+	glViewport (0, 0, map.size, map.size);
+	glEnable (GL_DEPTH_TEST);
+	glDepthFunc (GL_LESS);
+	glDepthMask (GL_TRUE);
+	glClear (GL_DEPTH_BUFFER_BIT);
+	// slope-scaled bias against acne, applied while drawing so the lookup stays a plain compare
+	glEnable (GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset (2.0f, 4.0f);
+}
+
+bool ShadowMaps::begin_static (const vec3& light, const AABB& bounds) {
+	if (!static_map.framebuffer) {
+		return false;
+	}
+	if (static_valid && memcmp (light.v, static_light.v, sizeof (light.v)) == 0 &&
+		memcmp (&bounds, &static_bounds, sizeof (bounds)) == 0) {
+		return false;
+	}
+	static_light = light;
+	static_bounds = bounds;
+	static_valid = true;
+	if (aabb_is_empty (bounds)) {
+		// nothing casts, an all-far map leaves everything lit
+		begin (static_map);
+		static_map.light_matrix = identity_mat4 ();
+		return false;
+	}
+	static_map.light_matrix = fit_light_frustum (light, bounds);
+	begin (static_map);
+	static_renders++;
+	return true;
+}
+
+bool ShadowMaps::begin_dynamic (const vec3& light, const AABB& bounds) {
+	dynamic_valid = dynamic_map.framebuffer && !aabb_is_empty (bounds);
+	if (!dynamic_valid) {
+		return false;
+	}
+	dynamic_map.light_matrix = fit_light_frustum (light, bounds);
+	begin (dynamic_map);
+	dynamic_renders++;
+	return true;
+}
+
+void ShadowMaps::end () {
+	if (!saved) {
+		return;
+	}
+	glDisable (GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer (GL_FRAMEBUFFER, saved_framebuffer);
+	glViewport (saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+	saved = false;
+}
+
+/*-------------------------------- LOOKUP --------------------------------*/
+
+void ShadowMaps::bind (const mat4& view, const vec3& light, GLuint first_unit, bool enabled) {
+	// std140 layout of ShadowParams in lighting.glsl
+	struct {
+		mat4 matrices[2]; // eye space to each map
+		float light[4]; // eye space
+		float state[4]; // enabled, dynamic map drawn
+	} params;
+	mat4 eye_to_world = inverse (view);
+	params.matrices[0] = multiply (static_map.light_matrix, eye_to_world);
+	params.matrices[1] = multiply (dynamic_map.light_matrix, eye_to_world);
+	for (int i = 0; i < 3; i++) {
+		params.light[i] = view.m[i] * light.v[0] + view.m[4 + i] * light.v[1] + view.m[8 + i] * light.v[2] + view.m[12 + i];
+	}
+	params.light[3] = 1.0f;
+	bool usable = enabled && static_map.framebuffer != 0;
+	params.state[0] = usable && static_valid ? 1.0f : 0.0f;
+	params.state[1] = usable && dynamic_valid ? 1.0f : 0.0f;
+	params.state[2] = params.state[3] = 0.0f;
+
+	// created here, the light has to reach the shaders even when the maps could not be made
+	if (!param_buffer) {
+		glGenBuffers (1, &param_buffer);
+	}
+	glBindBuffer (GL_UNIFORM_BUFFER, param_buffer);
+	glBufferData (GL_UNIFORM_BUFFER, sizeof (params), &params, GL_STREAM_DRAW);
+	glBindBuffer (GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase (GL_UNIFORM_BUFFER, 3, param_buffer);
+
+	glActiveTexture (GL_TEXTURE0 + first_unit);
+	glBindTexture (GL_TEXTURE_2D, static_map.depth);
+	glActiveTexture (GL_TEXTURE0 + first_unit + 1);
+	glBindTexture (GL_TEXTURE_2D, dynamic_map.depth);
+	glActiveTexture (GL_TEXTURE0);
+}
+
+void ShadowMaps::attach (GLuint program, GLuint first_unit) {
+	glUseProgram (program);
+	glUniform1i (glGetUniformLocation (program, "shadowStatic"), first_unit);
+	glUniform1i (glGetUniformLocation (program, "shadowDynamic"), first_unit + 1);
+	GLuint block = glGetUniformBlockIndex (program, "ShadowParams");
+	if (block != GL_INVALID_INDEX) {
+		glUniformBlockBinding (program, block, 3);
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef _SHADOW_MAPS_H_
+#define _SHADOW_MAPS_H_
+
+#include <GL/glew.h>
+#include "maths_funcs.h"
+#include "bvh.h"
+
+/* shadows of the main light from two depth maps.
+   the static map is fitted around the static world and only redrawn when
+   the light moves or the world is rebaked; every other frame it is reused
+   untouched. the dynamic map is small, fitted every frame around the
+   moving casters alone and redrawn every frame. the fragment shader looks
+   up both and keeps the darker result, so fish shadow the sea floor and
+   the wreck shadows the fish.
+   the light is a point light, both maps are perspective projections from
+   it. the ShadowParams block (binding 3) also carries the light itself in
+   eye space, so scene_lighting() and the shadows always agree. */
+class ShadowMaps {
+public:
+	bool init (int static_size, int dynamic_size);
+	void destroy ();
+	//! the static map is redrawn by the next begin_static ()
+	void invalidate () { static_valid = false; }
+
+	//! false while the cached static map still matches light and bounds. otherwise binds
+	//! and clears it, and the caller draws the static casters with get_static_matrix ()
+	bool begin_static (const vec3& light, const AABB& bounds);
+	//! binds and clears the dynamic map fitted around bounds, the caller draws the moving
+	//! casters with get_dynamic_matrix (); false if bounds is empty
+	bool begin_dynamic (const vec3& light, const AABB& bounds);
+	//! puts back the framebuffer and viewport that were bound before the first begin
+	void end ();
+
+	const mat4& get_static_matrix () const { return static_map.light_matrix; }
+	const mat4& get_dynamic_matrix () const { return dynamic_map.light_matrix; }
+
+	//! uploads ShadowParams for this camera and binds the maps to first_unit and first_unit + 1
+	void bind (const mat4& view, const vec3& light, GLuint first_unit, bool enabled);
+	//! points the samplers and the ShadowParams block of program at what bind () uses
+	void attach (GLuint program, GLuint first_unit);
+
+	// since the last report
+	int static_renders = 0;
+	int dynamic_renders = 0;
+
+private:
+	struct Map {
+		GLuint framebuffer = 0;
+		GLuint depth = 0;
+		int size = 0;
+		mat4 light_matrix; // world to the map's clip space
+	};
+
+	bool create_map (Map& map, int size);
+	void begin (Map& map);
+
+	Map static_map;
+	Map dynamic_map;
+	bool static_valid = false;
+	bool dynamic_valid = false; // something was drawn into the dynamic map this frame
+	vec3 static_light;
+	AABB static_bounds;
+	GLuint param_buffer = 0;
+
+	bool saved = false;
+	GLint saved_framebuffer = 0;
+	GLint saved_viewport[4];
+};
+
+#endif
@@ -0,0 +1,678 @@
+#include "software_rasterizer.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFT_RASTER_SSE
+#include <emmintrin.h>
+#endif
+
+// anything this close to the eye plane is treated as crossing it
+static const float NEAR_W = 1e-3f;
+// references are job << REFERENCE_SHIFT | triangle; a job emits at most 4 triangles per primitive
+static const int REFERENCE_SHIFT = 11;
+static const uint32_t REFERENCE_MASK = (1u << REFERENCE_SHIFT) - 1;
+// clip xyzw, eye xyz, eye normal xyz
+static const int CLIP_FLOATS = 10;
+
+static double now_us () {
+	using namespace std::chrono;
+	return (double)duration_cast<nanoseconds> (steady_clock::now ().time_since_epoch ()).count () * 0.001;
+}
+
+// a * b, both column-major
+static mat4 multiply (const mat4& a, const mat4& b) {
+	mat4 r;
+	for (int c = 0; c < 4; c++) {
+		for (int row = 0; row < 4; row++) {
+			r.m[c * 4 + row] = a.m[row] * b.m[c * 4] + a.m[4 + row] * b.m[c * 4 + 1] +
+				a.m[8 + row] * b.m[c * 4 + 2] + a.m[12 + row] * b.m[c * 4 + 3];
+		}
+	}
+	return r;
+}
+
+// first rows of m * (p, w)
+static void transform (const mat4& m, const float p[3], float w, float* out, int rows) {
+	for (int r = 0; r < rows; r++) {
+		out[r] = m.m[r] * p[0] + m.m[4 + r] * p[1] + m.m[8 + r] * p[2] + m.m[12 + r] * w;
+	}
+}
+
+static float smoothstep (float edge0, float edge1, float x) {
+	float t = (x - edge0) / (edge1 - edge0);
+	t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+	return t * t * (3.0f - 2.0f * t);
+}
+
+static uint32_t pack_color (const float c[3]) {
+	uint32_t rgba = 0xff000000u;
+	for (int i = 0; i < 3; i++) {
+		float v = c[i] < 0.0f ? 0.0f : c[i] > 1.0f ? 1.0f : c[i];
+		rgba |= (uint32_t)(v * 255.0f + 0.5f) << (i * 8);
+	}
+	return rgba;
+}
+
+/*---------------------------- WORKER POOL ----------------------------*/
+
+void SoftwareRasterizer::init (int threads) {
+	destroy ();
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency ();
+	}
+	thread_count = threads > 0 ? threads : 1;
+	quit = false;
+	for (int i = 1; i < thread_count; i++) {
+		workers.push_back (std::thread (&SoftwareRasterizer::worker_main, this, i));
+	}
+}
+
+void SoftwareRasterizer::destroy () {
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		quit = true;
+	}
+	wake.notify_all ();
+	for (std::thread& worker : workers) {
+		worker.join ();
+	}
+	workers.clear ();
+	thread_count = 1;
+}
+
+void SoftwareRasterizer::worker_main (int index) {
+	(void)index;
+	uint64_t seen = 0;
+	for (;;) {
+		Stage current;
+		{
+			std::unique_lock<std::mutex> lock (mutex);
+			wake.wait (lock, [&] { return quit || generation != seen; });
+			if (quit) {
+				return;
+			}
+			seen = generation;
+			current = stage;
+		}
+		run_stage (current);
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			if (--running == 0) {
+				done.notify_one ();
+			}
+		}
+	}
+}
+
+// every thread pulls items until none are left; returns when all of them are done
+void SoftwareRasterizer::run_parallel (Stage s, size_t items) {
+	item_count = items;
+	next_item = 0;
+	if (workers.empty ()) {
+		run_stage (s);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock (mutex);
+		stage = s;
+		running = (int)workers.size ();
+		generation++;
+	}
+	wake.notify_all ();
+	run_stage (s);
+	std::unique_lock<std::mutex> lock (mutex);
+	done.wait (lock, [&] { return running == 0; });
+}
+
+void SoftwareRasterizer::run_stage (Stage s) {
+	for (;;) {
+		size_t index = next_item.fetch_add (1);
+		if (index >= item_count) {
+			return;
+		}
+		if (s == STAGE_VERTEX) {
+			vertex_job (index);
+		}
+		else if (s == STAGE_BIN) {
+			bin_job (index);
+		}
+		else {
+			raster_tile (index);
+		}
+	}
+}
+
+/*---------------------------- FRAME ----------------------------*/
+
+void SoftwareRasterizer::begin_frame (int w, int h, const mat4& v, const mat4& p,
+	const SoftShading& s, const std::vector<ClusterLight>& scene_lights) {
+	w = w > 1 ? w : 1;
+	h = h > 1 ? h : 1;
+	if (w != width || h != height) {
+		width = w;
+		height = h;
+		tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+		color.assign ((size_t)width * height, 0);
+		depth.assign ((size_t)width * height, 1.0f);
+	}
+	view = v;
+	proj = p;
+	shading = s;
+	draws.clear ();
+
+	// lights go to eye space, and to every tile their bounding box covers on screen
+	size_t tiles = (size_t)tiles_x * tiles_y;
+	tile_lights.resize (tiles);
+	for (size_t i = 0; i < tiles; i++) {
+		tile_lights[i].clear ();
+	}
+	lights.clear ();
+	for (const ClusterLight& source : scene_lights) {
+		Light light;
+		transform (view, source.position, 1.0f, light.position, 3);
+		transform (view, source.direction, 0.0f, light.direction, 3);
+		light.radius = source.radius;
+		light.cos_outer = source.cos_outer;
+		for (int i = 0; i < 3; i++) {
+			light.color[i] = source.color[i] * source.intensity;
+		}
+		if (light.position[2] - light.radius > 0.0f) {
+			continue; // behind the eye
+		}
+		int tx0 = 0, ty0 = 0, tx1 = tiles_x - 1, ty1 = tiles_y - 1;
+		if (light.position[2] + light.radius < -NEAR_W) {
+			float fx0 = 1e30f, fy0 = 1e30f, fx1 = -1e30f, fy1 = -1e30f;
+			for (int corner = 0; corner < 8; corner++) {
+				float p3[3] = {
+					light.position[0] + (corner & 1 ? light.radius : -light.radius),
+					light.position[1] + (corner & 2 ? light.radius : -light.radius),
+					light.position[2] + (corner & 4 ? light.radius : -light.radius)
+				};
+				float c[4];
+				transform (proj, p3, 1.0f, c, 4);
+				float x = (c[0] / c[3] * 0.5f + 0.5f) * width;
+				float y = (c[1] / c[3] * 0.5f + 0.5f) * height;
+				fx0 = fminf (fx0, x);
+				fx1 = fmaxf (fx1, x);
+				fy0 = fminf (fy0, y);
+				fy1 = fmaxf (fy1, y);
+			}
+			if (fx1 < 0.0f || fy1 < 0.0f || fx0 >= (float)width || fy0 >= (float)height) {
+				continue;
+			}
+			tx0 = fx0 < 0.0f ? 0 : (int)fx0 / TILE_SIZE;
+			ty0 = fy0 < 0.0f ? 0 : (int)fy0 / TILE_SIZE;
+			tx1 = std::min (tiles_x - 1, (int)fx1 / TILE_SIZE);
+			ty1 = std::min (tiles_y - 1, (int)fy1 / TILE_SIZE);
+		}
+		uint16_t index = (uint16_t)lights.size ();
+		lights.push_back (light);
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				tile_lights[ty * tiles_x + tx].push_back (index);
+			}
+		}
+		if (lights.size () == 0xffff) {
+			break;
+		}
+	}
+}
+
+void SoftwareRasterizer::draw (const vec3* positions, const vec3* normals, size_t count, bool quads, const mat4& model, const vec3& c) {
+	if (!positions || count < (size_t)(quads ? 4 : 3)) {
+		return;
+	}
+	Draw d;
+	d.positions = positions;
+	d.normals = normals;
+	d.count = count;
+	d.quads = quads;
+	d.model = model;
+	memcpy (d.color, c.v, sizeof (d.color));
+	draws.push_back (d);
+}
+
+void SoftwareRasterizer::end_frame () {
+	size_t tiles = (size_t)tiles_x * tiles_y;
+
+	// fixed-size jobs keep the vertex stage balanced however uneven the draws are
+	double start = now_us ();
+	job_count = 0;
+	for (uint32_t d = 0; d < draws.size (); d++) {
+		uint32_t primitives = (uint32_t)(draws[d].count / (draws[d].quads ? 4 : 3));
+		for (uint32_t first = 0; first < primitives; first += JOB_PRIMITIVES) {
+			if (job_count == jobs.size ()) {
+				jobs.push_back (Job ());
+			}
+			Job& job = jobs[job_count++];
+			job.draw = d;
+			job.first = first;
+			job.last = std::min (primitives, first + JOB_PRIMITIVES);
+		}
+	}
+	tile_counts.resize (job_count * tiles);
+	tile_offsets.resize (job_count * tiles);
+	run_parallel (STAGE_VERTEX, job_count);
+	double vertex_end = now_us ();
+
+	// tile-major prefix sum, so each tile's references come out in job order
+	uint32_t total = 0;
+	tile_start.resize (tiles + 1);
+	for (size_t tile = 0; tile < tiles; tile++) {
+		tile_start[tile] = total;
+		for (size_t job = 0; job < job_count; job++) {
+			tile_offsets[job * tiles + tile] = total;
+			total += tile_counts[job * tiles + tile];
+		}
+	}
+	tile_start[tiles] = total;
+	references.resize (total);
+	run_parallel (STAGE_BIN, job_count);
+	double bin_end = now_us ();
+
+	tile_pixels.assign (tiles, 0);
+	run_parallel (STAGE_RASTER, tiles);
+	double raster_end = now_us ();
+
+	triangles = 0;
+	for (size_t job = 0; job < job_count; job++) {
+		triangles += jobs[job].triangles.size ();
+	}
+	pixels = 0;
+	for (size_t count : tile_pixels) {
+		pixels += count;
+	}
+	vertex_us = vertex_end - start;
+	bin_us = bin_end - vertex_end;
+	raster_us = raster_end - bin_end;
+
+	frames++;
+	total_triangles += (double)triangles;
+	total_pixels += (double)pixels;
+	total_vertex_us += vertex_us;
+	total_bin_us += bin_us;
+	total_raster_us += raster_us;
+}
+
+void SoftwareRasterizer::report () {
+	if (frames == 0) {
+		return;
+	}
+	double seconds = (total_vertex_us + total_bin_us + total_raster_us) * 1e-6;
+	printf ("Software raster: %d threads, %.0f triangles and %.0f pixels per frame, %.2f M triangles/s, %.1f M pixels/s "
+		"(%.2f ms vertex + %.2f ms binning + %.2f ms raster per frame)\n",
+		thread_count, total_triangles / frames, total_pixels / frames,
+		seconds > 0.0 ? total_triangles / seconds * 1e-6 : 0.0, seconds > 0.0 ? total_pixels / seconds * 1e-6 : 0.0,
+		total_vertex_us * 0.001 / frames, total_bin_us * 0.001 / frames, total_raster_us * 0.001 / frames);
+	frames = 0;
+	total_triangles = total_pixels = 0.0;
+	total_vertex_us = total_bin_us = total_raster_us = 0.0;
+}
+
+/*---------------------------- VERTEX STAGE ----------------------------*/
+
+void SoftwareRasterizer::vertex_job (size_t index) {
+	Job& job = jobs[index];
+	job.triangles.clear ();
+	size_t tiles = (size_t)tiles_x * tiles_y;
+	uint32_t* counts = &tile_counts[index * tiles];
+	memset (counts, 0, tiles * sizeof (uint32_t));
+
+	const Draw& draw = draws[job.draw];
+	mat4 model_view = multiply (view, draw.model);
+	int stride = draw.quads ? 4 : 3;
+	float corner[4][CLIP_FLOATS];
+	for (uint32_t primitive = job.first; primitive < job.last; primitive++) {
+		size_t base = (size_t)primitive * stride;
+		for (int k = 0; k < stride; k++) {
+			float* v = corner[k];
+			transform (model_view, draw.positions[base + k].v, 1.0f, v + 4, 3);
+			transform (proj, v + 4, 1.0f, v, 4);
+			if (draw.normals) {
+				// mat3 of the model-view matrix, as the vertex shader uses it
+				transform (model_view, draw.normals[base + k].v, 0.0f, v + 7, 3);
+			}
+		}
+		if (!draw.normals) {
+			const float* a = corner[0] + 4;
+			const float* b = corner[1] + 4;
+			const float* c = corner[2] + 4;
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			for (int k = 0; k < stride; k++) {
+				memcpy (corner[k] + 7, n, sizeof (n));
+			}
+		}
+
+		// quads are fanned from their first vertex, like GL_QUADS
+		for (int t = 0; t + 2 < stride; t++) {
+			const float* a = corner[0];
+			const float* b = corner[t + 1];
+			const float* c = corner[t + 2];
+			// trivially outside one side of the frustum
+			if ((a[0] > a[3] && b[0] > b[3] && c[0] > c[3]) || (a[0] < -a[3] && b[0] < -b[3] && c[0] < -c[3]) ||
+				(a[1] > a[3] && b[1] > b[3] && c[1] > c[3]) || (a[1] < -a[3] && b[1] < -b[3] && c[1] < -c[3]) ||
+				(a[2] > a[3] && b[2] > b[3] && c[2] > c[3])) {
+				continue;
+			}
+			// near plane z = -w; a triangle crossing it becomes a triangle or a quad
+			const float* in[3] = { a, b, c };
+			float distance[3];
+			bool inside = true;
+			for (int k = 0; k < 3; k++) {
+				distance[k] = in[k][2] + in[k][3];
+				inside = inside && distance[k] >= 0.0f && in[k][3] > NEAR_W;
+			}
+			if (inside) {
+				setup_triangle (job, in);
+				continue;
+			}
+			float polygon[4][CLIP_FLOATS];
+			int n = 0;
+			for (int k = 0; k < 3; k++) {
+				int next = (k + 1) % 3;
+				if (distance[k] >= 0.0f) {
+					memcpy (polygon[n++], in[k], sizeof (polygon[0]));
+				}
+				if ((distance[k] >= 0.0f) != (distance[next] >= 0.0f)) {
+					float s = distance[k] / (distance[k] - distance[next]);
+					for (int f = 0; f < CLIP_FLOATS; f++) {
+						polygon[n][f] = in[k][f] + (in[next][f] - in[k][f]) * s;
+					}
+					n++;
+				}
+			}
+			for (int k = 1; k + 1 < n; k++) {
+				const float* fan[3] = { polygon[0], polygon[k], polygon[k + 1] };
+				if (fan[0][3] > NEAR_W && fan[1][3] > NEAR_W && fan[2][3] > NEAR_W) {
+					setup_triangle (job, fan);
+				}
+			}
+		}
+	}
+
+	for (const Triangle& tri : job.triangles) {
+		for (int ty = tri.y0 / TILE_SIZE; ty <= tri.y1 / TILE_SIZE; ty++) {
+			for (int tx = tri.x0 / TILE_SIZE; tx <= tri.x1 / TILE_SIZE; tx++) {
+				counts[ty * tiles_x + tx]++;
+			}
+		}
+	}
+}
+
+// screen position, covered pixel rectangle and the planes; both faces are drawn, like the model program
+void SoftwareRasterizer::setup_triangle (Job& job, const float* const* v) {
+	float sx[3], sy[3], sz[3], inv_w[3];
+	for (int k = 0; k < 3; k++) {
+		inv_w[k] = 1.0f / v[k][3];
+		sx[k] = (v[k][0] * inv_w[k] * 0.5f + 0.5f) * width;
+		sy[k] = (v[k][1] * inv_w[k] * 0.5f + 0.5f) * height;
+		sz[k] = v[k][2] * inv_w[k] * 0.5f + 0.5f;
+	}
+	float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+	if (!(fabsf (area) > 1e-8f)) {
+		return;
+	}
+	int order[3] = { 0, 1, 2 };
+	if (area < 0.0f) {
+		order[1] = 2;
+		order[2] = 1;
+		area = -area;
+	}
+
+	// pixels whose centre lies inside the bounding box
+	float fx0 = fminf (sx[0], fminf (sx[1], sx[2]));
+	float fx1 = fmaxf (sx[0], fmaxf (sx[1], sx[2]));
+	float fy0 = fminf (sy[0], fminf (sy[1], sy[2]));
+	float fy1 = fmaxf (sy[0], fmaxf (sy[1], sy[2]));
+	int x0 = std::max (0, (int)ceilf (fx0 - 0.5f));
+	int y0 = std::max (0, (int)ceilf (fy0 - 0.5f));
+	int x1 = std::min (width - 1, (int)floorf (fx1 - 0.5f));
+	int y1 = std::min (height - 1, (int)floorf (fy1 - 0.5f));
+	if (x0 > x1 || y0 > y1) {
+		return;
+	}
+
+	Triangle tri;
+	tri.x0 = x0;
+	tri.y0 = y0;
+	tri.x1 = x1;
+	tri.y1 = y1;
+	// planes relative to the box corner keep the constant terms small
+	tri.origin_x = (float)x0;
+	tri.origin_y = (float)y0;
+	float lx[3], ly[3];
+	for (int k = 0; k < 3; k++) {
+		lx[k] = sx[order[k]] - tri.origin_x;
+		ly[k] = sy[order[k]] - tri.origin_y;
+	}
+	// edge i is opposite vertex i, scaled so it reads 1 at vertex i
+	float inv_area = 1.0f / area;
+	for (int i = 0; i < 3; i++) {
+		int p = (i + 1) % 3, q = (i + 2) % 3;
+		tri.edge[i][0] = (ly[p] - ly[q]) * inv_area;
+		tri.edge[i][1] = (lx[q] - lx[p]) * inv_area;
+		tri.edge[i][2] = (lx[p] * ly[q] - ly[p] * lx[q]) * inv_area;
+	}
+	for (int j = 0; j < 3; j++) {
+		tri.depth[j] = 0.0f;
+		for (int i = 0; i < 3; i++) {
+			tri.depth[j] += tri.edge[i][j] * sz[order[i]];
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		const float* src = v[order[i]];
+		tri.inv_w[i] = inv_w[order[i]];
+		memcpy (tri.eye[i], src + 4, sizeof (tri.eye[i]));
+		memcpy (tri.normal[i], src + 7, sizeof (tri.normal[i]));
+	}
+	memcpy (tri.color, draws[job.draw].color, sizeof (tri.color));
+	job.triangles.push_back (tri);
+}
+
+/*---------------------------- BINNING ----------------------------*/
+
+void SoftwareRasterizer::bin_job (size_t index) {
+	size_t tiles = (size_t)tiles_x * tiles_y;
+	uint32_t* offsets = &tile_offsets[index * tiles];
+	const std::vector<Triangle>& triangles = jobs[index].triangles;
+	for (uint32_t i = 0; i < triangles.size (); i++) {
+		const Triangle& tri = triangles[i];
+		uint32_t reference = (uint32_t)index << REFERENCE_SHIFT | i;
+		for (int ty = tri.y0 / TILE_SIZE; ty <= tri.y1 / TILE_SIZE; ty++) {
+			for (int tx = tri.x0 / TILE_SIZE; tx <= tri.x1 / TILE_SIZE; tx++) {
+				references[offsets[ty * tiles_x + tx]++] = reference;
+			}
+		}
+	}
+}
+
+/*---------------------------- RASTER STAGE ----------------------------*/
+
+// simpleFragmentShader for one pixel; w are the screen-space barycentric weights
+uint32_t SoftwareRasterizer::shade (const Triangle& tri, const float w[3], const std::vector<uint16_t>& list) const {
+	const SoftShading& s = shading;
+	// perspective-correct weights
+	float p[3] = { w[0] * tri.inv_w[0], w[1] * tri.inv_w[1], w[2] * tri.inv_w[2] };
+	float sum = p[0] + p[1] + p[2];
+	float scale = sum > 0.0f ? 1.0f / sum : 0.0f;
+	float P[3], N[3];
+	for (int i = 0; i < 3; i++) {
+		P[i] = (p[0] * tri.eye[0][i] + p[1] * tri.eye[1][i] + p[2] * tri.eye[2][i]) * scale;
+		N[i] = (p[0] * tri.normal[0][i] + p[1] * tri.normal[1][i] + p[2] * tri.normal[2][i]) * scale;
+	}
+	float length = sqrtf (N[0] * N[0] + N[1] * N[1] + N[2] * N[2]);
+	if (length > 0.0f) {
+		N[0] /= length;
+		N[1] /= length;
+		N[2] /= length;
+	}
+
+	// the original light
+	float L[3] = { s.light_position[0] - P[0], s.light_position[1] - P[1], s.light_position[2] - P[2] };
+	float distance = sqrtf (L[0] * L[0] + L[1] * L[1] + L[2] * L[2]);
+	float diffuse = 0.0f;
+	if (distance > 0.0f) {
+		diffuse = fmaxf ((L[0] * N[0] + L[1] * N[1] + L[2] * N[2]) / distance, 0.0f) /
+			(1.0f + 0.02f * distance + 0.001f * distance * distance);
+	}
+	float intensity[3];
+	for (int i = 0; i < 3; i++) {
+		intensity[i] = s.ld[i] * s.kd[i] * diffuse;
+	}
+
+	// clustered_lighting(), over the tile's list instead of the cluster's
+	for (size_t k = 0; k < list.size (); k++) {
+		const Light& light = lights[list[k]];
+		float D[3] = { light.position[0] - P[0], light.position[1] - P[1], light.position[2] - P[2] };
+		float d2 = D[0] * D[0] + D[1] * D[1] + D[2] * D[2];
+		if (d2 >= light.radius * light.radius) {
+			continue;
+		}
+		float d = sqrtf (d2);
+		if (d > 0.0f) {
+			D[0] /= d;
+			D[1] /= d;
+			D[2] /= d;
+		}
+		float window = 1.0f - d2 / (light.radius * light.radius);
+		float attenuation = window * window / (1.0f + d2);
+		if (light.cos_outer > -1.0f) {
+			float cos_angle = -(D[0] * light.direction[0] + D[1] * light.direction[1] + D[2] * light.direction[2]);
+			attenuation *= smoothstep (light.cos_outer, light.cos_outer + (1.0f - light.cos_outer) * 0.25f, cos_angle);
+		}
+		float lambert = fmaxf (N[0] * D[0] + N[1] * D[1] + N[2] * D[2], 0.0f) * attenuation;
+		for (int i = 0; i < 3; i++) {
+			intensity[i] += light.color[i] * lambert;
+		}
+	}
+
+	float eye_distance = sqrtf (P[0] * P[0] + P[1] * P[1] + P[2] * P[2]);
+	float visibility;
+	if (s.fog_mode == 1) {
+		visibility = expf (-s.fog_density * eye_distance);
+	}
+	else if (s.fog_mode == 2) {
+		float f = s.fog_density * eye_distance;
+		visibility = expf (-f * f);
+	}
+	else {
+		visibility = (s.fog_end - eye_distance) / (s.fog_end - s.fog_start);
+		visibility = visibility < 0.0f ? 0.0f : visibility > 1.0f ? 1.0f : visibility;
+	}
+	float out[3];
+	for (int i = 0; i < 3; i++) {
+		float surface = (intensity[i] + s.ambient[i]) * tri.color[i];
+		out[i] = s.fog_color[i] + (surface - s.fog_color[i]) * visibility;
+	}
+	return pack_color (out);
+}
+
+void SoftwareRasterizer::raster_tile (size_t index) {
+	int rx0 = (int)(index % tiles_x) * TILE_SIZE;
+	int ry0 = (int)(index / tiles_x) * TILE_SIZE;
+	int rx1 = std::min (width, rx0 + TILE_SIZE) - 1;
+	int ry1 = std::min (height, ry0 + TILE_SIZE) - 1;
+
+	uint32_t background = pack_color (shading.fog_color);
+	for (int y = ry0; y <= ry1; y++) {
+		std::fill (&color[(size_t)y * width + rx0], &color[(size_t)y * width + rx1] + 1, background);
+		std::fill (&depth[(size_t)y * width + rx0], &depth[(size_t)y * width + rx1] + 1, 1.0f);
+	}
+
+	const std::vector<uint16_t>& list = tile_lights[index];
+	size_t shaded = 0;
+#ifdef SOFT_RASTER_SSE
+	const __m128 lane = _mm_set_ps (3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 zero = _mm_setzero_ps ();
+#endif
+	for (uint32_t r = tile_start[index]; r < tile_start[index + 1]; r++) {
+		uint32_t reference = references[r];
+		const Triangle& tri = jobs[reference >> REFERENCE_SHIFT].triangles[reference & REFERENCE_MASK];
+		int bx0 = std::max (rx0, tri.x0), bx1 = std::min (rx1, tri.x1);
+		int by0 = std::max (ry0, tri.y0), by1 = std::min (ry1, tri.y1);
+#ifdef SOFT_RASTER_SSE
+		const __m128 a0 = _mm_set1_ps (tri.edge[0][0]), a1 = _mm_set1_ps (tri.edge[1][0]);
+		const __m128 a2 = _mm_set1_ps (tri.edge[2][0]), az = _mm_set1_ps (tri.depth[0]);
+#endif
+		for (int y = by0; y <= by1; y++) {
+			float py = y + 0.5f - tri.origin_y;
+			float row[3], row_z = tri.depth[1] * py + tri.depth[2];
+			for (int i = 0; i < 3; i++) {
+				row[i] = tri.edge[i][1] * py + tri.edge[i][2];
+			}
+			float* depth_row = &depth[(size_t)y * width];
+			uint32_t* color_row = &color[(size_t)y * width];
+#ifdef SOFT_RASTER_SSE
+			const __m128 r0 = _mm_set1_ps (row[0]), r1 = _mm_set1_ps (row[1]);
+			const __m128 r2 = _mm_set1_ps (row[2]), rz = _mm_set1_ps (row_z);
+#endif
+			for (int x = bx0; x <= bx1; x += 4) {
+				float px = x + 0.5f - tri.origin_x;
+				int lanes = std::min (4, bx1 - x + 1);
+				float w0[4], w1[4], w2[4], z[4];
+				int mask;
+#ifdef SOFT_RASTER_SSE
+				__m128 vx = _mm_add_ps (_mm_set1_ps (px), lane);
+				__m128 e0 = _mm_add_ps (_mm_mul_ps (a0, vx), r0);
+				__m128 e1 = _mm_add_ps (_mm_mul_ps (a1, vx), r1);
+				__m128 e2 = _mm_add_ps (_mm_mul_ps (a2, vx), r2);
+				__m128 vz = _mm_add_ps (_mm_mul_ps (az, vx), rz);
+				__m128 inside = _mm_and_ps (_mm_and_ps (_mm_cmpge_ps (e0, zero), _mm_cmpge_ps (e1, zero)), _mm_cmpge_ps (e2, zero));
+				// only the lanes up to the tile's right edge are read, the rest belong to the
+				// neighbouring tile's thread or lie past the end of the row
+				__m128 stored;
+				if (lanes == 4) {
+					stored = _mm_loadu_ps (depth_row + x);
+				} else {
+					float tail[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+					for (int l = 0; l < lanes; l++) {
+						tail[l] = depth_row[x + l];
+					}
+					stored = _mm_loadu_ps (tail);
+				}
+				inside = _mm_and_ps (inside, _mm_cmplt_ps (vz, stored));
+				mask = _mm_movemask_ps (inside) & ((1 << lanes) - 1);
+				if (!mask) {
+					continue;
+				}
+				_mm_storeu_ps (w0, e0);
+				_mm_storeu_ps (w1, e1);
+				_mm_storeu_ps (w2, e2);
+				_mm_storeu_ps (z, vz);
+#else
+				mask = 0;
+				for (int l = 0; l < lanes; l++) {
+					float lx = px + l;
+					w0[l] = tri.edge[0][0] * lx + row[0];
+					w1[l] = tri.edge[1][0] * lx + row[1];
+					w2[l] = tri.edge[2][0] * lx + row[2];
+					z[l] = tri.depth[0] * lx + row_z;
+					if (w0[l] >= 0.0f && w1[l] >= 0.0f && w2[l] >= 0.0f && z[l] < depth_row[x + l]) {
+						mask |= 1 << l;
+					}
+				}
+				if (!mask) {
+					continue;
+				}
+#endif
+				for (int l = 0; l < lanes; l++) {
+					if (!(mask & (1 << l))) {
+						continue;
+					}
+					float w[3] = { w0[l], w1[l], w2[l] };
+					depth_row[x + l] = z[l];
+					color_row[x + l] = shade (tri, w, list);
+					shaded++;
+				}
+			}
+		}
+	}
+	tile_pixels[index] = shaded;
+}
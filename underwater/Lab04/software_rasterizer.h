@@ -0,0 +1,160 @@
+#ifndef _SOFTWARE_RASTERIZER_H_
+#define _SOFTWARE_RASTERIZER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "maths_funcs.h"
+#include "clustered_lighting.h"
+
+// everything simpleFragmentShader reads besides the per-draw colour
+struct SoftShading {
+	float light_position[3]; // LightPosition, compared against eye-space positions like the shader does
+	float kd[3];
+	float ld[3];
+	float ambient[3];
+	float fog_color[3];
+	float fog_start, fog_end, fog_density;
+	int fog_mode; // 0 linear, 1 exp, 2 exp2
+};
+
+/* tile-based software rasterizer, a CPU stand-in for the model program.
+   draws are only recorded; end_frame runs three parallel stages over a
+   pool of worker threads (the calling thread is worker 0):
+   - vertex: fixed-size jobs of primitives are transformed, clipped against
+     the near plane and set up as edge and depth planes, and each job counts
+     the screen tiles its triangles touch
+   - binning: a prefix sum over those counts gives every (tile, job) pair
+     its slot, and the jobs scatter their triangle references into one array
+     ordered by tile, then job, so the draw order is kept without locks
+   - raster: tiles are handed out to workers; each clears its tile, walks its
+     references with 4-wide SSE edge functions and depth tests, and shades
+     the covered pixels with the same lighting and fog as the shader.
+   no texturing, textured draws come out in their diffuse colour. */
+class SoftwareRasterizer {
+public:
+	static const int TILE_SIZE = 64;
+	static const int JOB_PRIMITIVES = 512;
+
+	//! threads <= 0 uses every hardware thread
+	void init (int threads);
+	//! stops and joins the workers
+	void destroy ();
+	~SoftwareRasterizer () { destroy (); }
+
+	void begin_frame (int width, int height, const mat4& view, const mat4& proj,
+		const SoftShading& shading, const std::vector<ClusterLight>& lights);
+	//! the arrays are read in end_frame and have to live until then.
+	//! normals may be NULL (face normals are used), quads takes 4 vertices per primitive
+	void draw (const vec3* positions, const vec3* normals, size_t count, bool quads, const mat4& model, const vec3& color);
+	//! transforms, bins and rasterizes everything drawn since begin_frame
+	void end_frame ();
+
+	//! RGBA8, bottom row first like glTexImage2D expects
+	const uint32_t* get_color () const { return color.empty () ? NULL : &color[0]; }
+	int get_width () const { return width; }
+	int get_height () const { return height; }
+	int get_thread_count () const { return thread_count; }
+	//! throughput since the last report, then resets it
+	void report ();
+
+	// last frame
+	size_t triangles = 0; // after clipping and culling
+	size_t pixels = 0; // shaded, i.e. passed the depth test
+	double vertex_us = 0.0;
+	double bin_us = 0.0;
+	double raster_us = 0.0;
+
+private:
+	struct Draw {
+		const vec3* positions;
+		const vec3* normals;
+		size_t count;
+		bool quads;
+		mat4 model;
+		float color[3];
+	};
+	// screen-space triangle; the planes are relative to (origin_x, origin_y)
+	// and give the barycentric weight of each vertex directly
+	struct Triangle {
+		float edge[3][3]; // a, b, c of weight i = a * x + b * y + c
+		float depth[3]; // depth plane in the same form
+		float inv_w[3];
+		float eye[3][3];
+		float normal[3][3];
+		float color[3];
+		float origin_x, origin_y;
+		int x0, y0, x1, y1; // covered pixel rectangle, inclusive
+	};
+	struct Job {
+		uint32_t draw;
+		uint32_t first, last; // primitives
+		std::vector<Triangle> triangles;
+	};
+	// eye space, intensity folded into the colour
+	struct Light {
+		float position[3];
+		float radius;
+		float color[3];
+		float direction[3];
+		float cos_outer;
+	};
+	enum Stage { STAGE_VERTEX, STAGE_BIN, STAGE_RASTER };
+
+	void run_parallel (Stage stage, size_t items);
+	void worker_main (int index);
+	void run_stage (Stage stage);
+	void vertex_job (size_t index);
+	void bin_job (size_t index);
+	void raster_tile (size_t index);
+	void setup_triangle (Job& job, const float* const* v);
+	uint32_t shade (const Triangle& tri, const float w[3], const std::vector<uint16_t>& list) const;
+
+	int width = 0;
+	int height = 0;
+	int tiles_x = 0;
+	int tiles_y = 0;
+	mat4 view;
+	mat4 proj;
+	SoftShading shading;
+	std::vector<Light> lights;
+	std::vector<std::vector<uint16_t> > tile_lights;
+
+	std::vector<Draw> draws;
+	std::vector<Job> jobs;
+	size_t job_count = 0; // jobs beyond this are kept only for their capacity
+	std::vector<uint32_t> tile_counts; // job-major, jobs * tiles
+	std::vector<uint32_t> tile_offsets; // where each (job, tile) pair writes, same layout
+	std::vector<uint32_t> tile_start; // tiles + 1
+	std::vector<uint32_t> references; // job << 11 | triangle
+	std::vector<uint32_t> color;
+	std::vector<float> depth;
+	std::vector<size_t> tile_pixels; // shaded per tile, summed after the raster stage
+
+	// worker pool
+	int thread_count = 1;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation = 0;
+	int running = 0;
+	bool quit = false;
+	Stage stage = STAGE_VERTEX;
+	size_t item_count = 0;
+	std::atomic<size_t> next_item;
+
+	// totals since the last report
+	int frames = 0;
+	double total_triangles = 0.0;
+	double total_pixels = 0.0;
+	double total_vertex_us = 0.0;
+	double total_bin_us = 0.0;
+	double total_raster_us = 0.0;
+};
+
+#endif
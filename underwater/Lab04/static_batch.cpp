@@ -0,0 +1,81 @@
+#include "static_batch.h"
+#include <math.h>
+#include <map>
+#include <tuple>
+
+typedef std::tuple<uint32_t, int, int, int> BatchKey;
+
+// upper 3x3 of the inverse transpose, keeps normals right under non-uniform scale
+static mat3 normal_matrix (const mat4& m) {
+	mat4 inv_t = transpose (inverse (m));
+	mat3 n;
+	for (int col = 0; col < 3; col++) {
+		for (int row = 0; row < 3; row++) {
+			n.m[col * 3 + row] = inv_t.m[col * 4 + row];
+		}
+	}
+	return n;
+}
+
+void bake_static_batches (const std::vector<BakeInput>& inputs, float cell_size, std::vector<BakedBatch>& out) {
+	std::map<BatchKey, size_t> lookup;
+	for (const BakeInput& input : inputs) {
+		const std::vector<vec3>& positions = *input.positions;
+		if (positions.empty ()) {
+			continue;
+		}
+		const float* m = input.transform.m;
+		mat3 nm = normal_matrix (input.transform);
+
+		AABB world = aabb_transform (aabb_from_points (positions), input.transform);
+		vec3 centre = aabb_center (world);
+		int cell[3];
+		for (int i = 0; i < 3; i++) {
+			cell[i] = (int)floorf (centre.v[i] / cell_size);
+		}
+		BatchKey key (input.material, cell[0], cell[1], cell[2]);
+		auto found = lookup.find (key);
+		if (found == lookup.end ()) {
+			found = lookup.insert (std::make_pair (key, out.size ())).first;
+			BakedBatch batch;
+			batch.material = input.material;
+			for (int i = 0; i < 3; i++) {
+				batch.cell[i] = cell[i];
+			}
+			batch.bounds = aabb_empty ();
+			out.push_back (batch);
+		}
+		BakedBatch& batch = out[found->second];
+		aabb_merge (batch.bounds, world);
+		batch.sources.push_back (input.source);
+
+		size_t count = positions.size ();
+		batch.positions.reserve (batch.positions.size () + count);
+		batch.normals.reserve (batch.normals.size () + count);
+		batch.texcoords.reserve (batch.texcoords.size () + count);
+		for (size_t i = 0; i < count; i++) {
+			const float* p = positions[i].v;
+			batch.positions.push_back (vec3 (
+				m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12],
+				m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13],
+				m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14]));
+
+			vec3 n (0.0f, 1.0f, 0.0f);
+			if (i < input.normals->size ()) {
+				const float* s = (*input.normals)[i].v;
+				n = normalise (vec3 (
+					nm.m[0] * s[0] + nm.m[3] * s[1] + nm.m[6] * s[2],
+					nm.m[1] * s[0] + nm.m[4] * s[1] + nm.m[7] * s[2],
+					nm.m[2] * s[0] + nm.m[5] * s[1] + nm.m[8] * s[2]));
+			}
+			batch.normals.push_back (n);
+
+			if (i < input.texcoords->size ()) {
+				batch.texcoords.push_back ((*input.texcoords)[i]);
+			}
+			else {
+				batch.texcoords.push_back (vec2 (0.0f, 0.0f));
+			}
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef _STATIC_BATCH_H_
+#define _STATIC_BATCH_H_
+
+#include <stdint.h>
+#include <vector>
+#include "maths_funcs.h"
+#include "bvh.h"
+
+// one immovable mesh placed in the world
+struct BakeInput {
+	const std::vector<vec3>* positions;
+	const std::vector<vec3>* normals;
+	const std::vector<vec2>* texcoords; // may be empty
+	mat4 transform;
+	uint32_t material; // meshes only merge when this matches
+	uint32_t source; // caller's id, kept so batches can be traced back
+};
+
+// world-space geometry of every input that shares a material and a grid cell
+struct BakedBatch {
+	uint32_t material;
+	int cell[3];
+	AABB bounds;
+	std::vector<vec3> positions;
+	std::vector<vec3> normals;
+	std::vector<vec2> texcoords;
+	std::vector<uint32_t> sources;
+};
+
+/* pre-transforms the inputs and merges them per (material, cell).
+   an input goes to the cell that holds the centre of its bounds, so a batch
+   can stick out of its cell but never by more than its largest member. */
+void bake_static_batches (const std::vector<BakeInput>& inputs, float cell_size, std::vector<BakedBatch>& out);
+
+#endif
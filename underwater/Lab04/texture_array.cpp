@@ -0,0 +1,131 @@
+#include "texture_array.h"
+#include "stb_image.h"
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+int TextureArray::add (const char* path) {
+	for (size_t i = 0; i < paths.size (); i++) {
+		if (paths[i] == path) {
+			return (int)i;
+		}
+	}
+	if (texture) {
+		fprintf (stderr, "ERROR: texture array is already built, %s was not added\n", path);
+		return -1;
+	}
+	int width, height, channels;
+	unsigned char* data = stbi_load (path, &width, &height, &channels, 4);
+	if (!data) {
+		fprintf (stderr, "ERROR: could not read texture %s\n", path);
+		return -1;
+	}
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.pixels.assign (data, data + (size_t)width * height * 4);
+	stbi_image_free (data);
+	images.push_back (image);
+	paths.push_back (path);
+	printf ("=> texture %s (%dx%d) is layer %d \n", path, width, height, (int)paths.size () - 1);
+	return (int)paths.size () - 1;
+}
+
+// bilinear, wrapping at the edges like GL_REPEAT so tiled textures stay seamless
+static void resample (const uint8_t* src, int src_w, int src_h, uint8_t* dst, int size) {
+	float scale_x = (float)src_w / size;
+	float scale_y = (float)src_h / size;
+	for (int y = 0; y < size; y++) {
+		float fy = (y + 0.5f) * scale_y - 0.5f;
+		int y0 = (int)floorf (fy);
+		float ty = fy - y0;
+		int row0 = ((y0 % src_h) + src_h) % src_h;
+		int row1 = (row0 + 1) % src_h;
+		for (int x = 0; x < size; x++) {
+			float fx = (x + 0.5f) * scale_x - 0.5f;
+			int x0 = (int)floorf (fx);
+			float tx = fx - x0;
+			int col0 = ((x0 % src_w) + src_w) % src_w;
+			int col1 = (col0 + 1) % src_w;
+			const uint8_t* a = src + ((size_t)row0 * src_w + col0) * 4;
+			const uint8_t* b = src + ((size_t)row0 * src_w + col1) * 4;
+			const uint8_t* c = src + ((size_t)row1 * src_w + col0) * 4;
+			const uint8_t* d = src + ((size_t)row1 * src_w + col1) * 4;
+			uint8_t* out = dst + ((size_t)y * size + x) * 4;
+			for (int i = 0; i < 4; i++) {
+				float top = a[i] + (b[i] - a[i]) * tx;
+				float bottom = c[i] + (d[i] - c[i]) * tx;
+				out[i] = (uint8_t)(top + (bottom - top) * ty + 0.5f);
+			}
+		}
+	}
+}
+
+bool TextureArray::build (int max_size) {
+	if (texture || images.empty ()) {
+		return texture != 0;
+	}
+	GLint max_texture = 0, max_layers = 0;
+	glGetIntegerv (GL_MAX_TEXTURE_SIZE, &max_texture);
+	glGetIntegerv (GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	if ((int)images.size () > max_layers) {
+		fprintf (stderr, "ERROR: %d textures, the array holds %d layers at most\n", (int)images.size (), max_layers);
+		return false;
+	}
+	// the largest side rounded up to a power of two, so the mip chain halves evenly
+	int largest = 1;
+	for (const Image& image : images) {
+		largest = std::max (largest, std::max (image.width, image.height));
+	}
+	size = 1;
+	while (size < largest && size < max_size && size < max_texture) {
+		size *= 2;
+	}
+	int levels = 1;
+	while ((size >> levels) > 0) {
+		levels++;
+	}
+
+	glGenTextures (1, &texture);
+	glBindTexture (GL_TEXTURE_2D_ARRAY, texture);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri (GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexImage3D (GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, (GLsizei)images.size (), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	std::vector<uint8_t> layer ((size_t)size * size * 4);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < images.size (); i++) {
+		const Image& image = images[i];
+		const uint8_t* pixels = &image.pixels[0];
+		if (image.width != size || image.height != size) {
+			resample (pixels, image.width, image.height, &layer[0], size);
+			pixels = &layer[0];
+		}
+		glTexSubImage3D (GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap (GL_TEXTURE_2D_ARRAY);
+	glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
+
+	std::vector<Image> ().swap (images);
+	double mb = (double)size * size * 4 * paths.size () * 4.0 / 3.0 / (1024.0 * 1024.0);
+	printf ("=> texture array: %d layers of %dx%d, %.1f MB with mipmaps \n", (int)paths.size (), size, size, mb);
+	return true;
+}
+
+void TextureArray::destroy () {
+	glDeleteTextures (1, &texture);
+	texture = 0;
+	size = 0;
+	paths.clear ();
+	images.clear ();
+}
+
+void TextureArray::bind (int unit) const {
+	glActiveTexture (GL_TEXTURE0 + unit);
+	glBindTexture (GL_TEXTURE_2D_ARRAY, texture);
+	glActiveTexture (GL_TEXTURE0);
+}
@@ -0,0 +1,44 @@
+#ifndef _TEXTURE_ARRAY_H_
+#define _TEXTURE_ARRAY_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+/* material textures packed into the layers of one GL_TEXTURE_2D_ARRAY.
+   images are read as RGBA8 when they are added and resampled to one
+   power-of-two size when the array is built. every layer keeps its own
+   [0,1] texcoord range, so GL_REPEAT tiling still works, which an atlas
+   would lose. with a single texture bound for the whole frame, draws that
+   only differ in their material share a program and a batch, and the
+   shader picks the layer. */
+class TextureArray {
+public:
+	//! reads the image now, the same path twice gives the same layer; -1 if it could not be read
+	//! or the array was already built
+	int add (const char* path);
+	//! resamples and uploads every added image with mipmaps, at most max_size on a side,
+	//! and frees the CPU copies
+	bool build (int max_size);
+	void destroy ();
+	//! binds the array to GL_TEXTURE0 + unit and leaves GL_TEXTURE0 active
+	void bind (int unit) const;
+
+	GLuint get_texture () const { return texture; }
+	int get_layer_count () const { return (int)paths.size (); }
+	int get_size () const { return size; }
+
+private:
+	struct Image {
+		int width, height;
+		std::vector<uint8_t> pixels; // RGBA
+	};
+
+	std::vector<std::string> paths; // layer i was read from paths[i]
+	std::vector<Image> images; // waiting for build ()
+	GLuint texture = 0;
+	int size = 0;
+};
+
+#endif